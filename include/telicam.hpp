@@ -1,12 +1,26 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
 #include <opencv2/core/core.hpp>
 
 #include <TeliCamApi.h>
 #include <TeliCamUtl.h>
 
+#include "telicam_allocator.hpp"
+#include "telicam_clock.hpp"
+#include "telicam_frame.hpp"
+#include "telicam_metrics.hpp"
+#include "telicam_preview.hpp"
+#include "telicam_timing.hpp"
+#include "telicam_undistort.hpp"
+
 /**
- * @brief Driver for controlling Toshiba TeliCams
+ * @brief Driver for controlling Toshiba TeliCams. TeliCam is move-only; destroying it stops the stream and closes the
+ * camera. A moved-from TeliCam may only be destroyed or assigned to.
  */
 class TeliCam
 {
@@ -39,6 +53,40 @@ class TeliCam
         bool reverse_x = false;
         bool reverse_y = false;
         bool trigger_mode = false;
+
+        // Convert frames on a dedicated worker thread instead of the SDK callback thread
+        bool use_worker_thread = false;
+        std::vector<int> worker_cpu_affinity; // Cores the worker may run on. Empty means any core
+        int worker_priority = 0;              // SCHED_FIFO priority of the worker. 0 keeps the default scheduler
+        bool numa_local_buffers = true;       // Allocate the worker's raw buffers on its own NUMA node
+
+        // Frame buffers
+        uint32_t frame_pool_size = 4;   // Converted frame buffers allocated and pre-faulted at initialize()
+        bool use_huge_pages = false;    // Back frame buffers with huge pages
+        bool lock_frame_memory = false; // mlock frame buffers so they are never paged out
+
+        // Per-frame exposure statistics, attached to FrameMetadata::statistics
+        bool compute_statistics = false;
+        uint32_t statistics_subsample = 1; // Sample every Nth row and column block to bound the cost
+        cv::Rect statistics_roi;           // Region the statistics cover. Empty means the whole frame
+
+        // Temporal denoising, a motion-adaptive running average applied in place right after conversion. With
+        // convert_regions_only, only the regions are denoised
+        bool denoise = false;
+        uint32_t denoise_strength = 2;          // 1-7. Static pixels move 1/2^strength of the way to each new frame
+        uint32_t denoise_motion_threshold = 16; // Difference from the average at which a pixel counts as moving
+
+        // Named regions delivered as views into each frame. With convert_regions_only, only the regions are converted,
+        // the rest of the frame stays black and statistics only cover the regions. This rules out undistortion
+        std::vector<RegionOfInterest> regions;
+        bool convert_regions_only = false;
+
+        // Lens undistortion, applied right after conversion. Disabled while the calibration is empty
+        CameraCalibration calibration;
+        std::string undistort_cache_dir; // Directory in which remap tables are cached. Empty disables the cache
+
+        // Period of device clock sampling used to map frame timestamps to host time. 0 disables the mapping
+        uint32_t clock_sync_interval_ms = 1000;
     };
 
     struct SupportedFeatures
@@ -60,10 +108,54 @@ class TeliCam
         bool has_balance_ratio_b;
     };
 
+    struct TimingStats
+    {
+        uint64_t frames_processed;
+        uint64_t frames_dropped;   // Frames dropped because the worker was still busy, or they did not fit its buffers
+        uint64_t frames_oversized; // Of those, frames larger than the stream's payload size
+        StageTiming handoff;       // SDK callback to worker pickup. Only recorded with a worker thread
+        StageTiming conversion;    // Raw to BGR conversion
+        StageTiming denoise;       // Temporal denoising. Only recorded with denoise
+        StageTiming undistortion;  // Lens undistortion. Only recorded with a calibration
+        StageTiming statistics;    // Per-frame statistics. Only recorded with compute_statistics
+        StageTiming publish;       // Making the converted frame available to get_last_frame()
+    };
+
+    /**
+     * @brief Called with every published frame on the thread that converted it. The image is shared with the driver
+     * and with other listeners, so it must be treated as read-only. Listeners should return quickly.
+     */
+    using FrameListener = std::function<void(const Frame&)>;
+
+    /**
+     * @brief Called with every raw frame before it is converted, on the thread that converts it. The data is only
+     * valid for the duration of the call. Listeners should return quickly.
+     */
+    using RawFrameListener = std::function<void(const RawFrame&)>;
+
   public:
     TeliCam();
     explicit TeliCam(int camera_index);
 
+    /**
+     * @brief Stop the stream and close the camera if they are still open. Errors are reported on stderr.
+     */
+    ~TeliCam();
+
+    TeliCam(const TeliCam&) = delete;
+    TeliCam& operator=(const TeliCam&) = delete;
+
+    /**
+     * @brief Take over another camera, including a running stream. The moved-from object is left closed, and can only
+     * be assigned to or destroyed.
+     */
+    TeliCam(TeliCam&& other) noexcept;
+
+    /**
+     * @brief Release this camera, then take over another one, including a running stream.
+     */
+    TeliCam& operator=(TeliCam&& other) noexcept;
+
     /**
      * @brief Initialize the TeliCam API. Must be called once per program.
      */
@@ -81,6 +173,45 @@ class TeliCam
      */
     void initialize(const Parameters& parameters);
 
+    /**
+     * @brief Set up the frame path without a camera, for simulation and benchmarking. Frames are then fed with
+     * inject_frame() and go through the same conversion, worker and publish path as frames from a camera.
+     *
+     * @param parameters TeliCam parameters. Only the frame path options are used.
+     * @param width Frame width
+     * @param height Frame height
+     */
+    void initialize_simulated(const Parameters& parameters, uint32_t width, uint32_t height);
+
+    /**
+     * @brief Feed a raw frame through the frame path as if it came from the SDK callback. Requires
+     * initialize_simulated().
+     *
+     * @param raw Raw frame, only needs to be valid for the duration of the call
+     */
+    void inject_frame(const RawFrame& raw);
+
+    /**
+     * @brief Simulate a stream error on a simulated camera. The error is reported as by the SDK, and frames are lost
+     * until recover() is called.
+     */
+    void inject_stream_error();
+
+    /**
+     * @brief Simulate unplugging or replugging a simulated camera. While it is disconnected, frames are lost and
+     * recover() fails. Reconnecting does not restart the stream, which takes recover().
+     */
+    void set_simulated_connected(bool connected);
+
+    /**
+     * @brief Reopen the camera after a disconnect or stream error, and resume streaming if it was streaming. Only this
+     * camera is touched. It is found again by its serial number, as its index may change when it reconnects, and the
+     * current parameters are reapplied, so a camera in the preview profile comes back in its configured profile. Frame
+     * pools, listeners and metrics are kept. Throws if the camera cannot be reopened, in which case recover() can be
+     * retried.
+     */
+    void recover();
+
     /**
      * @brief Start continuous streaming from the TeliCam.
      */
@@ -98,7 +229,8 @@ class TeliCam
     void stop_stream();
 
     /**
-     * @brief Destroy the TeliCam. This will close the stream and camera. Does not close the API.
+     * @brief Destroy the TeliCam. This will close the stream and camera. Does not close the API. Does nothing if the
+     * camera is not open.
      */
     void destroy();
 
@@ -114,6 +246,54 @@ class TeliCam
      */
     cv::Mat get_last_frame();
 
+    /**
+     * @brief Get the last captured frame together with its metadata.
+     *
+     * @return Frame Last captured frame and its metadata
+     */
+    Frame get_last_frame_with_metadata();
+
+    /**
+     * @brief Get a region of the last frame without copying the frame. The view keeps the frame's buffer out of the
+     * frame pool for as long as it is held, and must be treated as read-only.
+     *
+     * @param name Name of a region in Parameters::regions. Throws if there is no such region.
+     * @return cv::Mat View of the region, empty until a frame has been received or if the region lies outside it
+     */
+    cv::Mat get_last_region(const std::string& name);
+
+    /**
+     * @brief Register a function to be called with every published frame.
+     *
+     * @param listener Frame listener
+     * @return int Listener ID, to be passed to remove_frame_listener()
+     */
+    int add_frame_listener(FrameListener listener);
+
+    /**
+     * @brief Unregister a frame listener. Waits for listener calls already in progress on other threads, so once this
+     * returns the listener is not running and will not be called again. Must not be called from inside a listener of
+     * the same camera, which would wait for itself.
+     *
+     * @param listener_id Listener ID returned by add_frame_listener()
+     */
+    void remove_frame_listener(int listener_id);
+
+    /**
+     * @brief Register a function to be called with every raw frame, e.g. to record sensor data.
+     *
+     * @param listener Raw frame listener
+     * @return int Listener ID, to be passed to remove_raw_frame_listener()
+     */
+    int add_raw_frame_listener(RawFrameListener listener);
+
+    /**
+     * @brief Unregister a raw frame listener, with the same guarantees as remove_frame_listener().
+     *
+     * @param listener_id Listener ID returned by add_raw_frame_listener()
+     */
+    void remove_raw_frame_listener(int listener_id);
+
     /**
      * @brief Get the TeliCam parameters.
      *
@@ -128,6 +308,38 @@ class TeliCam
      */
     SupportedFeatures get_supported_features() const;
 
+    /**
+     * @brief Get the per-stage timing counters of the frame path.
+     *
+     * @return TimingStats Timing counters since the stream was opened. Waits for a recovery or stream restart in
+     * progress, which replaces the worker.
+     */
+    TimingStats get_timing_stats() const;
+
+    /**
+     * @brief Get the memory held by this camera's frame buffers.
+     *
+     * @return FrameMemoryStats Frame buffer memory
+     */
+    FrameMemoryStats get_memory_stats() const;
+
+    /**
+     * @brief Get the health metrics of this camera. The camera also adds them to MetricsRegistry::global() when it is
+     * initialized.
+     *
+     * @return std::shared_ptr<const CameraMetrics> Camera metrics, updated as frames arrive
+     */
+    std::shared_ptr<const CameraMetrics> get_metrics() const;
+
+    /**
+     * @brief Convert a camera timestamp to host monotonic time, using the clock model fitted to periodic samples of
+     * the camera clock.
+     *
+     * @param device_timestamp Camera timestamp in device ticks, as in FrameMetadata::device_timestamp
+     * @return HostTimestamp Host time and its uncertainty. The uncertainty is negative until enough samples are taken.
+     */
+    HostTimestamp to_host_time(uint64_t device_timestamp) const;
+
     /**
      * @brief Get the sensor width
      * 
@@ -142,6 +354,54 @@ class TeliCam
      */
     uint32_t get_sensor_height() const;
 
+    /**
+     * @brief Get the size of the frames the camera currently delivers, which is smaller than the configured size while
+     * a preview profile is active.
+     */
+    cv::Size get_frame_size() const;
+
+    /**
+     * @brief Get the binning and decimation factors the camera supports.
+     */
+    BinningLimits get_binning_limits() const;
+
+    /**
+     * @brief Switch to a reduced-resolution preview of the configured field of view, binned and decimated on the camera
+     * so that less data crosses the bus and less is converted. The stream is stopped for the switch and restarted with
+     * the buffers it already has. If the camera rejects the profile, it goes back to the configured profile and the
+     * error is rethrown. Should that fail too, the stream stays stopped until recover() resumes it.
+     *
+     * @param target_size Size the preview will be displayed at
+     * @return PreviewProfile Chosen profile. Frames still need scaling from camera_size to display_size.
+     */
+    PreviewProfile set_preview_profile(cv::Size target_size);
+
+    /**
+     * @brief Switch back to the configured binning, decimation and region. Does nothing if no preview is active.
+     */
+    void set_full_profile();
+
+    bool is_preview() const;
+
+    /**
+     * @brief Set the exposure time of a running camera. Safe to call from any thread while streaming.
+     *
+     * @param exposure_time Exposure time in microseconds, within the camera limits
+     */
+    void set_exposure_time(float64_t exposure_time);
+
+    /**
+     * @brief Set the gain of a running camera. Safe to call from any thread while streaming.
+     *
+     * @param gain Gain in dB, within the camera limits
+     */
+    void set_gain(float64_t gain);
+
+    float64_t get_min_exposure_time() const;
+    float64_t get_max_exposure_time() const;
+    float64_t get_min_gain() const;
+    float64_t get_max_gain() const;
+
     /**
      * @brief Print TeliCam API system information.
      */
@@ -157,27 +417,61 @@ class TeliCam
      */
     void print_parameters() const;
 
+    /**
+     * @brief Print the per-stage timing counters of the frame path.
+     */
+    void print_timing_stats() const;
+
   private:
     void get_system_info();
     void get_num_cameras();
     void get_camera_info();
     void open_camera();
+    void find_camera_by_serial_number();
     void get_camera_parameter_limits();
     void set_camera_parameters(Parameters parameters);
     void get_camera_properties();
+    void allocate_frame_pool();
+    void configure_statistics();
+    void configure_denoise();
+    void configure_undistortion();
+    void configure_regions();
+    void apply_capture_profile(const Parameters& profile);
+    void write_capture_profile(const Parameters& profile);
+    void create_worker();
     void open_stream();
+    void start_clock_sync();
     void capture_frame_internal();
     void start_stream_internal();
     void stop_stream_internal();
+    void close_stream();
     void close_camera();
 
+    /**
+     * @brief Exchange everything with another camera, including its stream state.
+     */
+    void swap(TeliCam& other) noexcept;
+
+    friend void CallbackImageAcquired(Teli::CAM_HANDLE cam_handle, Teli::CAM_STRM_HANDLE cam_stream_handle,
+                                      Teli::CAM_IMAGE_INFO* image_info, uint32_t buffer_index, void* pvContext);
+    friend void CallbackImageError(Teli::CAM_HANDLE cam_handle, Teli::CAM_STRM_HANDLE cam_stream_handle,
+                                   Teli::CAM_API_STATUS error_status, uint32_t buffer_index, void* pvContext);
+
   private:
+    struct StreamState;
+
     static bool api_initialized;
     static Teli::CAM_SYSTEM_INFO sys_info;
     static uint32_t num_cameras;
 
+    // Changed under StreamState::control_mutex, along with the camera handles and the frame size. The atomic ones are
+    // also read without it, e.g. by a supervisor polling is_streaming().
     bool camera_initialized;
-    bool streaming;
+    bool stream_opened;
+    std::atomic<bool> streaming;
+    bool simulated;
+    std::atomic<bool> preview;
+    bool resume_streaming; // Streaming was interrupted by an incident and resumes once recover() succeeds
 
     uint32_t cam_id;
     Teli::CAM_INFO cam_info;
@@ -189,6 +483,8 @@ class TeliCam
     uint32_t height;
     uint32_t sensor_width;
     uint32_t sensor_height;
+    uint32_t full_width;  // Frame size of the configured profile
+    uint32_t full_height;
     float64_t framerate;
     uint32_t image_buffer_size;
 
@@ -237,5 +533,6 @@ class TeliCam
     float64_t min_balance_ratio_b;
     float64_t max_balance_ratio_b;
 
-    cv::Mat last_frame;
+    // Everything the acquisition callback touches. Heap allocated so the SDK callback context stays valid.
+    std::unique_ptr<StreamState> stream_state;
 };
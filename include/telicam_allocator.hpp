@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * @brief Memory held by one FrameAllocator.
+ */
+struct FrameMemoryStats
+{
+    size_t bytes_allocated = 0; // Includes row padding and page rounding
+    size_t bytes_locked = 0;    // Pinned in RAM with mlock
+    size_t huge_page_bytes = 0; // Backed by explicit (MAP_HUGETLB) huge pages
+    size_t allocations = 0;     // Live buffers
+};
+
+/**
+ * @brief cv::MatAllocator for frame buffers. Buffers are mapped directly from the kernel, with rows padded to a fixed
+ * alignment for wide SIMD loads. They can be backed by huge pages to reduce TLB pressure, and are pre-faulted and
+ * optionally locked at allocation time so the first frames do not pay for page faults.
+ *
+ * Every buffer keeps its allocator alive, so matrices may safely outlive the camera that produced them.
+ */
+class FrameAllocator : public cv::MatAllocator, public std::enable_shared_from_this<FrameAllocator>
+{
+  public:
+    struct Options
+    {
+        size_t row_alignment = 64; // Must be a power of two
+        bool use_huge_pages = false; // MAP_HUGETLB, falling back to transparent huge pages
+        bool prefault = true;        // Touch every page at allocation time
+        bool lock_memory = false;    // mlock buffers, which also pre-faults them
+    };
+
+  public:
+    /**
+     * @brief Create an allocator. Allocators must be owned by a std::shared_ptr.
+     *
+     * @param options Allocator options
+     */
+    static std::shared_ptr<FrameAllocator> create(const Options& options);
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usage_flags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    /**
+     * @brief Allocate a 2D matrix from this allocator.
+     */
+    cv::Mat allocate_mat(int rows, int cols, int type) const;
+
+    /**
+     * @brief Get the memory currently held by buffers from this allocator.
+     */
+    FrameMemoryStats get_stats() const;
+
+  private:
+    explicit FrameAllocator(const Options& options);
+
+    struct Mapping;
+
+  private:
+    Options options;
+
+    mutable std::atomic<size_t> bytes_allocated;
+    mutable std::atomic<size_t> bytes_locked;
+    mutable std::atomic<size_t> huge_page_bytes;
+    mutable std::atomic<size_t> allocations;
+    mutable std::atomic<bool> lock_warning_printed;
+};
+
+/**
+ * @brief Fixed set of frame buffers that are recycled once nobody references them any more. Not thread-safe: buffers
+ * must be acquired from a single thread, but may be released from any thread.
+ */
+class FramePool
+{
+  public:
+    /**
+     * @brief Allocate all buffers up front.
+     *
+     * @param allocator Allocator for the buffers
+     * @param size Frame size
+     * @param type Frame type, e.g. CV_8UC3
+     * @param capacity Number of buffers
+     * @param zeroed Zero every buffer when it is allocated, for frames that are only partly written
+     */
+    FramePool(std::shared_ptr<FrameAllocator> allocator, cv::Size size, int type, size_t capacity, bool zeroed = false);
+
+    /**
+     * @brief Get a buffer that is not referenced anywhere else. Allocates an extra buffer if all are in use.
+     */
+    cv::Mat acquire();
+
+    cv::Size get_frame_size() const;
+    int get_frame_type() const;
+    size_t get_capacity() const;
+
+    /**
+     * @brief Get the number of buffers allocated after construction because the pool ran dry.
+     */
+    uint64_t get_grow_count() const;
+
+  private:
+    std::shared_ptr<FrameAllocator> allocator;
+    cv::Size size;
+    int type;
+    bool zeroed;
+    std::vector<cv::Mat> buffers;
+    size_t next;
+    std::atomic<uint64_t> grow_count;
+};
@@ -0,0 +1,444 @@
+#pragma once
+
+#if __cplusplus < 202002L
+    #error "telicam_async.hpp requires C++20. Link against the telicam_async target or compile with -std=c++20."
+#endif
+
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "telicam.hpp"
+
+/**
+ * @brief Anything that can run a function on some thread of its choosing.
+ */
+template<class E>
+concept FrameExecutor = requires(E& executor, std::function<void()> function) {
+    executor.post(std::move(function));
+};
+
+/**
+ * @brief Executor that resumes coroutines directly on the acquisition thread.
+ */
+class InlineExecutor
+{
+  public:
+    void post(std::function<void()> function)
+    {
+        function();
+    }
+};
+
+/**
+ * @brief Single-threaded executor. Coroutines awaiting any number of cameras are resumed on the thread calling run().
+ */
+class RunLoop
+{
+  public:
+    void post(std::function<void()> function)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(function));
+        }
+        cv.notify_one();
+    }
+
+    /**
+     * @brief Run posted functions until stop() is called.
+     */
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> function;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping)
+                {
+                    stopping = false;
+                    return;
+                }
+
+                function = std::move(queue.front());
+                queue.pop_front();
+            }
+            function();
+        }
+    }
+
+    /**
+     * @brief Make run() return after the function it is currently running.
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+    }
+
+  private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> queue;
+    bool stopping = false;
+};
+
+/**
+ * @brief Fire-and-forget coroutine. It starts running when called and frees itself when it finishes, so the caller
+ * must keep everything it awaits alive until then. An exception escaping the coroutine terminates the program.
+ */
+struct Task
+{
+    struct promise_type
+    {
+        Task get_return_object() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+/**
+ * @brief Coroutine producing a sequence of values asynchronously. Consume it with `co_await generator.next()`, which
+ * returns an empty optional once the coroutine has finished.
+ */
+template<class T>
+class AsyncGenerator
+{
+  public:
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    struct TransferToConsumer
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(handle_type coroutine) noexcept
+        {
+            return coroutine.promise().consumer;
+        }
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    struct promise_type
+    {
+        std::optional<T> current;
+        std::coroutine_handle<> consumer;
+        std::exception_ptr exception;
+
+        AsyncGenerator get_return_object()
+        {
+            return AsyncGenerator(handle_type::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        TransferToConsumer final_suspend() noexcept
+        {
+            return {};
+        }
+
+        TransferToConsumer yield_value(T value)
+        {
+            current = std::move(value);
+            return {};
+        }
+
+        void return_void()
+        {
+        }
+
+        void unhandled_exception()
+        {
+            exception = std::current_exception();
+        }
+    };
+
+    struct NextAwaiter
+    {
+        handle_type coroutine;
+
+        bool await_ready() const noexcept
+        {
+            return coroutine.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept
+        {
+            coroutine.promise().consumer = consumer;
+            coroutine.promise().current.reset();
+            return coroutine;
+        }
+
+        std::optional<T> await_resume()
+        {
+            if (coroutine.promise().exception)
+            {
+                std::rethrow_exception(coroutine.promise().exception);
+            }
+            if (coroutine.done())
+            {
+                return std::nullopt;
+            }
+            return std::move(coroutine.promise().current);
+        }
+    };
+
+  public:
+    explicit AsyncGenerator(handle_type coroutine)
+        : coroutine(coroutine)
+    {
+    }
+
+    AsyncGenerator(AsyncGenerator&& other) noexcept
+        : coroutine(std::exchange(other.coroutine, nullptr))
+    {
+    }
+
+    AsyncGenerator& operator=(AsyncGenerator&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (coroutine)
+                coroutine.destroy();
+            coroutine = std::exchange(other.coroutine, nullptr);
+        }
+        return *this;
+    }
+
+    ~AsyncGenerator()
+    {
+        if (coroutine)
+            coroutine.destroy();
+    }
+
+    /**
+     * @brief Resume the generator until it yields its next value or finishes.
+     */
+    NextAwaiter next()
+    {
+        return NextAwaiter{coroutine};
+    }
+
+  private:
+    handle_type coroutine;
+};
+
+/**
+ * @brief Awaitable source of frames from one TeliCam, driven directly by the acquisition callback. Awaiting
+ * coroutines are resumed through the given executor, so a single thread can serve many cameras.
+ *
+ * Only the most recent frame is kept while no coroutine is waiting; older ones are skipped. At most one coroutine may
+ * await a source at a time.
+ */
+class AsyncFrameSource
+{
+  private:
+    struct Channel
+    {
+        std::mutex mutex;
+        std::optional<Frame> pending;
+        std::coroutine_handle<> waiter;
+        std::optional<Frame>* waiter_result = nullptr;
+        std::function<void(std::coroutine_handle<>)> schedule;
+        bool closed = false;
+        uint64_t skipped_frames = 0;
+    };
+
+  public:
+    struct NextFrameAwaiter
+    {
+        std::shared_ptr<Channel> channel;
+        std::optional<Frame> result;
+
+        bool await_ready()
+        {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            if (channel->pending || channel->closed)
+            {
+                result = std::exchange(channel->pending, std::nullopt);
+                return true;
+            }
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> coroutine)
+        {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            if (channel->pending || channel->closed)
+            {
+                result = std::exchange(channel->pending, std::nullopt);
+                return false;
+            }
+            channel->waiter = coroutine;
+            channel->waiter_result = &result;
+            return true;
+        }
+
+        /**
+         * @return std::optional<Frame> Next frame, or nothing once the source has been closed
+         */
+        std::optional<Frame> await_resume()
+        {
+            return std::move(result);
+        }
+    };
+
+  public:
+    /**
+     * @brief Start listening for frames from a camera.
+     *
+     * @param camera TeliCam to listen to. Must outlive the source.
+     * @param executor Executor on which awaiting coroutines are resumed. Must outlive the source.
+     */
+    template<FrameExecutor Executor>
+    AsyncFrameSource(TeliCam& camera, Executor& executor)
+        : camera(camera)
+        , channel(std::make_shared<Channel>())
+    {
+        channel->schedule = [&executor](std::coroutine_handle<> coroutine) {
+            executor.post([coroutine] { coroutine.resume(); });
+        };
+
+        std::shared_ptr<Channel> listener_channel = channel;
+        listener_id =
+            camera.add_frame_listener([listener_channel](const Frame& frame) { deliver(*listener_channel, frame); });
+    }
+
+    ~AsyncFrameSource()
+    {
+        close();
+    }
+
+    AsyncFrameSource(const AsyncFrameSource&) = delete;
+    AsyncFrameSource& operator=(const AsyncFrameSource&) = delete;
+
+    /**
+     * @brief Wait for the next frame: `std::optional<Frame> frame = co_await source.next_frame();`
+     */
+    NextFrameAwaiter next_frame()
+    {
+        return NextFrameAwaiter{channel, std::nullopt};
+    }
+
+    /**
+     * @brief Asynchronous generator over all frames until the source is closed.
+     */
+    AsyncGenerator<Frame> frames()
+    {
+        while (std::optional<Frame> frame = co_await next_frame())
+        {
+            co_yield std::move(*frame);
+        }
+    }
+
+    /**
+     * @brief Stop listening. A coroutine currently awaiting a frame is resumed with an empty result. Waits for a frame
+     * being delivered on the acquisition thread, so it must not be called from a coroutine an InlineExecutor resumed.
+     */
+    void close()
+    {
+        if (listener_id < 0)
+            return;
+
+        camera.remove_frame_listener(listener_id);
+        listener_id = -1;
+
+        std::coroutine_handle<> waiter;
+        {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            channel->closed = true;
+            waiter = std::exchange(channel->waiter, nullptr);
+            channel->waiter_result = nullptr;
+        }
+        if (waiter)
+        {
+            channel->schedule(waiter);
+        }
+    }
+
+    /**
+     * @brief Get the number of frames that were replaced by a newer one before any coroutine awaited them.
+     */
+    uint64_t get_skipped_frames() const
+    {
+        std::lock_guard<std::mutex> lock(channel->mutex);
+        return channel->skipped_frames;
+    }
+
+  private:
+    static void deliver(Channel& channel, const Frame& frame)
+    {
+        std::coroutine_handle<> waiter;
+        {
+            std::lock_guard<std::mutex> lock(channel.mutex);
+            if (channel.closed)
+                return;
+
+            if (channel.waiter)
+            {
+                *channel.waiter_result = frame;
+                channel.waiter_result = nullptr;
+                waiter = std::exchange(channel.waiter, nullptr);
+            }
+            else
+            {
+                if (channel.pending)
+                {
+                    channel.skipped_frames++;
+                }
+                channel.pending = frame;
+            }
+        }
+
+        if (waiter)
+        {
+            channel.schedule(waiter);
+        }
+    }
+
+  private:
+    TeliCam& camera;
+    std::shared_ptr<Channel> channel;
+    int listener_id = -1;
+};
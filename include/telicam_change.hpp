@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * @brief Detects activity in a stream of frames, so that saving and recording can skip frames in which nothing
+ * changes. Each frame is compared with a running reference on a sparse grid of samples, and a sample counts as changed
+ * when it differs from the reference by more than a threshold. Activity starts when enough samples change for a few
+ * consecutive frames, and ends a number of frames after the changed fraction falls below a lower threshold.
+ *
+ * The reference moves towards every frame by 1/2^reference_shift, so slow lighting changes and objects that come to
+ * rest are absorbed instead of keeping the detector active.
+ */
+class ChangeDetector
+{
+  public:
+    struct Options
+    {
+        uint32_t grid_step = 4;         // Sample every Nth row, and every Nth block of SIMD-width columns within it
+        uint8_t pixel_threshold = 16;   // Difference from the reference at which a sample counts as changed
+        double start_fraction = 0.01;   // Fraction of changed samples at which activity starts
+        double stop_fraction = 0.005;   // Fraction below which activity winds down. Lower than start_fraction
+        uint32_t start_frames = 2;      // Consecutive frames above start_fraction needed to start
+        uint32_t post_roll_frames = 30; // Frames that stay active after the changed fraction falls below stop_fraction
+        uint32_t reference_shift = 4;   // 0-8. Larger values adapt the reference more slowly
+    };
+
+    struct Result
+    {
+        double changed_fraction = 0.0;
+        bool active = false;
+        bool started = false; // Activity started with this frame
+    };
+
+  public:
+    explicit ChangeDetector(const Options& options);
+
+    /**
+     * @brief Compare a frame with the reference and update the activity state. The first frame, and the first frame
+     * after the size or type changes, only initializes the reference.
+     *
+     * @param frame CV_8UC1 frame, e.g. a raw Bayer mosaic, or CV_8UC3 BGR frame, of which green is sampled
+     * @return Result Changed fraction and activity state
+     */
+    Result update(const cv::Mat& frame);
+
+    /**
+     * @brief Forget the reference and end any activity.
+     */
+    void reset();
+
+    bool is_active() const;
+
+  private:
+    Options options;
+    std::vector<uint16_t> reference; // Sampled values in 8.8 fixed point
+    cv::Size reference_size;
+    int reference_type;
+
+    bool active;
+    uint32_t frames_above_start;
+    uint32_t frames_below_stop;
+};
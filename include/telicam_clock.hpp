@@ -0,0 +1,131 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief One reading of the device clock, bracketed by host monotonic time.
+ */
+struct ClockSample
+{
+    uint64_t device_ticks = 0;
+    int64_t host_before_ns = 0; // Host time just before the device latched its clock
+    int64_t host_after_ns = 0;  // Host time just after the latched value was known to be taken
+};
+
+/**
+ * @brief Host monotonic time of a device timestamp.
+ */
+struct HostTimestamp
+{
+    int64_t ns = 0;
+    int64_t uncertainty_ns = -1; // Bound on the error of ns. Negative if the clocks are not synchronized yet
+};
+
+/**
+ * @brief Maps a device clock to host CLOCK_MONOTONIC with a linear model fitted to recent samples. The slope absorbs
+ * both the device tick rate and the drift between the two oscillators. Samples with an unusually long round trip
+ * are rejected before fitting, and samples far from the fit are rejected before refitting.
+ *
+ * Samples are added from one thread; the model can be read from any thread without blocking.
+ */
+class ClockSync
+{
+  public:
+    struct Options
+    {
+        size_t window = 64;            // Most recent samples used for the fit
+        size_t min_samples = 4;        // Samples needed before timestamps are mapped
+        double outlier_threshold = 3.0; // Residual rejection threshold, in robust standard deviations
+    };
+
+  public:
+    ClockSync();
+    explicit ClockSync(const Options& options);
+
+    /**
+     * @brief Add a sample and refit the model.
+     */
+    void add_sample(const ClockSample& sample);
+
+    /**
+     * @brief Discard all samples, e.g. because the device clock was reset.
+     */
+    void reset();
+
+    /**
+     * @brief Convert a device timestamp to host monotonic time.
+     */
+    HostTimestamp to_host(uint64_t device_ticks) const;
+
+    /**
+     * @brief Get the fitted host nanoseconds per device tick, or 0 if the clocks are not synchronized yet. Its
+     * deviation from the nominal tick period is the drift between the clocks.
+     */
+    double get_ns_per_tick() const;
+
+  private:
+    struct Model
+    {
+        uint64_t reference_ticks;
+        int64_t reference_host_ns;
+        double ns_per_tick;
+        int64_t uncertainty_ns;
+    };
+
+    void fit();
+
+  private:
+    Options options;
+    std::deque<ClockSample> samples;
+    std::shared_ptr<const Model> model; // Replaced atomically after every fit
+};
+
+/**
+ * @brief Background thread that periodically takes clock samples and feeds them to a ClockSync.
+ */
+class ClockSampler
+{
+  public:
+    /**
+     * @brief Returns false if no sample could be taken.
+     */
+    using SampleFunction = std::function<bool(ClockSample&)>;
+
+  public:
+    /**
+     * @brief Start sampling. A short burst of samples is taken first so that timestamps are mapped soon after start.
+     *
+     * @param sample Function that takes one sample, called on the sampler thread
+     * @param clock_sync Model to feed. Must outlive the sampler.
+     * @param interval_ms Time between samples after the initial burst
+     */
+    ClockSampler(SampleFunction sample, ClockSync& clock_sync, uint32_t interval_ms);
+
+    /**
+     * @brief Stop sampling and join the thread.
+     */
+    ~ClockSampler();
+
+    ClockSampler(const ClockSampler&) = delete;
+    ClockSampler& operator=(const ClockSampler&) = delete;
+
+  private:
+    void run();
+
+  private:
+    SampleFunction sample;
+    ClockSync& clock_sync;
+    uint32_t interval_ms;
+
+    std::mutex mutex;
+    std::condition_variable stop_cv;
+    bool stopping;
+
+    std::thread thread;
+};
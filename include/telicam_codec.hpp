@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * @brief Lossless codec for 8-bit Bayer mosaics, fast enough to compress every frame of several cameras while
+ * recording.
+ *
+ * Each pixel is predicted from its same-color neighbours (two to the left, two above and diagonally) with the LOCO-I
+ * median edge detector, so the four color planes are decorrelated without being split. Residuals are zigzag coded and
+ * bit-packed in blocks of 16 with a 4-bit width per block, as bit planes that SIMD compare and mask instructions
+ * produce directly. The frame is cut into horizontal slices that are compressed and decompressed independently, in
+ * parallel.
+ */
+struct BayerCodecOptions
+{
+    uint32_t slices = 0; // Independently coded horizontal slices. 0 uses one per OpenCV thread
+};
+
+/**
+ * @brief Upper bound of the compressed size of a frame.
+ *
+ * @param width Frame width
+ * @param height Frame height
+ * @param slices Number of slices
+ * @return size_t Size in bytes
+ */
+size_t bayer_compress_bound(uint32_t width, uint32_t height, uint32_t slices);
+
+/**
+ * @brief Compress a Bayer frame.
+ *
+ * @param bayer CV_8UC1 frame. Rows may be padded.
+ * @param buffer Receives the compressed frame in its first bytes. Grown to the bound if needed and otherwise left
+ * alone, so a buffer reused between frames is neither reallocated nor cleared.
+ * @param options Codec options
+ * @return size_t Compressed size in bytes
+ */
+size_t compress_bayer(const cv::Mat& bayer, std::vector<uint8_t>& buffer,
+                      const BayerCodecOptions& options = BayerCodecOptions());
+
+/**
+ * @brief Decompress a frame compressed with compress_bayer(). Throws if the data is malformed or truncated.
+ *
+ * @param data Compressed frame
+ * @param size Compressed size in bytes
+ * @param bayer Decompressed CV_8UC1 frame, reallocated if its size differs
+ */
+void decompress_bayer(const uint8_t* data, size_t size, cv::Mat& bayer);
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+
+#include "telicam_frame.hpp"
+
+/**
+ * @brief GenICam PFNC pixel format codes, as reported in RawFrame::pixel_format.
+ */
+namespace pixel_format
+{
+constexpr uint32_t MONO8 = 0x01080001;
+constexpr uint32_t MONO10 = 0x01100003;
+constexpr uint32_t MONO12 = 0x01100005;
+constexpr uint32_t MONO10P = 0x010A0046;
+constexpr uint32_t MONO12P = 0x010C0047;
+constexpr uint32_t BAYER_GR8 = 0x01080008;
+constexpr uint32_t BAYER_RG8 = 0x01080009;
+constexpr uint32_t BAYER_GB8 = 0x0108000A;
+constexpr uint32_t BAYER_BG8 = 0x0108000B;
+constexpr uint32_t BAYER_GR10 = 0x0110000C;
+constexpr uint32_t BAYER_RG10 = 0x0110000D;
+constexpr uint32_t BAYER_GB10 = 0x0110000E;
+constexpr uint32_t BAYER_BG10 = 0x0110000F;
+constexpr uint32_t BAYER_GR12 = 0x01100010;
+constexpr uint32_t BAYER_RG12 = 0x01100011;
+constexpr uint32_t BAYER_GB12 = 0x01100012;
+constexpr uint32_t BAYER_BG12 = 0x01100013;
+constexpr uint32_t BAYER_BG10P = 0x010A0052;
+constexpr uint32_t BAYER_GB10P = 0x010A0054;
+constexpr uint32_t BAYER_GR10P = 0x010A0056;
+constexpr uint32_t BAYER_RG10P = 0x010A0058;
+constexpr uint32_t BAYER_BG12P = 0x010C0053;
+constexpr uint32_t BAYER_GB12P = 0x010C0055;
+constexpr uint32_t BAYER_GR12P = 0x010C0057;
+constexpr uint32_t BAYER_RG12P = 0x010C0059;
+} // namespace pixel_format
+
+/**
+ * @brief Buffers reused between conversions.
+ */
+struct ConversionScratch
+{
+    cv::Mat unpacked;  // 10 and 12-bit samples reduced to 8 bits
+    cv::Mat converted; // Demosaiced margin around a region, or a contiguous frame for the SDK
+};
+
+/**
+ * @brief Conversion of raw frames of one pixel format to BGR, chosen once per stream with select_frame_converter().
+ * Mono and Bayer formats of 8, 10 and 12 bits, unpacked or packed as in PFNC's "p" formats, each get their own
+ * instantiation of the conversion kernels, so converting a frame involves no per-pixel format dispatch. 10 and 12-bit
+ * samples keep their 8 most significant bits, unpacked with SIMD, before demosaicing. Other formats are converted by
+ * the SDK.
+ */
+struct FrameConverter
+{
+    uint32_t pixel_format = 0;
+
+    /**
+     * @brief Convert a whole frame. dst is already allocated with the frame's size and type CV_8UC3, and its rows may
+     * be padded.
+     */
+    void (*convert)(const RawFrame& raw, cv::Mat& dst, ConversionScratch& scratch) = nullptr;
+
+    /**
+     * @brief Convert one region, as convert_region_to_bgr(). nullptr for formats that only the SDK converts.
+     */
+    void (*convert_region)(const RawFrame& raw, const cv::Rect& region, cv::Mat& dst,
+                           ConversionScratch& scratch) = nullptr;
+};
+
+/**
+ * @brief Choose the conversion kernels for a pixel format.
+ *
+ * @param pixel_format PFNC pixel format code
+ * @return FrameConverter Kernels for the format, which convert through the SDK if it has no kernels of its own
+ */
+FrameConverter select_frame_converter(uint32_t pixel_format);
+
+/**
+ * @brief Convert a raw frame to BGR. Chooses the kernels on every call; the frame path uses select_frame_converter()
+ * once per stream instead.
+ *
+ * @param raw Raw frame
+ * @param dst Destination, already allocated with the frame's size and type CV_8UC3. Rows may be padded.
+ * @param scratch Reused between calls
+ */
+void convert_to_bgr(const RawFrame& raw, cv::Mat& dst, ConversionScratch& scratch);
+
+/**
+ * @brief Check whether convert_region_to_bgr() supports a pixel format. The mono and Bayer formats that
+ * select_frame_converter() has kernels for are.
+ */
+bool can_convert_region(uint32_t pixel_format);
+
+/**
+ * @brief Convert one region of a raw frame to BGR, at a cost proportional to the region's area. Pixels are
+ * interpolated from their real neighbours, so the region matches a bilinear conversion of the whole frame.
+ *
+ * @param raw Raw frame in a format for which can_convert_region() is true
+ * @param region Region of the frame to convert, within the frame
+ * @param dst Destination, already allocated with the region's size and type CV_8UC3. May be a view into a larger
+ * image.
+ * @param scratch Reused between calls for the unpacked and demosaiced margin around the region
+ */
+void convert_region_to_bgr(const RawFrame& raw, const cv::Rect& region, cv::Mat& dst, ConversionScratch& scratch);
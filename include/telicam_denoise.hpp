@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+struct DenoiseOptions
+{
+    uint32_t strength = 2;         // 1-7. A static sample moves 1/2^strength of the way to each new frame
+    uint8_t motion_threshold = 16; // Difference from the average above which a sample is treated as moving
+};
+
+/**
+ * @brief Temporal denoising for low-light streams: every sample is replaced with an exponential running average of
+ * its past values, kept in 8.8 fixed point in a 16-bit accumulator of the frame's size. Averaging is motion-adaptive,
+ * per sample: a sample that differs from its average by more than motion_threshold only moves halfway towards the new
+ * value, and one that differs by more than twice the threshold restarts from it, so moving objects do not smear.
+ *
+ * Frames are filtered in place in one vectorized pass, meant to run right after conversion while the frame is still in
+ * cache. A static scene's noise falls by about sqrt(2^(strength + 1) - 1).
+ */
+class TemporalDenoiser
+{
+  public:
+    explicit TemporalDenoiser(const DenoiseOptions& options);
+
+    /**
+     * @brief Blend a frame into the running average and replace it with the average. The first frame, and the first
+     * frame after the size or type changes, only initializes the average.
+     *
+     * @param frame CV_8UC1 or CV_8UC3 frame, filtered in place
+     * @param rects Regions to filter, within the frame. Empty filters the whole frame. Regions must be the same from
+     * frame to frame, as the average outside of them is not kept.
+     */
+    void apply(cv::Mat& frame, const std::vector<cv::Rect>& rects = {});
+
+    /**
+     * @brief Forget the running average.
+     */
+    void reset();
+
+  private:
+    DenoiseOptions options;
+    cv::Mat accumulator; // CV_16U with the frame's channels, 8.8 fixed point
+};
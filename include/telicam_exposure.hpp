@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "telicam.hpp"
+
+/**
+ * @brief Driver-side auto exposure and auto gain. Drives the mean luma of the frame statistics (see
+ * Parameters::compute_statistics and Parameters::statistics_roi) to a target by writing exposure time first and gain
+ * once exposure is exhausted.
+ *
+ * The control loop runs on its own thread; the acquisition path only hands over the latest statistics. Each update
+ * changes brightness by at most max_step and is followed by settle_frames frames in which the new values take effect,
+ * so a brightness error of E converges within about ceil(log(E) / log(max_step)) * (settle_frames + 1) frames.
+ */
+class AutoExposureController
+{
+  public:
+    struct Options
+    {
+        double target_luma = 118.0;           // Mean luma to converge to, 0-255
+        double tolerance = 0.05;              // Relative luma error treated as converged
+        double max_saturated_fraction = 0.02; // Above this, the frame is treated as too bright whatever its mean
+        bool adjust_exposure = true;
+        bool adjust_gain = true;
+        double min_exposure_time = 0.0; // us. 0 uses the camera limit
+        double max_exposure_time = 0.0; // us. 0 uses the camera limit or the frame period, whichever is shorter
+        double max_gain = 0.0;          // dB. 0 uses the camera limit
+        double max_step = 2.0;          // Largest brightness change per update, as a factor
+        uint32_t settle_frames = 2;     // Frames ignored after a write while it takes effect
+        uint32_t min_update_interval_ms = 0;
+        double min_relative_change = 0.02; // Smaller exposure or gain changes are not written
+    };
+
+    struct State
+    {
+        bool converged = false;
+        double exposure_time = 0.0; // us
+        double gain = 0.0;          // dB
+        double luma = 0.0;          // Mean luma of the last evaluated frame
+        uint64_t last_frame_id = 0; // Last frame evaluated
+        uint64_t updates = 0;       // Evaluations that changed exposure or gain
+        uint64_t writes = 0;        // Register writes
+        uint64_t skipped_writes = 0; // Writes skipped because the change was below min_relative_change
+    };
+
+  public:
+    /**
+     * @brief Start controlling a camera. The camera must have compute_statistics enabled and must outlive the
+     * controller. Camera-side auto gain should be off.
+     *
+     * @param cam Camera to control
+     * @param options Controller options
+     */
+    AutoExposureController(TeliCam& cam, const Options& options);
+
+    /**
+     * @brief Stop controlling the camera. Exposure and gain keep their last values.
+     */
+    ~AutoExposureController();
+
+    AutoExposureController(const AutoExposureController&) = delete;
+    AutoExposureController& operator=(const AutoExposureController&) = delete;
+
+    State get_state() const;
+
+  private:
+    struct Mailbox;
+
+    void run();
+    void evaluate(const FrameStatistics& statistics, uint64_t frame_id);
+
+  private:
+    TeliCam& cam;
+    Options options;
+
+    double min_exposure_time;
+    double max_exposure_time;
+    double min_gain;
+    double max_gain;
+
+    std::shared_ptr<Mailbox> mailbox; // Shared with the frame listener, which may outlive the controller briefly
+    int listener_id;
+
+    mutable std::mutex state_mutex;
+    State state;
+    uint64_t settle_until_frame_id;
+    int64_t last_update_ns;
+    bool error_printed;
+
+    std::thread thread;
+};
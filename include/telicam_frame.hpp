@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "telicam_stats.hpp"
+
+/**
+ * @brief Raw sensor buffer as delivered by the TeliCam SDK, before any conversion.
+ */
+struct RawFrame
+{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pixel_format = 0;
+    uint32_t status = 0;
+    uint64_t block_id = 0;
+    uint64_t device_timestamp = 0;
+    int64_t receive_ns = 0; // Host monotonic time at which the SDK callback fired
+};
+
+/**
+ * @brief Information about a converted frame.
+ */
+struct FrameMetadata
+{
+    uint64_t frame_id = 0;   // Block ID assigned by the camera
+    int64_t receive_ns = 0;  // Host monotonic time at which the SDK callback fired
+    int64_t publish_ns = 0;  // Host monotonic time at which the frame was published
+
+    uint64_t device_timestamp = 0;        // Camera timestamp of the frame, in device ticks
+    int64_t exposure_ns = 0;              // Host monotonic time of device_timestamp
+    int64_t exposure_uncertainty_ns = -1; // Bound on the error of exposure_ns. Negative if the clocks are not synced
+
+    std::shared_ptr<const FrameStatistics> statistics; // Null unless compute_statistics is enabled
+};
+
+/**
+ * @brief A named region of a camera's frames, e.g. the part of the field of view one consumer cares about.
+ */
+struct RegionOfInterest
+{
+    std::string name;
+    cv::Rect rect;
+};
+
+/**
+ * @brief A region of a converted frame.
+ */
+struct FrameRegion
+{
+    std::string name;
+    cv::Mat image; // View into Frame::image, without a copy. Empty if the region lies outside the frame
+};
+
+/**
+ * @brief Converted BGR frame and its metadata.
+ */
+struct Frame
+{
+    cv::Mat image;
+    FrameMetadata metadata;
+    std::vector<FrameRegion> regions; // One per configured region of interest, in the order they were configured
+};
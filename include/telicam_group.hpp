@@ -0,0 +1,86 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "telicam.hpp"
+
+/**
+ * @brief Owns a set of TeliCams and runs their lifecycle operations concurrently, so that bringing up or shutting
+ * down a rig takes about as long as its slowest camera.
+ */
+class TeliCamGroup
+{
+  public:
+    TeliCamGroup() = default;
+
+    /**
+     * @brief Create one TeliCam per camera index. Cameras are not opened until initialize() is called.
+     *
+     * @param camera_indices TeliCam indices
+     */
+    explicit TeliCamGroup(const std::vector<int>& camera_indices);
+
+    /**
+     * @brief Destroy all cameras concurrently. Errors are reported on stderr.
+     */
+    ~TeliCamGroup();
+
+    TeliCamGroup(const TeliCamGroup&) = delete;
+    TeliCamGroup& operator=(const TeliCamGroup&) = delete;
+    TeliCamGroup(TeliCamGroup&&) = default;
+    TeliCamGroup& operator=(TeliCamGroup&&) = default;
+
+    /**
+     * @brief Add a camera to the group. Must not be called while a group operation is running.
+     *
+     * @param camera TeliCam to take ownership of
+     */
+    void add(TeliCam camera);
+
+    /**
+     * @brief Initialize all cameras concurrently.
+     *
+     * @param parameters Parameters for each camera, in the order the cameras were added
+     */
+    void initialize(const std::vector<TeliCam::Parameters>& parameters);
+
+    /**
+     * @brief Start continuous streaming on all cameras concurrently.
+     */
+    void start_stream();
+
+    /**
+     * @brief Stop continuous streaming on all cameras concurrently.
+     */
+    void stop_stream();
+
+    /**
+     * @brief Capture a single frame on all cameras concurrently.
+     */
+    void capture_frame();
+
+    /**
+     * @brief Destroy all cameras concurrently. Does not close the API.
+     */
+    void destroy();
+
+    size_t size() const;
+    TeliCam& operator[](size_t index);
+    const TeliCam& operator[](size_t index) const;
+
+    std::vector<TeliCam>::iterator begin();
+    std::vector<TeliCam>::iterator end();
+    std::vector<TeliCam>::const_iterator begin() const;
+    std::vector<TeliCam>::const_iterator end() const;
+
+  private:
+    /**
+     * @brief Run an operation on every camera, each on its own thread. Waits for all of them, then throws a single
+     * std::runtime_error listing every camera that failed.
+     */
+    void for_each_concurrently(const std::function<void(size_t, TeliCam&)>& operation, const char* name);
+
+  private:
+    std::vector<TeliCam> cameras;
+};
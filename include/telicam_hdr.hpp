@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "telicam.hpp"
+
+// Largest number of frames fuse_exposures() merges at once
+static const size_t MAX_FUSED_EXPOSURES = 8;
+
+struct ExposureFusionOptions
+{
+    bool radiance = false; // Output CV_32FC3 scene radiance instead of a tone-mapped CV_8UC3 frame
+};
+
+/**
+ * @brief Merge frames of a static scene taken at different exposure times. Every pixel is an average of its values in
+ * all frames, weighted by how well exposed it is in each: least near black, going by its luma, and near clipping, going
+ * by its brightest channel. The tone-mapped output averages the 8-bit values themselves, which fuses the well-exposed
+ * parts of every frame into one displayable frame. The radiance output first scales each frame to the longest exposure
+ * time, so it matches the longest exposure where that is not clipped and exceeds 255 where it is.
+ *
+ * Bands of rows are merged on OpenCV's thread pool, and each row in fixed-size tiles whose running sums stay on the
+ * stack and in L1 cache, so nothing is allocated besides the output. The inner loops use OpenCV universal intrinsics.
+ *
+ * @param frames 1 to MAX_FUSED_EXPOSURES CV_8UC3 frames of the same size
+ * @param exposure_times Exposure time of each frame, in any unit
+ * @param merged Merged frame, CV_8UC3 or CV_32FC3. Only reallocated if its size or type is wrong.
+ * @param options Fusion options
+ */
+void fuse_exposures(const std::vector<cv::Mat>& frames, const std::vector<double>& exposure_times, cv::Mat& merged,
+                    const ExposureFusionOptions& options);
+
+/**
+ * @brief A merged exposure bracket.
+ */
+struct BracketedFrame
+{
+    cv::Mat image;                        // CV_8UC3 tone-mapped or CV_32FC3 radiance, see ExposureFusionOptions
+    std::vector<FrameMetadata> exposures; // Metadata of the merged frames, in the order of the exposure times
+    std::vector<double> exposure_times;   // us
+    double merge_ms = 0.0;
+};
+
+/**
+ * @brief Exposure bracketing on a running stream. Consecutive frames are exposed with each exposure time of a list in
+ * turn: each frame that arrives asks the bracketer's write thread to write the exposure time of a later frame, and
+ * every complete set of consecutive frames is merged with fuse_exposures() on its merge thread. The frame listener
+ * only records the frame, so neither register writes nor merging hold up acquisition. A set that loses a frame is
+ * abandoned, and a set that completes while the previous one is still being merged replaces it.
+ *
+ * Writes only take effect on frames that are not yet being exposed, which latency_frames must match for the camera.
+ * The bracketer owns exposure time while it runs, so it cannot be combined with an AutoExposureController. Sets hold
+ * frame buffers while they are collected and merged, so frame_pool_size should allow for about twice the number of
+ * exposure times.
+ */
+class ExposureBracketer
+{
+  public:
+    struct Options
+    {
+        std::vector<double> exposure_times; // us, cycled in this order. 2 to MAX_FUSED_EXPOSURES
+        uint32_t latency_frames = 1;        // Frames still exposed with the old exposure time after a write
+        ExposureFusionOptions fusion;
+    };
+
+    struct Stats
+    {
+        uint64_t frames = 0;       // Frames received
+        uint64_t sets_merged = 0;  // Complete sets merged
+        uint64_t sets_dropped = 0; // Complete sets replaced by a newer one before they could be merged
+        uint64_t sets_broken = 0;  // Sets abandoned because a frame was lost
+        uint64_t writes = 0;       // Exposure time writes made
+        uint64_t write_errors = 0; // Exposure time writes that threw
+        double merged_fps = 0.0;   // Merged frames per second since the first merge
+        double mean_merge_ms = 0.0;
+        double max_merge_ms = 0.0;
+    };
+
+  public:
+    /**
+     * @brief Start bracketing a camera, from the first frame that arrives. The camera must outlive the bracketer.
+     *
+     * @param cam Camera to bracket
+     * @param options Bracketer options. Throws if the exposure times are out of the camera limits.
+     * @param on_merged Called on the merge thread with every merged set
+     */
+    ExposureBracketer(TeliCam& cam, const Options& options, std::function<void(const BracketedFrame&)> on_merged = {});
+
+    /**
+     * @brief Stop bracketing and restore the exposure time the camera had before.
+     */
+    ~ExposureBracketer();
+
+    ExposureBracketer(const ExposureBracketer&) = delete;
+    ExposureBracketer& operator=(const ExposureBracketer&) = delete;
+
+    Stats get_stats() const;
+
+    /**
+     * @brief Get the last merged set. Its image is empty until a set has been merged.
+     */
+    BracketedFrame get_last_merged() const;
+
+  private:
+    struct Sequencer;
+
+    void write_exposures();
+    void merge_sets();
+
+  private:
+    TeliCam& cam;
+    Options options;
+    std::function<void(const BracketedFrame&)> on_merged;
+    float64_t restore_exposure_time;
+
+    std::shared_ptr<Sequencer> sequencer; // Shared with the frame listener, which may outlive the bracketer briefly
+    int listener_id;
+
+    std::shared_ptr<FrameAllocator> allocator;
+    std::unique_ptr<FramePool> output_pool; // Merged frames, recycled once nobody holds them
+
+    std::thread write_thread;
+    std::thread merge_thread;
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Histogram with fixed bucket bounds. Observing is lock-free and safe from any thread.
+ */
+class Histogram
+{
+  public:
+    struct Snapshot
+    {
+        std::vector<double> upper_bounds;
+        std::vector<uint64_t> cumulative_counts; // Observations <= each bound, as Prometheus expects
+        uint64_t count = 0;
+        double sum = 0.0;
+    };
+
+  public:
+    /**
+     * @brief Create a histogram.
+     *
+     * @param upper_bounds Increasing bucket upper bounds. An implicit +Inf bucket follows the last one.
+     */
+    explicit Histogram(std::vector<double> upper_bounds);
+
+    void observe(double value);
+    Snapshot snapshot() const;
+
+  private:
+    std::vector<double> upper_bounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets; // One per bound plus +Inf, not cumulative
+    std::atomic<uint64_t> count;
+    std::atomic<double> sum;
+};
+
+/**
+ * @brief Point-in-time copy of one camera's metrics.
+ */
+struct CameraMetricsSnapshot
+{
+    uint64_t frames_received = 0;
+    uint64_t frames_dropped = 0;    // Gaps in the camera's block IDs plus frames dropped by the worker
+    uint64_t frames_incomplete = 0; // Frames delivered with a non-zero image status
+    double fps = 0.0;               // Decays towards zero when frames stop arriving
+    double last_frame_age_s = -1.0; // Negative if no frame has arrived yet
+    uint64_t stream_errors = 0;     // Errors reported by the SDK stream
+    uint64_t recoveries = 0;        // Times the camera was reopened after a disconnect or stream error
+    Histogram::Snapshot conversion_seconds;
+};
+
+/**
+ * @brief Health metrics of one camera. Recording uses only atomics so it never blocks the acquisition path. Frames
+ * must be recorded from a single thread, the SDK callback thread; everything else is safe from any thread.
+ */
+class CameraMetrics
+{
+  public:
+    CameraMetrics();
+
+    /**
+     * @brief Record a frame delivered by the SDK.
+     *
+     * @param block_id Block ID assigned by the camera
+     * @param status SDK image status, 0 if the frame is complete
+     * @param receive_ns Host monotonic time at which the SDK callback fired
+     */
+    void record_frame(uint64_t block_id, uint32_t status, int64_t receive_ns);
+
+    /**
+     * @brief Record frames dropped on the host.
+     */
+    void record_dropped(uint64_t frames);
+
+    /**
+     * @brief Record the conversion time of one frame.
+     */
+    void record_conversion(int64_t duration_ns);
+
+    /**
+     * @brief Record an error reported by the SDK stream.
+     */
+    void record_stream_error();
+
+    /**
+     * @brief Record that the camera was reopened after a disconnect or stream error.
+     */
+    void record_recovery();
+
+    /**
+     * @brief Forget the previous frame, so that restarting a stream is not counted as dropped frames.
+     */
+    void restart_sequence();
+
+    CameraMetricsSnapshot snapshot() const;
+
+  private:
+    std::atomic<uint64_t> frames_received;
+    std::atomic<uint64_t> frames_dropped;
+    std::atomic<uint64_t> frames_incomplete;
+    std::atomic<uint64_t> stream_errors;
+    std::atomic<uint64_t> recoveries;
+
+    std::atomic<uint64_t> last_block_id; // 0 until the first frame of a sequence
+    std::atomic<int64_t> last_receive_ns;
+    std::atomic<double> interval_ns; // Exponentially weighted frame interval
+
+    Histogram conversion_seconds;
+};
+
+/**
+ * @brief Set of camera metrics that can be rendered together. Cameras add themselves to the global registry when they
+ * are initialized and remove themselves when they are destroyed.
+ */
+class MetricsRegistry
+{
+  public:
+    /**
+     * @brief Get the registry that cameras add themselves to.
+     */
+    static MetricsRegistry& global();
+
+    /**
+     * @brief Add a camera's metrics. Adding the same metrics again only replaces their label.
+     *
+     * @param camera Value of the camera label, which should identify the camera for as long as it is registered
+     * @param metrics Camera metrics, held weakly
+     */
+    void add(const std::string& camera, const std::shared_ptr<const CameraMetrics>& metrics);
+
+    /**
+     * @brief Remove a camera's metrics, if they were added.
+     */
+    void remove(const std::shared_ptr<const CameraMetrics>& metrics);
+
+    /**
+     * @brief Render all live camera metrics in the Prometheus text exposition format.
+     */
+    std::string render_prometheus();
+
+  private:
+    struct Entry
+    {
+        std::string camera;
+        std::weak_ptr<const CameraMetrics> metrics;
+    };
+
+    std::mutex mutex;
+    std::vector<Entry> entries;
+};
+
+/**
+ * @brief Serves a registry over HTTP and/or writes it to a file at a fixed interval, from a background thread.
+ */
+class MetricsExporter
+{
+  public:
+    struct Options
+    {
+        int http_port = 0;                       // 0 disables the HTTP endpoint
+        std::string bind_address = "127.0.0.1";  // Loopback only by default
+        std::string filename;                    // Empty disables the file
+        double file_interval_s = 5.0;
+    };
+
+  public:
+    /**
+     * @brief Start exporting. Throws if the HTTP port cannot be bound.
+     *
+     * @param registry Registry to export. Must outlive the exporter.
+     * @param options Exporter options
+     */
+    MetricsExporter(MetricsRegistry& registry, const Options& options);
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+  private:
+    void run();
+    void serve_client(int client_fd);
+    void write_file();
+
+  private:
+    MetricsRegistry& registry;
+    Options options;
+    int listen_fd;
+    std::atomic<bool> stopping;
+    std::thread thread;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * @brief Range of binning and decimation factors a camera supports. Unsupported features have a range of 1 to 1.
+ */
+struct BinningLimits
+{
+    uint32_t min_binning = 1;
+    uint32_t max_binning = 1;
+    uint32_t min_decimation = 1;
+    uint32_t max_decimation = 1;
+};
+
+/**
+ * @brief A reduced-resolution capture profile for previews. The camera bins and decimates as far as it can without
+ * going below the display size, and the remaining reduction is done in software.
+ */
+struct PreviewProfile
+{
+    uint32_t binning = 1;    // On both axes
+    uint32_t decimation = 1; // On both axes
+    cv::Size camera_size;    // Frame size delivered by the camera
+    cv::Size display_size;   // Frame size after the residual software scaling
+};
+
+/**
+ * @brief Choose the binning and decimation for a preview. The largest total reduction that keeps the camera's frames
+ * at least as large as the display is chosen, preferring binning over decimation, as binning averages pixels instead
+ * of skipping them and so keeps noise and aliasing down.
+ *
+ * @param frame_size Frame size without binning or decimation
+ * @param target_size Size the preview must fit in. The frame's aspect ratio is kept.
+ * @param limits Factors the camera supports
+ * @return PreviewProfile Chosen factors and the resulting sizes
+ */
+PreviewProfile plan_preview_profile(cv::Size frame_size, cv::Size target_size, const BinningLimits& limits);
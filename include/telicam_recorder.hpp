@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "telicam.hpp"
+#include "telicam_change.hpp"
+#include "telicam_codec.hpp"
+#include "telicam_worker.hpp"
+
+/**
+ * @brief Records a camera's raw 8-bit frames to a file, losslessly compressed with compress_bayer(). Frames are copied
+ * off the acquisition path into a small queue and compressed and written on the recorder's own thread. When the
+ * recorder falls behind, frames are dropped and counted rather than stalling acquisition.
+ *
+ * With record_on_change, only frames in which a ChangeDetector sees activity are written, together with the
+ * pre_roll_frames before the activity started. Pre-roll frames are compressed as they arrive and kept in memory, so
+ * the start of an activity does not cause a burst of work.
+ */
+class FrameRecorder
+{
+  public:
+    struct Options
+    {
+        uint32_t queue_depth = 4; // Raw frames waiting to be compressed
+        BayerCodecOptions codec;
+
+        bool record_on_change = false; // Only write frames while the change detector reports activity
+        ChangeDetector::Options change;
+        uint32_t pre_roll_frames = 0; // Frames before the start of an activity that are written with it
+    };
+
+    struct Stats
+    {
+        uint64_t frames_written = 0;
+        uint64_t frames_dropped = 0; // Dropped because the queue was full or the format is not 8-bit
+        uint64_t frames_skipped = 0; // Not written because there was no activity
+        uint64_t raw_bytes = 0;
+        uint64_t compressed_bytes = 0;
+    };
+
+  public:
+    /**
+     * @brief Start recording. Throws if the file cannot be created.
+     *
+     * @param cam Camera to record. Must outlive the recorder.
+     * @param filename Recording file, replaced if it exists
+     * @param options Recorder options
+     */
+    FrameRecorder(TeliCam& cam, const std::string& filename, const Options& options);
+
+    /**
+     * @brief Stop recording. Frames still queued are discarded.
+     */
+    ~FrameRecorder();
+
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    Stats get_stats() const;
+
+  private:
+    struct Record;
+
+    void process_frame(const RawFrame& raw);
+    void write_record(const Record& record);
+
+  private:
+    TeliCam& cam;
+    Options options;
+    std::ofstream file;
+
+    // Only touched by the worker thread
+    ChangeDetector change_detector;
+    std::unique_ptr<Record> current;
+    std::deque<std::unique_ptr<Record>> pre_roll;
+    std::unique_ptr<FrameWorker> worker;
+    int listener_id;
+
+    std::atomic<uint64_t> frames_written;
+    std::atomic<uint64_t> unsupported_frames;
+    std::atomic<uint64_t> frames_skipped;
+    std::atomic<uint64_t> raw_bytes;
+    std::atomic<uint64_t> compressed_bytes;
+};
+
+/**
+ * @brief A frame read back from a recording.
+ */
+struct RecordedFrame
+{
+    uint64_t block_id = 0;
+    uint64_t device_timestamp = 0;
+    int64_t receive_ns = 0;
+    uint32_t pixel_format = 0;
+    cv::Mat bayer; // CV_8UC1
+};
+
+/**
+ * @brief Reads the frames of a recording written by FrameRecorder, in order.
+ */
+class RecordingReader
+{
+  public:
+    /**
+     * @brief Open a recording. Throws if it cannot be opened or is not a recording.
+     *
+     * @param filename Recording file
+     */
+    explicit RecordingReader(const std::string& filename);
+
+    /**
+     * @brief Read the next frame. Throws if the recording is corrupt.
+     *
+     * @param frame Next frame
+     * @return true if a frame was read, false at the end of the recording
+     */
+    bool read(RecordedFrame& frame);
+
+  private:
+    std::ifstream file;
+    std::vector<uint8_t> compressed;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * @brief Exposure statistics of one frame. When subsampling, all counts refer to the sampled pixels only.
+ */
+struct FrameStatistics
+{
+    std::array<uint32_t, 256> luma_histogram{}; // BT.601 luma
+    cv::Scalar channel_means;                   // B, G, R
+    uint64_t saturated_pixels = 0;              // Any channel at or above the saturation level
+    uint64_t black_pixels = 0;                  // All channels at or below the black level
+    uint64_t sampled_pixels = 0;
+};
+
+struct StatisticsOptions
+{
+    uint32_t subsample = 1; // Use every Nth row, and every Nth block of SIMD-width columns within it
+    cv::Rect roi;           // Region to cover, clipped to the frame. Empty means the whole frame
+    uint8_t saturation_level = 255;
+    uint8_t black_level = 0;
+};
+
+/**
+ * @brief Compute exposure statistics of a BGR frame in a single vectorized pass. Meant to run right after conversion,
+ * while the frame is still in cache.
+ *
+ * @param bgr CV_8UC3 frame
+ * @param options Sampling and clipping levels
+ * @param statistics Computed statistics
+ */
+void compute_frame_statistics(const cv::Mat& bgr, const StatisticsOptions& options, FrameStatistics& statistics);
+
+/**
+ * @brief Add the statistics of another part of a frame, as if both parts had been sampled in one pass.
+ *
+ * @param other Statistics to add
+ * @param statistics Statistics added to
+ */
+void add_frame_statistics(const FrameStatistics& other, FrameStatistics& statistics);
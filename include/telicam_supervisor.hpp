@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "telicam.hpp"
+
+/**
+ * @brief Watches one camera's stream and recovers it with TeliCam::recover() when it stalls or the SDK reports a
+ * stream error. A stream stalls when no frame arrives within stall_frame_periods frame periods, and recovery counts as
+ * done once the first frame after it arrives, so the measured downtime runs from the last frame before the incident to
+ * the first frame after it. Only the supervised camera is touched; other cameras keep streaming.
+ *
+ * While a supervisor runs, it owns the camera's lifecycle: stopping, starting or destroying the camera from elsewhere
+ * races with recovery. Runtime controls such as exposure may throw while the camera is being reopened.
+ */
+class StreamSupervisor
+{
+  public:
+    struct Options
+    {
+        double stall_frame_periods = 10.0; // Frame periods without a frame after which the stream counts as stalled
+        uint32_t min_stall_ms = 250;       // Lower bound on the stall timeout, and the timeout in free-running mode
+        uint32_t poll_interval_ms = 10;    // How often the camera's metrics are checked
+        uint32_t retry_interval_ms = 200;  // Wait between failed recovery attempts
+        bool recover_on_error = true;      // Recover on SDK stream errors, not only on stalls
+    };
+
+    struct Incident
+    {
+        std::string cause;         // "stall" or "stream error"
+        int64_t last_frame_ns = 0; // Monotonic time of the last frame before the incident, 0 if there was none
+        int64_t detected_ns = 0;
+        int64_t resumed_ns = 0; // Monotonic time of the first frame after recovery
+        uint32_t attempts = 0;  // Calls to TeliCam::recover(), including failed ones
+        double downtime_ms = 0.0; // From the last frame, or detection if there was none, to the first frame after
+    };
+
+    struct Stats
+    {
+        uint64_t incidents = 0;
+        uint64_t recoveries = 0;      // Incidents that ended with frames flowing again
+        uint64_t failed_attempts = 0; // Calls to TeliCam::recover() that threw, or after which no frame arrived
+        double last_downtime_ms = 0.0;
+        double max_downtime_ms = 0.0;
+        double total_downtime_ms = 0.0;
+        bool recovering = false; // An incident is in progress
+        Incident last_incident;  // Last completed incident
+    };
+
+  public:
+    /**
+     * @brief Start supervising a camera. The camera must outlive the supervisor.
+     *
+     * @param cam Camera to supervise
+     * @param options Supervisor options
+     * @param on_recovered Called on the supervisor thread after each completed incident
+     */
+    StreamSupervisor(TeliCam& cam, const Options& options, std::function<void(const Incident&)> on_recovered = {});
+
+    /**
+     * @brief Stop supervising. An incident in progress is abandoned and the camera is left as it is.
+     */
+    ~StreamSupervisor();
+
+    StreamSupervisor(const StreamSupervisor&) = delete;
+    StreamSupervisor& operator=(const StreamSupervisor&) = delete;
+
+    Stats get_stats() const;
+
+  private:
+    void run();
+    int64_t stall_timeout_ns() const;
+
+    /**
+     * @brief Sleep for up to a number of milliseconds.
+     *
+     * @return true if the supervisor is stopping
+     */
+    bool wait(uint32_t ms);
+
+    /**
+     * @brief Recover the camera and wait for the first frame, retrying until frames flow or the supervisor stops.
+     */
+    void handle_incident(Incident incident);
+
+  private:
+    TeliCam& cam;
+    Options options;
+    std::function<void(const Incident&)> on_recovered;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping;
+    Stats stats;
+
+    std::thread thread;
+};
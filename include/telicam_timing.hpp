@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+/**
+ * @brief Current host time in nanoseconds on the monotonic clock (CLOCK_MONOTONIC on Linux).
+ */
+inline int64_t monotonic_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Summary of the durations recorded for one stage of the frame path.
+ */
+struct StageTiming
+{
+    uint64_t count = 0;
+    double mean_us = 0.0;
+    double stddev_us = 0.0; // Jitter
+    double min_us = 0.0;
+    double max_us = 0.0;
+};
+
+/**
+ * @brief Lock-free accumulator for the durations of one stage of the frame path. Recording never blocks; with several
+ * writers its compare-exchange loops may retry. Safe to read from any thread.
+ */
+class StageTimer
+{
+  public:
+    /**
+     * @brief Record the duration of one pass through the stage.
+     *
+     * @param duration_ns Duration in nanoseconds
+     */
+    void record(int64_t duration_ns)
+    {
+        count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(duration_ns, std::memory_order_relaxed);
+
+        double duration_us = duration_ns * 1e-3;
+        double sum_sq = total_sq_us.load(std::memory_order_relaxed);
+        while (!total_sq_us.compare_exchange_weak(sum_sq, sum_sq + duration_us * duration_us,
+                                                  std::memory_order_relaxed))
+        {
+        }
+
+        int64_t current_min = min_ns.load(std::memory_order_relaxed);
+        while (duration_ns < current_min &&
+               !min_ns.compare_exchange_weak(current_min, duration_ns, std::memory_order_relaxed))
+        {
+        }
+
+        int64_t current_max = max_ns.load(std::memory_order_relaxed);
+        while (duration_ns > current_max &&
+               !max_ns.compare_exchange_weak(current_max, duration_ns, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    /**
+     * @brief Get a summary of all durations recorded since the last reset.
+     *
+     * @return StageTiming Timing summary
+     */
+    StageTiming get_timing() const
+    {
+        StageTiming timing;
+        timing.count = count.load(std::memory_order_relaxed);
+        if (timing.count == 0)
+            return timing;
+
+        timing.mean_us = total_ns.load(std::memory_order_relaxed) * 1e-3 / timing.count;
+        double variance = total_sq_us.load(std::memory_order_relaxed) / timing.count - timing.mean_us * timing.mean_us;
+        timing.stddev_us = std::sqrt(variance > 0.0 ? variance : 0.0);
+        timing.min_us = min_ns.load(std::memory_order_relaxed) * 1e-3;
+        timing.max_us = max_ns.load(std::memory_order_relaxed) * 1e-3;
+        return timing;
+    }
+
+    /**
+     * @brief Discard all recorded durations.
+     */
+    void reset()
+    {
+        count = 0;
+        total_ns = 0;
+        total_sq_us = 0.0;
+        min_ns = std::numeric_limits<int64_t>::max();
+        max_ns = 0;
+    }
+
+  private:
+    std::atomic<uint64_t> count{0};
+    std::atomic<int64_t> total_ns{0};
+    std::atomic<double> total_sq_us{0.0};
+    std::atomic<int64_t> min_ns{std::numeric_limits<int64_t>::max()};
+    std::atomic<int64_t> max_ns{0};
+};
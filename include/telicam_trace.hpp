@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "telicam_timing.hpp"
+
+/**
+ * @brief Records per-frame spans into lock-free per-thread rings and exports them as Chrome trace-event JSON, which
+ * opens in Perfetto (ui.perfetto.dev) and chrome://tracing. Tracing can be started and stopped at any time; while
+ * stopped, a span costs one relaxed atomic load.
+ */
+class Tracer
+{
+  public:
+    /**
+     * @brief Start recording. Spans recorded before this call are not exported.
+     */
+    static void start();
+
+    /**
+     * @brief Stop recording. Recorded spans are kept until the next start().
+     */
+    static void stop();
+
+    /**
+     * @brief Check whether spans are being recorded.
+     */
+    static bool is_enabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Write all spans recorded since the last start() as Chrome trace-event JSON. Each thread keeps its most
+     * recent events only, so very long captures lose their beginning.
+     *
+     * @param filename Output file
+     */
+    static void dump(const std::string& filename);
+
+    /**
+     * @brief Record a completed span on the calling thread.
+     *
+     * @param name Span name. Must be a string literal or otherwise outlive the tracer.
+     * @param camera_id Camera the span belongs to, or -1
+     * @param frame_id Frame the span belongs to
+     * @param start_ns Monotonic start time
+     * @param end_ns Monotonic end time
+     */
+    static void record(const char* name, int camera_id, uint64_t frame_id, int64_t start_ns, int64_t end_ns);
+
+  private:
+    static std::atomic<bool> enabled;
+    static std::atomic<int64_t> start_ns;
+};
+
+/**
+ * @brief Records a span covering its own lifetime if tracing is enabled when it is created.
+ */
+class TraceSpan
+{
+  public:
+    explicit TraceSpan(const char* name, int camera_id = -1, uint64_t frame_id = 0)
+        : name(name)
+        , camera_id(camera_id)
+        , frame_id(frame_id)
+        , start_ns(Tracer::is_enabled() ? monotonic_ns() : 0)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (start_ns != 0)
+        {
+            Tracer::record(name, camera_id, frame_id, start_ns, monotonic_ns());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    /**
+     * @brief Set the frame ID once it becomes known inside the span.
+     */
+    void set_frame_id(uint64_t id)
+    {
+        frame_id = id;
+    }
+
+  private:
+    const char* name;
+    int camera_id;
+    uint64_t frame_id;
+    int64_t start_ns;
+};
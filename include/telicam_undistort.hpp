@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * @brief Pinhole intrinsics and lens distortion of a camera, in OpenCV's conventions.
+ */
+struct CameraCalibration
+{
+    std::vector<double> camera_matrix;           // fx, 0, cx, 0, fy, cy, 0, 0, 1, row-major
+    std::vector<double> distortion_coefficients; // k1, k2, p1, p2[, k3[, k4, k5, k6]]
+    cv::Size image_size;                         // Size the calibration was made at. Empty means the frame size
+
+    bool empty() const
+    {
+        return camera_matrix.empty();
+    }
+};
+
+/**
+ * @brief Removes lens distortion from BGR frames, with the same result as cv::undistort. The remap tables are built
+ * once in OpenCV's compact fixed-point format (CV_16SC2 integer positions plus CV_16UC1 sub-pixel indices, 6 bytes
+ * per pixel instead of 8 for float maps) and can be cached on disk, so that processes sharing a calibration do not
+ * each rebuild them. Frames are remapped in tiles on OpenCV's thread pool, using its vectorized fixed-point kernel.
+ */
+class Undistorter
+{
+  public:
+    /**
+     * @brief Build or load the remap tables for a frame size. A calibration made at another size, e.g. before binning
+     * or decimation, is scaled to the frame size.
+     *
+     * @param calibration Camera calibration
+     * @param frame_size Size of the frames to undistort
+     * @param cache_dir Directory in which tables are cached. Empty disables the cache.
+     */
+    Undistorter(const CameraCalibration& calibration, cv::Size frame_size, const std::string& cache_dir = "");
+
+    /**
+     * @brief Undistort a frame. Pixels that map outside the source are black.
+     *
+     * @param src CV_8UC3 frame of the size given at construction
+     * @param dst Destination, already allocated with the same size and type. Must not alias src.
+     */
+    void apply(const cv::Mat& src, cv::Mat& dst) const;
+
+    cv::Size get_frame_size() const;
+
+    /**
+     * @brief Check whether the tables were loaded from the cache rather than built.
+     */
+    bool is_cached() const;
+
+  private:
+    bool load(const std::string& filename);
+    void save(const std::string& filename) const;
+
+  private:
+    cv::Size frame_size;
+    cv::Mat map_xy;            // CV_16SC2 integer source positions
+    cv::Mat map_interpolation; // CV_16UC1 indices into OpenCV's bilinear weight table
+    uint64_t key;              // Hash of everything the tables depend on
+    bool cached;
+};
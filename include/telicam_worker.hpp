@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "telicam_frame.hpp"
+#include "telicam_timing.hpp"
+
+/**
+ * @brief Dedicated thread that takes raw frames off the SDK callback thread and processes them. The worker can be
+ * pinned to a set of cores and run with SCHED_FIFO priority. Its raw buffers are first touched by the worker itself,
+ * so under the default first-touch policy they live on the worker's NUMA node.
+ */
+class FrameWorker
+{
+  public:
+    struct Options
+    {
+        std::string name = "telicam";  // Thread name, truncated to 15 characters
+        std::vector<int> cpu_affinity; // Empty means no pinning
+        int priority = 0;              // SCHED_FIFO priority, 0 keeps the default scheduler
+        bool numa_local_buffers = true;
+        uint32_t queue_depth = 2;
+    };
+
+    using Handler = std::function<void(const RawFrame&)>;
+
+  public:
+    /**
+     * @brief Start the worker thread. Throws if the affinity or priority cannot be applied.
+     *
+     * @param options Worker options
+     * @param buffer_size Size of each raw buffer in bytes
+     * @param handler Function called on the worker thread for every submitted frame
+     */
+    FrameWorker(const Options& options, size_t buffer_size, Handler handler);
+
+    /**
+     * @brief Stop the worker thread. Frames still queued are discarded.
+     */
+    ~FrameWorker();
+
+    FrameWorker(const FrameWorker&) = delete;
+    FrameWorker& operator=(const FrameWorker&) = delete;
+
+    /**
+     * @brief Copy a raw frame into a free buffer and queue it for the worker. Called from the SDK callback thread, so
+     * it never allocates.
+     *
+     * @param raw Raw frame, only valid for the duration of the call
+     * @return true if the frame was queued, false if it was dropped because all buffers were busy or it is larger than
+     * a buffer
+     */
+    bool submit(const RawFrame& raw);
+
+    /**
+     * @brief Get the number of frames dropped, because all buffers were busy or the frame did not fit in one.
+     */
+    uint64_t get_dropped_frames() const;
+
+    /**
+     * @brief Get the number of dropped frames that were larger than a buffer.
+     */
+    uint64_t get_oversized_frames() const;
+
+    /**
+     * @brief Get the time from the SDK callback to the worker picking up each frame.
+     */
+    StageTiming get_handoff_timing() const;
+
+  private:
+    enum SlotState
+    {
+        SLOT_FREE,
+        SLOT_FILLING,
+        SLOT_READY,
+    };
+
+    struct Slot
+    {
+        std::atomic<int> state{SLOT_FREE};
+        std::vector<uint8_t> buffer;
+        RawFrame raw;
+    };
+
+    void run(size_t buffer_size);
+    void configure_thread();
+
+  private:
+    Options options;
+    Handler handler;
+
+    std::unique_ptr<Slot[]> slots;
+    uint32_t num_slots;
+    size_t buffer_size; // Of every slot, allocated when the worker starts
+
+    // Ring of the indices of ready slots, in submission order. It holds num_slots entries, one per slot, so it never
+    // overflows and is never grown on the SDK callback thread.
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::unique_ptr<uint32_t[]> queue;
+    uint64_t queue_head; // Next entry to take
+    uint64_t queue_tail; // Next entry to fill
+    bool stopping;
+
+    std::mutex ready_mutex;
+    std::condition_variable ready_cv;
+    bool ready;
+    std::string setup_error;
+
+    std::atomic<uint64_t> dropped_frames;
+    std::atomic<uint64_t> oversized_frames;
+    StageTimer handoff_timer;
+
+    std::thread thread;
+};
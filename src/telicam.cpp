@@ -1,31 +1,338 @@
+#include <algorithm>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
 
 #include "telicam.hpp"
+#include "telicam_clock.hpp"
+#include "telicam_convert.hpp"
+#include "telicam_denoise.hpp"
+#include "telicam_frame.hpp"
+#include "telicam_metrics.hpp"
+#include "telicam_stats.hpp"
+#include "telicam_trace.hpp"
+#include "telicam_undistort.hpp"
+#include "telicam_worker.hpp"
+
+/**
+ * @brief Counts listener calls in progress, so that removing a listener can wait for the calls that may still use it.
+ * Calls are counted in one of two phases. A removal moves new calls to the other phase, then waits for the calls of
+ * the old phase to finish. Calls never block, and a removal only waits for the calls that started before it.
+ */
+class ListenerCalls
+{
+  public:
+    /**
+     * @brief Counts listener calls for as long as it lives. Create it before loading a listener list.
+     */
+    class Scope
+    {
+      public:
+        explicit Scope(ListenerCalls& calls) : calls(calls), phase(calls.begin())
+        {
+        }
+
+        ~Scope()
+        {
+            calls.end(phase);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+      private:
+        ListenerCalls& calls;
+        unsigned phase;
+    };
+
+    /**
+     * @brief Wait for every call that started before this, after a listener list has been replaced.
+     */
+    void wait_for_calls()
+    {
+        std::lock_guard<std::mutex> removal_lock(removal_mutex);
+        unsigned phase = current_phase.load();
+        current_phase.store(phase ^ 1);
+
+        waiting.fetch_add(1);
+        {
+            std::unique_lock<std::mutex> lock(wait_mutex);
+            drained.wait(lock, [this, phase] { return in_progress[phase].load() == 0; });
+        }
+        waiting.fetch_sub(1);
+    }
+
+  private:
+    unsigned begin()
+    {
+        while (true)
+        {
+            unsigned phase = current_phase.load();
+            in_progress[phase].fetch_add(1);
+            // A removal that switched phases in between may already have seen the old phase drained
+            if (current_phase.load() == phase)
+                return phase;
+            end(phase);
+        }
+    }
+
+    void end(unsigned phase)
+    {
+        if (in_progress[phase].fetch_sub(1) == 1 && waiting.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            drained.notify_all();
+        }
+    }
+
+  private:
+    std::atomic<unsigned> current_phase{0};
+    std::atomic<uint32_t> in_progress[2] = {{0}, {0}};
+    std::atomic<uint32_t> waiting{0};
+
+    std::mutex removal_mutex; // Removals switch phases one at a time
+    std::mutex wait_mutex;
+    std::condition_variable drained;
+};
+
+struct TeliCam::StreamState
+{
+    using ListenerList = std::vector<std::pair<int, FrameListener>>;
+    using RawListenerList = std::vector<std::pair<int, RawFrameListener>>;
+
+    explicit StreamState(int camera_id) : camera_id(camera_id)
+    {
+    }
+
+    int camera_id;
+
+    std::mutex frame_mutex;
+    Frame last_frame;
+
+    // Converted frames are written into recycled, pre-faulted buffers. Only touched by the converting thread.
+    std::shared_ptr<FrameAllocator> allocator;
+    std::unique_ptr<FramePool> frame_pool;
+    std::unique_ptr<FramePool> spare_frame_pool; // Pool of the previous frame size, kept for switching back
+    size_t frame_pool_capacity = 1;
+    FrameConverter converter; // Kernels for the stream's pixel format, chosen in open_stream()
+    ConversionScratch conversion_scratch;
+    std::vector<cv::Rect> converted_rects; // Regions converted in the current frame, empty when the whole frame was
+
+    // Size of the configured profile, in which regions and the statistics ROI are given. Smaller frames, e.g. from a
+    // preview profile, use them scaled down.
+    cv::Size full_frame_size;
+
+    // Copy-on-write so the acquisition path never blocks on listener registration. Removal waits for the listener
+    // calls in progress.
+    std::mutex listener_mutex;
+    std::shared_ptr<const ListenerList> listeners;
+    std::shared_ptr<const RawListenerList> raw_listeners;
+    int next_listener_id = 0;
+    ListenerCalls listener_calls;
+
+    std::unique_ptr<FrameWorker> worker;
+    std::atomic<uint64_t> frames_processed{0};
+    StageTimer conversion_timer;
+    StageTimer publish_timer;
+
+    // Frames are converted into undistort_source, then undistorted into the pooled buffer
+    CameraCalibration calibration;
+    std::string undistort_cache_dir;
+    std::unique_ptr<Undistorter> undistorter;
+    cv::Mat undistort_source;
+    StageTimer undistortion_timer;
+
+    std::vector<RegionOfInterest> regions;
+    bool convert_regions_only = false;
+
+    std::unique_ptr<TemporalDenoiser> denoiser; // Only set with denoise
+    StageTimer denoise_timer;
+
+    bool compute_statistics = false;
+    StatisticsOptions statistics_options;
+    StageTimer statistics_timer;
+
+    // Guards parameters that can change while streaming
+    std::mutex parameters_mutex;
+
+    // Serializes the calls that use or replace the camera handles, so that a supervisor's recover() never interleaves
+    // with a stream start or stop, a profile switch or a register write from another thread
+    std::mutex control_mutex;
+    std::shared_ptr<CameraMetrics> metrics = std::make_shared<CameraMetrics>();
+
+    ClockSync clock_sync;
+    std::unique_ptr<ClockSampler> clock_sampler;
+
+    // Faults of a simulated camera
+    std::atomic<bool> simulated_connected{true};
+    std::atomic<bool> simulated_stream_failed{false};
+
+    // A profile switch builds the frame pool and undistortion tables of its frame size on the control thread, before
+    // the stream restarts, and the converting thread adopts them with the first frame of that size. The converting
+    // thread also replaces frame_pool, spare_frame_pool and undistorter under this mutex, so that the control thread
+    // can look at their sizes.
+    std::mutex prepared_mutex;
+    std::unique_ptr<FramePool> prepared_frame_pool;
+    std::unique_ptr<Undistorter> prepared_undistorter;
+
+    void prepare_frame_size(cv::Size frame_size);
+    void adopt_frame_size(cv::Size frame_size);
+    void on_raw_frame(const RawFrame& raw);
+    void process_raw_frame(const RawFrame& raw);
+};
 
 // Static variables
 bool TeliCam::api_initialized = false;
 Teli::CAM_SYSTEM_INFO TeliCam::sys_info = Teli::CAM_SYSTEM_INFO();
 uint32_t TeliCam::num_cameras = 0;
 
+// Guards the static system information, which cameras initialized concurrently all write
+static std::mutex system_info_mutex;
+
 TeliCam::TeliCam()
     : cam_id(0)
     , camera_initialized(false)
+    , stream_opened(false)
     , streaming(false)
+    , simulated(false)
+    , preview(false)
+    , resume_streaming(false)
+    , cam_handle(NULL)
+    , cam_stream_handle(NULL)
+    , stream_state(new StreamState(0))
 {
 }
 
 TeliCam::TeliCam(int camera_index)
     : cam_id(camera_index)
     , camera_initialized(false)
+    , stream_opened(false)
+    , streaming(false)
+    , simulated(false)
+    , preview(false)
+    , resume_streaming(false)
+    , cam_handle(NULL)
+    , cam_stream_handle(NULL)
+    , stream_state(new StreamState(camera_index))
+{
+}
+
+TeliCam::~TeliCam()
+{
+    // A moved-from TeliCam has no stream state and owns nothing
+    if (!stream_state)
+        return;
+
+    try
+    {
+        destroy();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "TeliCam " << cam_id << " destructor: " << e.what() << std::endl;
+    }
+}
+
+// The SDK callback context points into stream_state, which moves along with its owner, so moving keeps a running
+// stream valid. The moved-from object is left closed, with a null stream_state, and releases nothing.
+TeliCam::TeliCam(TeliCam&& other) noexcept
+    : camera_initialized(false)
+    , stream_opened(false)
     , streaming(false)
+    , simulated(false)
+    , preview(false)
+    , resume_streaming(false)
+    , cam_id(other.cam_id)
+    , cam_handle(NULL)
+    , cam_stream_handle(NULL)
+{
+    swap(other);
+}
+
+TeliCam& TeliCam::operator=(TeliCam&& other) noexcept
+{
+    if (this != &other)
+    {
+        // Takes over other's state, then hands this camera's previous state to a temporary that releases it
+        TeliCam previous(std::move(other));
+        swap(previous);
+    }
+    return *this;
+}
+
+void TeliCam::swap(TeliCam& other) noexcept
 {
+    using std::swap;
+    swap(camera_initialized, other.camera_initialized);
+    swap(stream_opened, other.stream_opened);
+    other.streaming = streaming.exchange(other.streaming);
+    swap(simulated, other.simulated);
+    other.preview = preview.exchange(other.preview);
+    swap(resume_streaming, other.resume_streaming);
+    swap(cam_id, other.cam_id);
+    swap(cam_info, other.cam_info);
+    swap(cam_handle, other.cam_handle);
+    swap(cam_stream_handle, other.cam_stream_handle);
+    swap(width, other.width);
+    swap(height, other.height);
+    swap(sensor_width, other.sensor_width);
+    swap(sensor_height, other.sensor_height);
+    swap(full_width, other.full_width);
+    swap(full_height, other.full_height);
+    swap(framerate, other.framerate);
+    swap(image_buffer_size, other.image_buffer_size);
+    swap(parameters, other.parameters);
+    swap(features, other.features);
+    swap(min_width, other.min_width);
+    swap(max_width, other.max_width);
+    swap(width_inc, other.width_inc);
+    swap(min_height, other.min_height);
+    swap(max_height, other.max_height);
+    swap(height_inc, other.height_inc);
+    swap(min_offset_x, other.min_offset_x);
+    swap(max_offset_x, other.max_offset_x);
+    swap(offset_x_inc, other.offset_x_inc);
+    swap(min_offset_y, other.min_offset_y);
+    swap(max_offset_y, other.max_offset_y);
+    swap(offset_y_inc, other.offset_y_inc);
+    swap(min_binning_x, other.min_binning_x);
+    swap(max_binning_x, other.max_binning_x);
+    swap(min_binning_y, other.min_binning_y);
+    swap(max_binning_y, other.max_binning_y);
+    swap(min_decimation_x, other.min_decimation_x);
+    swap(max_decimation_x, other.max_decimation_x);
+    swap(min_decimation_y, other.min_decimation_y);
+    swap(max_decimation_y, other.max_decimation_y);
+    swap(min_exposure_time, other.min_exposure_time);
+    swap(max_exposure_time, other.max_exposure_time);
+    swap(min_saturation, other.min_saturation);
+    swap(max_saturation, other.max_saturation);
+    swap(min_gamma, other.min_gamma);
+    swap(max_gamma, other.max_gamma);
+    swap(min_hue, other.min_hue);
+    swap(max_hue, other.max_hue);
+    swap(min_gain, other.min_gain);
+    swap(max_gain, other.max_gain);
+    swap(min_black_level, other.min_black_level);
+    swap(max_black_level, other.max_black_level);
+    swap(min_framerate, other.min_framerate);
+    swap(max_framerate, other.max_framerate);
+    swap(min_sharpness, other.min_sharpness);
+    swap(max_sharpness, other.max_sharpness);
+    swap(min_balance_ratio_r, other.min_balance_ratio_r);
+    swap(max_balance_ratio_r, other.max_balance_ratio_r);
+    swap(min_balance_ratio_b, other.min_balance_ratio_b);
+    swap(max_balance_ratio_b, other.max_balance_ratio_b);
+    swap(stream_state, other.stream_state);
 }
 
 void TeliCam::initialize(const Parameters& parameters)
 {
     if (camera_initialized)
     {
-        close_camera();
+        destroy();
     }
 
     get_system_info();
@@ -36,41 +343,222 @@ void TeliCam::initialize(const Parameters& parameters)
     get_camera_parameter_limits();
     set_camera_parameters(parameters);
     get_camera_properties();
+    preview = false;
+    allocate_frame_pool();
+    configure_statistics();
+    configure_denoise();
+    configure_undistortion();
+    configure_regions();
     open_stream();
+    start_clock_sync();
+    // Labelled by serial number, which unlike the camera index stays the same when recover() finds it again
+    MetricsRegistry::global().add(cam_info.szSerialNumber, stream_state->metrics);
 
     // Allocate all black image to last_frame
-    last_frame = cv::Mat(height, width, CV_8UC1, cv::Scalar(0));
+    std::lock_guard<std::mutex> lock(stream_state->frame_mutex);
+    stream_state->last_frame.image = cv::Mat(height, width, CV_8UC1, cv::Scalar(0));
+    stream_state->last_frame.metadata = FrameMetadata();
+}
+
+void TeliCam::initialize_simulated(const Parameters& parameters, uint32_t width, uint32_t height)
+{
+    destroy();
+
+    this->parameters = parameters;
+    this->width = width;
+    this->height = height;
+    sensor_width = width;
+    sensor_height = height;
+    full_width = width;
+    full_height = height;
+    preview = false;
+    stream_state->simulated_connected = true;
+    stream_state->simulated_stream_failed = false;
+    framerate = parameters.framerate;
+    image_buffer_size = width * height * 2;
+    features = SupportedFeatures();
+
+    // Limits of a typical sensor, so that runtime controls can be exercised without a camera
+    min_exposure_time = 10.0;
+    max_exposure_time = 1000000.0;
+    min_gain = 0.0;
+    max_gain = 24.0;
+
+    allocate_frame_pool();
+    configure_statistics();
+    configure_denoise();
+    configure_undistortion();
+    configure_regions();
+    create_worker();
+    simulated = true;
+    MetricsRegistry::global().add("simulated" + std::to_string(cam_id), stream_state->metrics);
+
+    std::lock_guard<std::mutex> lock(stream_state->frame_mutex);
+    stream_state->last_frame.image = cv::Mat(height, width, CV_8UC1, cv::Scalar(0));
+    stream_state->last_frame.metadata = FrameMetadata();
+}
+
+void TeliCam::inject_frame(const RawFrame& raw)
+{
+    if (!simulated)
+    {
+        throw std::runtime_error("TeliCam::inject_frame requires initialize_simulated()");
+    }
+
+    // A disconnected camera or failed stream delivers nothing
+    if (!stream_state->simulated_connected.load() || stream_state->simulated_stream_failed.load())
+        return;
+
+    stream_state->on_raw_frame(raw);
+}
+
+void TeliCam::inject_stream_error()
+{
+    if (!simulated)
+    {
+        throw std::runtime_error("TeliCam::inject_stream_error requires initialize_simulated()");
+    }
+
+    stream_state->metrics->record_stream_error();
+    stream_state->simulated_stream_failed = true;
+}
+
+void TeliCam::set_simulated_connected(bool connected)
+{
+    if (!simulated)
+    {
+        throw std::runtime_error("TeliCam::set_simulated_connected requires initialize_simulated()");
+    }
+
+    stream_state->simulated_connected = connected;
+    if (!connected)
+    {
+        stream_state->simulated_stream_failed = true;
+    }
+}
+
+void TeliCam::recover()
+{
+    std::lock_guard<std::mutex> lock(stream_state->control_mutex);
+
+    // Release what is left of the old handles. The camera may be gone, so errors are expected.
+    resume_streaming = resume_streaming || streaming;
+    if (streaming)
+    {
+        try
+        {
+            stop_stream_internal();
+        }
+        catch (const std::exception&)
+        {
+        }
+        streaming = false;
+    }
+    if (!simulated)
+    {
+        try
+        {
+            close_stream();
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+    if (camera_initialized)
+    {
+        try
+        {
+            close_camera();
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+
+    // The frame pool, worker options, listeners and metrics live in stream_state and are kept
+    if (simulated)
+    {
+        // Reopened the way a real camera is: it must be reachable again, and comes back in the configured profile
+        if (!stream_state->simulated_connected.load())
+        {
+            throw std::runtime_error("TeliCam: simulated camera is disconnected");
+        }
+        width = full_width;
+        height = full_height;
+        stream_state->simulated_stream_failed = false;
+    }
+    else
+    {
+        find_camera_by_serial_number();
+        open_camera();
+        get_camera_parameter_limits();
+        set_camera_parameters(get_parameters());
+        get_camera_properties();
+        open_stream();
+        start_clock_sync();
+    }
+    preview = false;
+    stream_state->prepare_frame_size(cv::Size(width, height));
+
+    if (resume_streaming)
+    {
+        stream_state->metrics->restart_sequence();
+        start_stream_internal();
+        streaming = true;
+        resume_streaming = false;
+    }
+    stream_state->metrics->record_recovery();
 }
 
 void TeliCam::start_stream()
 {
+    std::lock_guard<std::mutex> lock(stream_state->control_mutex);
     if (streaming)
         return;
 
+    stream_state->metrics->restart_sequence();
     start_stream_internal();
     streaming = true;
 }
 
 void TeliCam::capture_frame()
 {
+    std::lock_guard<std::mutex> lock(stream_state->control_mutex);
     capture_frame_internal();
 }
 
 void TeliCam::stop_stream()
 {
+    std::lock_guard<std::mutex> lock(stream_state->control_mutex);
     if (!streaming)
         return;
 
     stop_stream_internal();
+    streaming = false;
 }
 
 void TeliCam::destroy()
 {
+    std::lock_guard<std::mutex> lock(stream_state->control_mutex);
+    MetricsRegistry::global().remove(stream_state->metrics);
+    resume_streaming = false;
+    if (simulated)
+    {
+        stream_state->worker.reset();
+        simulated = false;
+        streaming = false;
+    }
+
+    if (!camera_initialized)
+        return;
+
     if (streaming)
     {
-        TeliCam::stop_stream();
+        stop_stream_internal();
+        streaming = false;
     }
 
+    close_stream();
     close_camera();
 }
 
@@ -81,11 +569,131 @@ bool TeliCam::is_streaming() const
 
 cv::Mat TeliCam::get_last_frame()
 {
-    return last_frame.clone();
+    TraceSpan span("get_last_frame", cam_id);
+    std::lock_guard<std::mutex> lock(stream_state->frame_mutex);
+    span.set_frame_id(stream_state->last_frame.metadata.frame_id);
+    return stream_state->last_frame.image.clone();
+}
+
+Frame TeliCam::get_last_frame_with_metadata()
+{
+    TraceSpan span("get_last_frame", cam_id);
+    std::lock_guard<std::mutex> lock(stream_state->frame_mutex);
+    span.set_frame_id(stream_state->last_frame.metadata.frame_id);
+    Frame frame;
+    frame.image = stream_state->last_frame.image.clone();
+    frame.metadata = stream_state->last_frame.metadata;
+
+    // Regions of the copy are views into the copy, at the same place as in the original
+    for (const FrameRegion& region : stream_state->last_frame.regions)
+    {
+        FrameRegion copy;
+        copy.name = region.name;
+        if (!region.image.empty())
+        {
+            cv::Size whole_size;
+            cv::Point offset;
+            region.image.locateROI(whole_size, offset);
+            copy.image = frame.image(cv::Rect(offset, region.image.size()));
+        }
+        frame.regions.push_back(copy);
+    }
+    return frame;
+}
+
+cv::Mat TeliCam::get_last_region(const std::string& name)
+{
+    TraceSpan span("get_last_region", cam_id);
+    std::lock_guard<std::mutex> lock(stream_state->frame_mutex);
+    span.set_frame_id(stream_state->last_frame.metadata.frame_id);
+    for (const FrameRegion& region : stream_state->last_frame.regions)
+    {
+        if (region.name == name)
+            return region.image;
+    }
+
+    for (const RegionOfInterest& region : parameters.regions)
+    {
+        if (region.name == name)
+            return cv::Mat();
+    }
+    throw std::runtime_error("TeliCam::get_last_region: no region named " + name);
+}
+
+/**
+ * @brief Publish a copy of a listener list with one listener added. The caller holds the listener mutex.
+ */
+template <typename Listener>
+static void add_listener(std::shared_ptr<const std::vector<std::pair<int, Listener>>>& current, int listener_id,
+                         Listener listener)
+{
+    auto listeners = std::make_shared<std::vector<std::pair<int, Listener>>>();
+    if (current)
+    {
+        *listeners = *current;
+    }
+
+    listeners->emplace_back(listener_id, std::move(listener));
+    std::atomic_store(&current, std::shared_ptr<const std::vector<std::pair<int, Listener>>>(listeners));
+}
+
+/**
+ * @brief Publish a copy of a listener list with one listener removed. The caller holds the listener mutex.
+ */
+template <typename Listener>
+static void remove_listener(std::shared_ptr<const std::vector<std::pair<int, Listener>>>& current, int listener_id)
+{
+    if (!current)
+        return;
+
+    auto listeners = std::make_shared<std::vector<std::pair<int, Listener>>>();
+    for (const auto& entry : *current)
+    {
+        if (entry.first != listener_id)
+        {
+            listeners->push_back(entry);
+        }
+    }
+    std::atomic_store(&current, std::shared_ptr<const std::vector<std::pair<int, Listener>>>(listeners));
+}
+
+int TeliCam::add_frame_listener(FrameListener listener)
+{
+    std::lock_guard<std::mutex> lock(stream_state->listener_mutex);
+    int listener_id = stream_state->next_listener_id++;
+    add_listener(stream_state->listeners, listener_id, std::move(listener));
+    return listener_id;
+}
+
+void TeliCam::remove_frame_listener(int listener_id)
+{
+    {
+        std::lock_guard<std::mutex> lock(stream_state->listener_mutex);
+        remove_listener(stream_state->listeners, listener_id);
+    }
+    stream_state->listener_calls.wait_for_calls();
+}
+
+int TeliCam::add_raw_frame_listener(RawFrameListener listener)
+{
+    std::lock_guard<std::mutex> lock(stream_state->listener_mutex);
+    int listener_id = stream_state->next_listener_id++;
+    add_listener(stream_state->raw_listeners, listener_id, std::move(listener));
+    return listener_id;
+}
+
+void TeliCam::remove_raw_frame_listener(int listener_id)
+{
+    {
+        std::lock_guard<std::mutex> lock(stream_state->listener_mutex);
+        remove_listener(stream_state->raw_listeners, listener_id);
+    }
+    stream_state->listener_calls.wait_for_calls();
 }
 
 TeliCam::Parameters TeliCam::get_parameters() const
 {
+    std::lock_guard<std::mutex> lock(stream_state->parameters_mutex);
     return parameters;
 }
 
@@ -94,6 +702,30 @@ TeliCam::SupportedFeatures TeliCam::get_supported_features() const
     return features;
 }
 
+TeliCam::TimingStats TeliCam::get_timing_stats() const
+{
+    TimingStats stats;
+    stats.frames_processed = stream_state->frames_processed.load(std::memory_order_relaxed);
+    {
+        // recover() and close_stream() replace the worker under the control mutex
+        std::lock_guard<std::mutex> control_lock(stream_state->control_mutex);
+        stats.frames_dropped = 0;
+        stats.frames_oversized = 0;
+        if (stream_state->worker)
+        {
+            stats.frames_dropped = stream_state->worker->get_dropped_frames();
+            stats.frames_oversized = stream_state->worker->get_oversized_frames();
+            stats.handoff = stream_state->worker->get_handoff_timing();
+        }
+    }
+    stats.conversion = stream_state->conversion_timer.get_timing();
+    stats.denoise = stream_state->denoise_timer.get_timing();
+    stats.undistortion = stream_state->undistortion_timer.get_timing();
+    stats.publish = stream_state->publish_timer.get_timing();
+    stats.statistics = stream_state->statistics_timer.get_timing();
+    return stats;
+}
+
 uint32_t TeliCam::get_sensor_width() const
 {
     return sensor_width;
@@ -104,6 +736,260 @@ uint32_t TeliCam::get_sensor_height() const
     return sensor_height;
 }
 
+cv::Size TeliCam::get_frame_size() const
+{
+    return cv::Size(width, height);
+}
+
+BinningLimits TeliCam::get_binning_limits() const
+{
+    BinningLimits limits;
+    if (simulated)
+    {
+        // Factors of a typical sensor, so that previews can be exercised without a camera
+        limits.max_binning = 2;
+        limits.max_decimation = 4;
+        return limits;
+    }
+
+    if (features.has_binning)
+    {
+        limits.min_binning = std::min(min_binning_x, min_binning_y);
+        limits.max_binning = std::min(max_binning_x, max_binning_y);
+    }
+    if (features.has_decimation)
+    {
+        limits.min_decimation = std::min(min_decimation_x, min_decimation_y);
+        limits.max_decimation = std::min(max_decimation_x, max_decimation_y);
+    }
+    return limits;
+}
+
+PreviewProfile TeliCam::set_preview_profile(cv::Size target_size)
+{
+    std::lock_guard<std::mutex> lock(stream_state->control_mutex);
+
+    // Plan on the configured region without any binning or decimation, so that the preview shows the same view
+    uint32_t factor_x = std::max<uint32_t>(parameters.binning_x, 1) * std::max<uint32_t>(parameters.decimation_x, 1);
+    uint32_t factor_y = std::max<uint32_t>(parameters.binning_y, 1) * std::max<uint32_t>(parameters.decimation_y, 1);
+    cv::Size unreduced_size(full_width * factor_x, full_height * factor_y);
+    PreviewProfile profile = plan_preview_profile(unreduced_size, target_size, get_binning_limits());
+
+    uint32_t factor = profile.binning * profile.decimation;
+    Parameters preview_parameters = parameters;
+    preview_parameters.binning_x = profile.binning;
+    preview_parameters.binning_y = profile.binning;
+    preview_parameters.decimation_x = profile.decimation;
+    preview_parameters.decimation_y = profile.decimation;
+    preview_parameters.width = unreduced_size.width / factor;
+    preview_parameters.height = unreduced_size.height / factor;
+    preview_parameters.offset_x = parameters.offset_x * factor_x / factor;
+    preview_parameters.offset_y = parameters.offset_y * factor_y / factor;
+    if (!simulated)
+    {
+        preview_parameters.width = std::max(
+            preview_parameters.width - preview_parameters.width % std::max<uint32_t>(width_inc, 1), min_width);
+        preview_parameters.height = std::max(
+            preview_parameters.height - preview_parameters.height % std::max<uint32_t>(height_inc, 1), min_height);
+        preview_parameters.offset_x -= preview_parameters.offset_x % std::max<uint32_t>(offset_x_inc, 1);
+        preview_parameters.offset_y -= preview_parameters.offset_y % std::max<uint32_t>(offset_y_inc, 1);
+    }
+
+    apply_capture_profile(preview_parameters);
+    preview = true;
+    profile.camera_size = cv::Size(width, height);
+    return profile;
+}
+
+void TeliCam::set_full_profile()
+{
+    std::lock_guard<std::mutex> lock(stream_state->control_mutex);
+    if (!preview)
+        return;
+
+    Parameters full_parameters = parameters;
+    full_parameters.width = full_width;
+    full_parameters.height = full_height;
+    apply_capture_profile(full_parameters);
+    preview = false;
+}
+
+bool TeliCam::is_preview() const
+{
+    return preview;
+}
+
+static void check_status(Teli::CAM_API_STATUS cam_status, const char* call)
+{
+    if (cam_status != Teli::CAM_API_STS_SUCCESS)
+    {
+        throw std::runtime_error(std::string("Telicam ") + call + " failed");
+    }
+}
+
+void TeliCam::apply_capture_profile(const Parameters& profile)
+{
+    if (simulated)
+    {
+        width = profile.width;
+        height = profile.height;
+        stream_state->prepare_frame_size(cv::Size(width, height));
+        return;
+    }
+
+    // Only the geometry changes, so the stream and its buffers, sized for the configured profile, are kept open
+    bool was_streaming = streaming;
+    if (was_streaming)
+    {
+        stop_stream_internal();
+    }
+
+    try
+    {
+        write_capture_profile(profile);
+    }
+    catch (const std::exception&)
+    {
+        // Go back to the configured profile and restart, rather than leave a stream that is reported as running but
+        // delivers nothing. If even that fails, the stream is left stopped until recover() resumes it.
+        try
+        {
+            Parameters full_profile = parameters;
+            full_profile.width = full_width;
+            full_profile.height = full_height;
+            write_capture_profile(full_profile);
+            preview = false;
+            if (was_streaming)
+            {
+                stream_state->metrics->restart_sequence();
+                start_stream_internal();
+            }
+        }
+        catch (const std::exception&)
+        {
+            if (was_streaming)
+            {
+                streaming = false;
+                resume_streaming = true;
+            }
+        }
+        throw;
+    }
+
+    if (was_streaming)
+    {
+        stream_state->metrics->restart_sequence();
+        start_stream_internal();
+    }
+}
+
+void TeliCam::write_capture_profile(const Parameters& profile)
+{
+    // Offsets are cleared first so that the new size fits whether binning grows or shrinks
+    check_status(Teli::SetCamOffsetX(cam_handle, 0), "SetCamOffsetX");
+    check_status(Teli::SetCamOffsetY(cam_handle, 0), "SetCamOffsetY");
+    if (features.has_binning)
+    {
+        check_status(Teli::SetCamBinningHorizontal(cam_handle, std::max<uint32_t>(profile.binning_x, 1)),
+                     "SetCamBinningHorizontal");
+        check_status(Teli::SetCamBinningVertical(cam_handle, std::max<uint32_t>(profile.binning_y, 1)),
+                     "SetCamBinningVertical");
+    }
+    if (features.has_decimation)
+    {
+        check_status(Teli::SetCamDecimationHorizontal(cam_handle, std::max<uint32_t>(profile.decimation_x, 1)),
+                     "SetCamDecimationHorizontal");
+        check_status(Teli::SetCamDecimationVertical(cam_handle, std::max<uint32_t>(profile.decimation_y, 1)),
+                     "SetCamDecimationVertical");
+    }
+    check_status(Teli::SetCamWidth(cam_handle, profile.width), "SetCamWidth");
+    check_status(Teli::SetCamHeight(cam_handle, profile.height), "SetCamHeight");
+    check_status(Teli::SetCamOffsetX(cam_handle, profile.offset_x), "SetCamOffsetX");
+    check_status(Teli::SetCamOffsetY(cam_handle, profile.offset_y), "SetCamOffsetY");
+
+    Teli::GetCamWidth(cam_handle, &width);
+    Teli::GetCamHeight(cam_handle, &height);
+
+    // Buffers and tables of the new size are ready before its first frame arrives
+    stream_state->prepare_frame_size(cv::Size(width, height));
+}
+
+void TeliCam::set_exposure_time(float64_t exposure_time)
+{
+    if (exposure_time > max_exposure_time || exposure_time < min_exposure_time)
+    {
+        std::stringstream ss;
+        ss << "Exposure time out of range. Min: " << min_exposure_time << " Max: " << max_exposure_time;
+        throw std::runtime_error(ss.str());
+    }
+
+    std::lock_guard<std::mutex> control_lock(stream_state->control_mutex);
+    if (!simulated)
+    {
+        if (!features.has_exposure_time)
+        {
+            throw std::runtime_error("Telicam exposure time is not supported");
+        }
+
+        Teli::CAM_API_STATUS cam_status = Teli::SetCamExposureTime(cam_handle, exposure_time);
+        if (cam_status != Teli::CAM_API_STS_SUCCESS)
+        {
+            throw std::runtime_error("Telicam SetCamExposureTime failed");
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stream_state->parameters_mutex);
+    parameters.exposure_time = exposure_time;
+}
+
+void TeliCam::set_gain(float64_t gain)
+{
+    if (gain > max_gain || gain < min_gain)
+    {
+        std::stringstream ss;
+        ss << "Gain out of range. Min: " << min_gain << " Max: " << max_gain;
+        throw std::runtime_error(ss.str());
+    }
+
+    std::lock_guard<std::mutex> control_lock(stream_state->control_mutex);
+    if (!simulated)
+    {
+        if (!features.has_gain)
+        {
+            throw std::runtime_error("Telicam gain is not supported");
+        }
+
+        Teli::CAM_API_STATUS cam_status = Teli::SetCamGain(cam_handle, gain);
+        if (cam_status != Teli::CAM_API_STS_SUCCESS)
+        {
+            throw std::runtime_error("Telicam SetCamGain failed");
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stream_state->parameters_mutex);
+    parameters.gain = gain;
+}
+
+float64_t TeliCam::get_min_exposure_time() const
+{
+    return min_exposure_time;
+}
+
+float64_t TeliCam::get_max_exposure_time() const
+{
+    return max_exposure_time;
+}
+
+float64_t TeliCam::get_min_gain() const
+{
+    return min_gain;
+}
+
+float64_t TeliCam::get_max_gain() const
+{
+    return max_gain;
+}
+
 void TeliCam::print_system_info() const
 {
     std::cout << "TeliCam API System info:" << std::endl;
@@ -149,6 +1035,56 @@ void TeliCam::print_parameters() const
     std::cout << "  Trigger mode: " << parameters.trigger_mode << std::endl;
 }
 
+std::shared_ptr<const CameraMetrics> TeliCam::get_metrics() const
+{
+    return stream_state->metrics;
+}
+
+HostTimestamp TeliCam::to_host_time(uint64_t device_timestamp) const
+{
+    return stream_state->clock_sync.to_host(device_timestamp);
+}
+
+FrameMemoryStats TeliCam::get_memory_stats() const
+{
+    return stream_state->allocator ? stream_state->allocator->get_stats() : FrameMemoryStats();
+}
+
+void TeliCam::print_timing_stats() const
+{
+    auto print_stage = [](const char* name, const StageTiming& timing) {
+        std::cout << "  " << name << ": mean " << timing.mean_us << " us, stddev " << timing.stddev_us << " us, min "
+                  << timing.min_us << " us, max " << timing.max_us << " us" << std::endl;
+    };
+
+    TimingStats stats = get_timing_stats();
+    std::cout << "TeliCam " << cam_id << " timing:" << std::endl;
+    std::cout << "  Frames processed: " << stats.frames_processed << std::endl;
+    std::cout << "  Frames dropped: " << stats.frames_dropped << std::endl;
+    if (stats.frames_oversized > 0)
+    {
+        std::cout << "  Frames larger than the payload size: " << stats.frames_oversized << std::endl;
+    }
+    if (parameters.use_worker_thread)
+    {
+        print_stage("Handoff", stats.handoff);
+    }
+    print_stage("Conversion", stats.conversion);
+    if (parameters.denoise)
+    {
+        print_stage("Denoise", stats.denoise);
+    }
+    if (!parameters.calibration.empty())
+    {
+        print_stage("Undistortion", stats.undistortion);
+    }
+    if (parameters.compute_statistics)
+    {
+        print_stage("Statistics", stats.statistics);
+    }
+    print_stage("Publish", stats.publish);
+}
+
 void TeliCam::initialize_api()
 {
     if (api_initialized)
@@ -163,6 +1099,7 @@ void TeliCam::initialize_api()
 
 void TeliCam::get_system_info()
 {
+    std::lock_guard<std::mutex> lock(system_info_mutex);
     Teli::CAM_API_STATUS cam_status = Teli::Sys_GetInformation(&TeliCam::sys_info);
     if (cam_status != Teli::CAM_API_STS_SUCCESS)
     {
@@ -172,6 +1109,7 @@ void TeliCam::get_system_info()
 
 void TeliCam::get_num_cameras()
 {
+    std::lock_guard<std::mutex> lock(system_info_mutex);
     Teli::CAM_API_STATUS cam_status = Teli::Sys_GetNumOfCameras(&TeliCam::num_cameras);
     if (cam_status != Teli::CAM_API_STS_SUCCESS)
     {
@@ -193,6 +1131,32 @@ void TeliCam::get_camera_info()
     }
 }
 
+void TeliCam::find_camera_by_serial_number()
+{
+    std::string serial_number = cam_info.szSerialNumber;
+
+    uint32_t count = 0;
+    Teli::CAM_API_STATUS cam_status = Teli::Sys_GetNumOfCameras(&count);
+    if (cam_status != Teli::CAM_API_STS_SUCCESS)
+    {
+        throw std::runtime_error("Telicam Sys_GetNumOfCameras failed");
+    }
+
+    for (uint32_t index = 0; index < count; ++index)
+    {
+        Teli::CAM_INFO info;
+        cam_status = Teli::Cam_GetInformation((Teli::CAM_HANDLE)NULL, index, &info);
+        if (cam_status == Teli::CAM_API_STS_SUCCESS && serial_number == info.szSerialNumber)
+        {
+            cam_id = index;
+            cam_info = info;
+            return;
+        }
+    }
+
+    throw std::runtime_error("Telicam " + serial_number + " not found");
+}
+
 void TeliCam::open_camera()
 {
     Teli::CAM_API_STATUS cam_status = Teli::Cam_Open(cam_id, &cam_handle);
@@ -200,6 +1164,7 @@ void TeliCam::open_camera()
     {
         throw std::runtime_error("Telicam Cam_Open failed");
     }
+    camera_initialized = true;
 }
 
 void TeliCam::get_camera_parameter_limits()
@@ -271,7 +1236,10 @@ void TeliCam::get_camera_parameter_limits()
 
 void TeliCam::set_camera_parameters(Parameters parameters)
 {
-    this->parameters = parameters;
+    {
+        std::lock_guard<std::mutex> lock(stream_state->parameters_mutex);
+        this->parameters = parameters;
+    }
 
     Teli::SetCamExposureTimeControl(cam_handle, Teli::CAM_EXPOSURE_TIME_CONTROL_MANUAL);
     Teli::SetCamAcquisitionFrameRateControl(cam_handle, Teli::CAM_ACQ_FRAME_RATE_CTRL_MANUAL);
@@ -575,26 +1543,398 @@ void TeliCam::get_camera_properties()
     Teli::GetCamHeight(cam_handle, &height);
     Teli::GetCamSensorWidth(cam_handle, &sensor_width);
     Teli::GetCamSensorHeight(cam_handle, &sensor_height);
+    full_width = width;
+    full_height = height;
     // Print sensor width and height
     std::cout << "Sensor width: " << sensor_width << std::endl;
     std::cout << "Sensor height: " << sensor_height << std::endl;
     Teli::GetCamAcquisitionFrameRate(cam_handle, &framerate);
 }
 
+void TeliCam::allocate_frame_pool()
+{
+    FrameAllocator::Options allocator_options;
+    allocator_options.use_huge_pages = parameters.use_huge_pages;
+    allocator_options.lock_memory = parameters.lock_frame_memory;
+
+    // The previous pool and allocator stay alive for as long as consumers hold frames from them
+    stream_state->frame_pool.reset();
+    stream_state->spare_frame_pool.reset();
+    stream_state->prepared_frame_pool.reset();
+    stream_state->full_frame_size = cv::Size(width, height);
+    stream_state->frame_pool_capacity = std::max<uint32_t>(parameters.frame_pool_size, 1);
+    stream_state->allocator = FrameAllocator::create(allocator_options);
+    stream_state->frame_pool.reset(new FramePool(stream_state->allocator, cv::Size(width, height), CV_8UC3,
+                                                 stream_state->frame_pool_capacity,
+                                                 parameters.convert_regions_only && !parameters.regions.empty()));
+}
+
+/**
+ * @brief Scale a rectangle given for frames of one size to frames of another.
+ */
+static cv::Rect scale_rect(const cv::Rect& rect, cv::Size from, cv::Size to)
+{
+    if (from == to || from.area() == 0)
+        return rect;
+
+    int x0 = static_cast<int>(static_cast<int64_t>(rect.x) * to.width / from.width);
+    int y0 = static_cast<int>(static_cast<int64_t>(rect.y) * to.height / from.height);
+    int x1 = static_cast<int>(static_cast<int64_t>(rect.x + rect.width) * to.width / from.width);
+    int y1 = static_cast<int>(static_cast<int64_t>(rect.y + rect.height) * to.height / from.height);
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+void TeliCam::StreamState::process_raw_frame(const RawFrame& raw)
+{
+    {
+        ListenerCalls::Scope calls(listener_calls);
+        std::shared_ptr<const RawListenerList> current_raw_listeners = std::atomic_load(&raw_listeners);
+        if (current_raw_listeners)
+        {
+            for (const auto& entry : *current_raw_listeners)
+            {
+                entry.second(raw);
+            }
+        }
+    }
+
+    int64_t start_ns = monotonic_ns();
+
+    cv::Size frame_size(raw.width, raw.height);
+    if (!frame_pool || frame_pool->get_frame_size() != frame_size ||
+        (undistorter && undistorter->get_frame_size() != frame_size))
+    {
+        adopt_frame_size(frame_size);
+    }
+    cv::Mat image = frame_pool->acquire();
+
+    if (undistorter)
+    {
+        undistort_source.create(frame_size, CV_8UC3);
+    }
+
+    {
+        TraceSpan span("convert", camera_id, raw.block_id);
+        // Only frames in another format than the stream was opened with, e.g. injected ones, choose kernels here
+        if (raw.pixel_format != converter.pixel_format)
+        {
+            converter = select_frame_converter(raw.pixel_format);
+        }
+
+        converted_rects.clear();
+        if (convert_regions_only && converter.convert_region)
+        {
+            cv::Rect frame_rect(cv::Point(), frame_size);
+            for (const RegionOfInterest& region : regions)
+            {
+                cv::Rect rect = scale_rect(region.rect, full_frame_size, frame_size) & frame_rect;
+                if (!rect.empty())
+                {
+                    cv::Mat dst = image(rect);
+                    converter.convert_region(raw, rect, dst, conversion_scratch);
+                    converted_rects.push_back(rect);
+                }
+            }
+        }
+        else
+        {
+            converter.convert(raw, undistorter ? undistort_source : image, conversion_scratch);
+        }
+    }
+
+    int64_t converted_ns = monotonic_ns();
+    conversion_timer.record(converted_ns - start_ns);
+    metrics->record_conversion(converted_ns - start_ns);
+
+    // Denoised in place in the buffer just converted into, while it is still in cache
+    int64_t denoised_ns = converted_ns;
+    if (denoiser)
+    {
+        TraceSpan span("denoise", camera_id, raw.block_id);
+        denoiser->apply(undistorter ? undistort_source : image, converted_rects);
+
+        denoised_ns = monotonic_ns();
+        denoise_timer.record(denoised_ns - converted_ns);
+    }
+
+    // Undistorted straight into the pooled buffer, while the converted frame is still in cache
+    int64_t undistorted_ns = denoised_ns;
+    if (undistorter)
+    {
+        TraceSpan span("undistort", camera_id, raw.block_id);
+        undistorter->apply(undistort_source, image);
+
+        undistorted_ns = monotonic_ns();
+        undistortion_timer.record(undistorted_ns - denoised_ns);
+    }
+
+    // Computed now, while the frame is still in cache
+    std::shared_ptr<FrameStatistics> statistics;
+    int64_t publish_start_ns = undistorted_ns;
+    if (compute_statistics)
+    {
+        TraceSpan span("statistics", camera_id, raw.block_id);
+        statistics = std::make_shared<FrameStatistics>();
+        StatisticsOptions options = statistics_options;
+        options.roi = scale_rect(options.roi, full_frame_size, frame_size);
+        if (converted_rects.empty())
+        {
+            compute_frame_statistics(image, options, *statistics);
+        }
+        else
+        {
+            // Only the converted regions hold the scene, the rest of the frame is black
+            cv::Rect roi = options.roi.area() > 0 ? options.roi : cv::Rect(cv::Point(), frame_size);
+            FrameStatistics region_statistics;
+            for (const cv::Rect& rect : converted_rects)
+            {
+                options.roi = rect & roi;
+                if (!options.roi.empty())
+                {
+                    compute_frame_statistics(image, options, region_statistics);
+                    add_frame_statistics(region_statistics, *statistics);
+                }
+            }
+        }
+
+        publish_start_ns = monotonic_ns();
+        statistics_timer.record(publish_start_ns - undistorted_ns);
+    }
+
+    TraceSpan span("publish", camera_id, raw.block_id);
+
+    Frame frame;
+    frame.image = image;
+    frame.metadata.frame_id = raw.block_id;
+    frame.metadata.receive_ns = raw.receive_ns;
+    frame.metadata.device_timestamp = raw.device_timestamp;
+
+    HostTimestamp exposure = clock_sync.to_host(raw.device_timestamp);
+    frame.metadata.exposure_ns = exposure.ns;
+    frame.metadata.exposure_uncertainty_ns = exposure.uncertainty_ns;
+    frame.metadata.statistics = std::move(statistics);
+    frame.metadata.publish_ns = monotonic_ns();
+
+    frame.regions.resize(regions.size());
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        cv::Rect rect = scale_rect(regions[i].rect, full_frame_size, frame_size) & cv::Rect(cv::Point(), frame_size);
+        frame.regions[i].name = regions[i].name;
+        if (!rect.empty())
+        {
+            frame.regions[i].image = image(rect);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(frame_mutex);
+        last_frame = frame;
+    }
+
+    publish_timer.record(monotonic_ns() - publish_start_ns);
+    frames_processed.fetch_add(1, std::memory_order_relaxed);
+
+    ListenerCalls::Scope calls(listener_calls);
+    std::shared_ptr<const ListenerList> current_listeners = std::atomic_load(&listeners);
+    if (current_listeners)
+    {
+        for (const auto& entry : *current_listeners)
+        {
+            entry.second(frame);
+        }
+    }
+}
+
+void TeliCam::StreamState::prepare_frame_size(cv::Size frame_size)
+{
+    bool build_pool;
+    bool build_undistorter;
+    {
+        std::lock_guard<std::mutex> lock(prepared_mutex);
+        auto has_size = [frame_size](const std::unique_ptr<FramePool>& pool) {
+            return pool && pool->get_frame_size() == frame_size;
+        };
+        build_pool = !has_size(frame_pool) && !has_size(spare_frame_pool) && !has_size(prepared_frame_pool);
+        build_undistorter = undistorter && undistorter->get_frame_size() != frame_size &&
+                            !(prepared_undistorter && prepared_undistorter->get_frame_size() == frame_size);
+    }
+
+    // Built without the lock, while frames of the old size may still be converted
+    std::unique_ptr<FramePool> pool;
+    std::unique_ptr<Undistorter> frame_undistorter;
+    if (build_pool)
+    {
+        pool.reset(new FramePool(allocator, frame_size, CV_8UC3, frame_pool_capacity, convert_regions_only));
+    }
+    if (build_undistorter)
+    {
+        frame_undistorter.reset(new Undistorter(calibration, frame_size, undistort_cache_dir));
+    }
+
+    std::lock_guard<std::mutex> lock(prepared_mutex);
+    if (pool)
+    {
+        prepared_frame_pool = std::move(pool);
+    }
+    if (frame_undistorter)
+    {
+        prepared_undistorter = std::move(frame_undistorter);
+    }
+}
+
+void TeliCam::StreamState::adopt_frame_size(cv::Size frame_size)
+{
+    std::lock_guard<std::mutex> lock(prepared_mutex);
+    if (!frame_pool || frame_pool->get_frame_size() != frame_size)
+    {
+        if (spare_frame_pool && spare_frame_pool->get_frame_size() == frame_size)
+        {
+            std::swap(frame_pool, spare_frame_pool);
+        }
+        else if (prepared_frame_pool && prepared_frame_pool->get_frame_size() == frame_size)
+        {
+            spare_frame_pool = std::move(frame_pool);
+            frame_pool = std::move(prepared_frame_pool);
+        }
+        else
+        {
+            // A size no profile switch announced, e.g. an injected frame, is allocated here
+            spare_frame_pool = std::move(frame_pool);
+            frame_pool.reset(new FramePool(allocator, frame_size, CV_8UC3, frame_pool_capacity, convert_regions_only));
+        }
+    }
+
+    if (undistorter && undistorter->get_frame_size() != frame_size)
+    {
+        if (prepared_undistorter && prepared_undistorter->get_frame_size() == frame_size)
+        {
+            std::swap(undistorter, prepared_undistorter);
+        }
+        else
+        {
+            undistorter.reset(new Undistorter(calibration, frame_size, undistort_cache_dir));
+        }
+    }
+}
+
+void TeliCam::StreamState::on_raw_frame(const RawFrame& raw)
+{
+    metrics->record_frame(raw.block_id, raw.status, raw.receive_ns);
+
+    if (worker)
+    {
+        if (!worker->submit(raw))
+        {
+            metrics->record_dropped(1);
+        }
+    }
+    else
+    {
+        process_raw_frame(raw);
+    }
+}
+
 void CallbackImageAcquired(Teli::CAM_HANDLE cam_handle, Teli::CAM_STRM_HANDLE cam_stream_handle,
                            Teli::CAM_IMAGE_INFO* image_info, uint32_t buffer_index, void* pvContext)
 {
-    uint8_t* image_buffer = (uint8_t*)image_info->pvBuf;
+    RawFrame raw;
+    raw.receive_ns = monotonic_ns();
+    raw.data = (const uint8_t*)image_info->pvBuf;
+    raw.size = image_info->uiSize;
+    raw.width = image_info->uiSizeX;
+    raw.height = image_info->uiSizeY;
+    raw.pixel_format = image_info->uiPixelFormat;
+    raw.status = image_info->uiImageStatus;
+    raw.block_id = image_info->ullBlockId;
+    raw.device_timestamp = image_info->ullTimestamp;
+
+    TeliCam::StreamState* state = reinterpret_cast<TeliCam::StreamState*>(pvContext);
+    TraceSpan span("callback", state->camera_id, raw.block_id);
+    state->on_raw_frame(raw);
+}
+
+void CallbackImageError(Teli::CAM_HANDLE cam_handle, Teli::CAM_STRM_HANDLE cam_stream_handle,
+                        Teli::CAM_API_STATUS error_status, uint32_t buffer_index, void* pvContext)
+{
+    TeliCam::StreamState* state = reinterpret_cast<TeliCam::StreamState*>(pvContext);
+    state->metrics->record_stream_error();
+}
+
+void TeliCam::configure_statistics()
+{
+    stream_state->compute_statistics = parameters.compute_statistics;
+    stream_state->statistics_options.subsample = std::max<uint32_t>(parameters.statistics_subsample, 1);
+    stream_state->statistics_options.roi = parameters.statistics_roi;
+}
+
+void TeliCam::configure_denoise()
+{
+    stream_state->denoiser.reset();
+    if (parameters.denoise)
+    {
+        DenoiseOptions options;
+        options.strength = parameters.denoise_strength;
+        options.motion_threshold = static_cast<uint8_t>(std::min<uint32_t>(parameters.denoise_motion_threshold, 255));
+        stream_state->denoiser.reset(new TemporalDenoiser(options));
+    }
+}
+
+void TeliCam::configure_undistortion()
+{
+    stream_state->calibration = parameters.calibration;
+    stream_state->undistort_cache_dir = parameters.undistort_cache_dir;
+    stream_state->undistorter.reset();
+    stream_state->prepared_undistorter.reset();
+    stream_state->undistort_source.release();
+    if (!parameters.calibration.empty())
+    {
+        stream_state->undistorter.reset(
+            new Undistorter(parameters.calibration, cv::Size(width, height), parameters.undistort_cache_dir));
+    }
+}
+
+void TeliCam::configure_regions()
+{
+    for (size_t i = 0; i < parameters.regions.size(); ++i)
+    {
+        const RegionOfInterest& region = parameters.regions[i];
+        if (region.name.empty() || region.rect.empty())
+        {
+            throw std::runtime_error("TeliCam: regions need a name and a non-empty rectangle");
+        }
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (parameters.regions[j].name == region.name)
+            {
+                throw std::runtime_error("TeliCam: duplicate region " + region.name);
+            }
+        }
+    }
+
+    if (parameters.convert_regions_only && !parameters.calibration.empty())
+    {
+        throw std::runtime_error("TeliCam: convert_regions_only cannot be combined with undistortion");
+    }
+
+    stream_state->regions = parameters.regions;
+    stream_state->convert_regions_only = parameters.convert_regions_only && !parameters.regions.empty();
+}
 
-    uint32_t image_width = image_info->uiSizeX;
-    uint32_t image_height = image_info->uiSizeY;
-    cv::Mat image(cv::Size(image_width, image_height), CV_8UC3, cv::Scalar::all(0));
+void TeliCam::create_worker()
+{
+    stream_state->worker.reset();
+    if (!parameters.use_worker_thread)
+        return;
 
-    Teli::ConvImage(Teli::DST_FMT_BGR24, image_info->uiPixelFormat, true, image.data, image_buffer, image_width,
-                    image_height);
+    FrameWorker::Options worker_options;
+    worker_options.name = "telicam" + std::to_string(cam_id);
+    worker_options.cpu_affinity = parameters.worker_cpu_affinity;
+    worker_options.priority = parameters.worker_priority;
+    worker_options.numa_local_buffers = parameters.numa_local_buffers;
 
-    cv::Mat* last_frame = reinterpret_cast<cv::Mat*>(pvContext);
-    *last_frame = image.clone();
+    StreamState* state = stream_state.get();
+    stream_state->worker.reset(new FrameWorker(worker_options, image_buffer_size,
+                                               [state](const RawFrame& raw) { state->process_raw_frame(raw); }));
 }
 
 void TeliCam::open_stream()
@@ -604,13 +1944,68 @@ void TeliCam::open_stream()
     {
         throw std::runtime_error("Telicam Strm_OpenSimple failed");
     }
+    stream_opened = true;
+
+    create_worker();
+
+    // The conversion kernels are chosen once, for the format the camera streams in
+    Teli::CAM_PIXEL_FORMAT format;
+    cam_status = Teli::GetCamPixelFormat(cam_handle, &format);
+    if (cam_status != Teli::CAM_API_STS_SUCCESS)
+    {
+        throw std::runtime_error("Telicam GetCamPixelFormat failed");
+    }
+    stream_state->converter = select_frame_converter(static_cast<uint32_t>(format));
 
-    void* last_frame_ptr = reinterpret_cast<void*>(&last_frame);
-    cam_status = Teli::Strm_SetCallbackImageAcquired(cam_stream_handle, last_frame_ptr, CallbackImageAcquired);
+    void* stream_state_ptr = reinterpret_cast<void*>(stream_state.get());
+    cam_status = Teli::Strm_SetCallbackImageAcquired(cam_stream_handle, stream_state_ptr, CallbackImageAcquired);
     if (cam_status != Teli::CAM_API_STS_SUCCESS)
     {
         throw std::runtime_error("Telicam Strm_SetCallbackImageAcquired failed");
     }
+
+    cam_status = Teli::Strm_SetCallbackImageError(cam_stream_handle, stream_state_ptr, CallbackImageError);
+    if (cam_status != Teli::CAM_API_STS_SUCCESS)
+    {
+        throw std::runtime_error("Telicam Strm_SetCallbackImageError failed");
+    }
+}
+
+static bool sample_device_clock(Teli::CAM_HANDLE cam_handle, ClockSample& sample)
+{
+    Teli::CAM_NODE_HANDLE latch_node;
+    Teli::CAM_NODE_HANDLE value_node;
+    if (Teli::Nd_GetNode(cam_handle, "TimestampLatch", &latch_node) != Teli::CAM_API_STS_SUCCESS ||
+        Teli::Nd_GetNode(cam_handle, "TimestampLatchValue", &value_node) != Teli::CAM_API_STS_SUCCESS)
+    {
+        return false;
+    }
+
+    // The latch happens somewhere between sending the command and its completion
+    sample.host_before_ns = monotonic_ns();
+    if (Teli::Nd_CmdExecute(cam_handle, latch_node, true) != Teli::CAM_API_STS_SUCCESS)
+        return false;
+    sample.host_after_ns = monotonic_ns();
+
+    int64_t ticks = 0;
+    if (Teli::Nd_GetIntValue(cam_handle, value_node, &ticks) != Teli::CAM_API_STS_SUCCESS)
+        return false;
+
+    sample.device_ticks = static_cast<uint64_t>(ticks);
+    return true;
+}
+
+void TeliCam::start_clock_sync()
+{
+    stream_state->clock_sampler.reset();
+    stream_state->clock_sync.reset();
+    if (parameters.clock_sync_interval_ms == 0)
+        return;
+
+    Teli::CAM_HANDLE handle = cam_handle;
+    stream_state->clock_sampler.reset(
+        new ClockSampler([handle](ClockSample& sample) { return sample_device_clock(handle, sample); },
+                         stream_state->clock_sync, parameters.clock_sync_interval_ms));
 }
 
 void TeliCam::capture_frame_internal()
@@ -624,6 +2019,9 @@ void TeliCam::capture_frame_internal()
 
 void TeliCam::start_stream_internal()
 {
+    // A simulated stream delivers whatever is injected
+    if (simulated)
+        return;
 
     Teli::CAM_API_STATUS cam_status = Teli::Strm_Start(cam_stream_handle);
     if (cam_status != Teli::CAM_API_STS_SUCCESS)
@@ -634,6 +2032,9 @@ void TeliCam::start_stream_internal()
 
 void TeliCam::stop_stream_internal()
 {
+    if (simulated)
+        return;
+
     Teli::CAM_API_STATUS cam_status = Teli::Strm_Stop(cam_stream_handle);
     if (cam_status != Teli::CAM_API_STS_SUCCESS)
     {
@@ -641,8 +2042,30 @@ void TeliCam::stop_stream_internal()
     }
 }
 
+void TeliCam::close_stream()
+{
+    if (!stream_opened)
+        return;
+
+    // The stream is stopped by now, so no callback can reach the worker
+    stream_state->worker.reset();
+
+    stream_opened = false;
+    Teli::CAM_API_STATUS cam_status = Teli::Strm_Close(cam_stream_handle);
+    if (cam_status != Teli::CAM_API_STS_SUCCESS)
+    {
+        throw std::runtime_error("Telicam stream close failed");
+    }
+}
+
 void TeliCam::close_camera()
 {
+    camera_initialized = false;
+
+    // The sampler reads the camera clock, so it must stop before the camera is closed
+    stream_state->clock_sampler.reset();
+    stream_state->clock_sync.reset();
+
     Teli::CAM_API_STATUS cam_status = Teli::Cam_Close(cam_handle);
     if (cam_status != Teli::CAM_API_STS_SUCCESS)
     {
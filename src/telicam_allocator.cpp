@@ -0,0 +1,259 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "telicam_allocator.hpp"
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+struct FrameAllocator::Mapping
+{
+    size_t size;
+    bool locked;
+    bool huge_pages;
+    std::shared_ptr<const FrameAllocator> owner;
+};
+
+std::shared_ptr<FrameAllocator> FrameAllocator::create(const Options& options)
+{
+    return std::shared_ptr<FrameAllocator>(new FrameAllocator(options));
+}
+
+FrameAllocator::FrameAllocator(const Options& options)
+    : options(options)
+    , bytes_allocated(0)
+    , bytes_locked(0)
+    , huge_page_bytes(0)
+    , allocations(0)
+    , lock_warning_printed(false)
+{
+    if (options.row_alignment == 0 || (options.row_alignment & (options.row_alignment - 1)) != 0)
+    {
+        throw std::runtime_error("FrameAllocator row alignment must be a power of two");
+    }
+}
+
+cv::UMatData* FrameAllocator::allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                                       cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const
+{
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--)
+    {
+        if (step)
+        {
+            if (data && step[i] != CV_AUTOSTEP)
+            {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            }
+            else
+            {
+                // Pad rows so that every row starts on an aligned address
+                if (!data && i == 0 && dims >= 2)
+                {
+                    total = align_up(total, options.row_alignment);
+                }
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    cv::UMatData* u = new cv::UMatData(this);
+    u->size = total;
+
+    if (data)
+    {
+        u->data = u->origdata = static_cast<uint8_t*>(data);
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    Mapping* mapping = new Mapping{align_up(total, page_size), false, false, shared_from_this()};
+
+    void* memory = MAP_FAILED;
+    if (options.use_huge_pages && total >= HUGE_PAGE_SIZE)
+    {
+        size_t huge_size = align_up(total, HUGE_PAGE_SIZE);
+        memory = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED)
+        {
+            mapping->size = huge_size;
+            mapping->huge_pages = true;
+        }
+    }
+
+    if (memory == MAP_FAILED)
+    {
+        memory = mmap(nullptr, mapping->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            delete mapping;
+            delete u;
+            throw std::runtime_error("FrameAllocator mmap failed: " + std::string(std::strerror(errno)));
+        }
+
+        // No reserved huge pages, so ask for transparent ones instead
+        if (options.use_huge_pages)
+        {
+            madvise(memory, mapping->size, MADV_HUGEPAGE);
+        }
+    }
+
+    if (options.lock_memory)
+    {
+        if (mlock(memory, mapping->size) == 0)
+        {
+            mapping->locked = true;
+        }
+        else if (!lock_warning_printed.exchange(true))
+        {
+            std::cerr << "FrameAllocator: mlock failed (" << std::strerror(errno)
+                      << "), frame buffers will not be locked. Check RLIMIT_MEMLOCK." << std::endl;
+        }
+    }
+
+    if (options.prefault && !mapping->locked)
+    {
+        std::memset(memory, 0, mapping->size);
+    }
+
+    bytes_allocated += mapping->size;
+    bytes_locked += mapping->locked ? mapping->size : 0;
+    huge_page_bytes += mapping->huge_pages ? mapping->size : 0;
+    allocations++;
+
+    u->data = u->origdata = static_cast<uint8_t*>(memory);
+    u->userdata = mapping;
+    return u;
+}
+
+bool FrameAllocator::allocate(cv::UMatData* data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const
+{
+    return data != nullptr;
+}
+
+void FrameAllocator::deallocate(cv::UMatData* u) const
+{
+    if (!u)
+        return;
+
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+
+    // Released last: dropping the final reference may destroy this allocator
+    std::shared_ptr<const FrameAllocator> keep_alive;
+
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+    {
+        Mapping* mapping = static_cast<Mapping*>(u->userdata);
+        if (mapping->locked)
+        {
+            munlock(u->origdata, mapping->size);
+        }
+        munmap(u->origdata, mapping->size);
+
+        bytes_allocated -= mapping->size;
+        bytes_locked -= mapping->locked ? mapping->size : 0;
+        huge_page_bytes -= mapping->huge_pages ? mapping->size : 0;
+        allocations--;
+
+        keep_alive = std::move(mapping->owner);
+        delete mapping;
+        u->origdata = nullptr;
+    }
+
+    delete u;
+}
+
+cv::Mat FrameAllocator::allocate_mat(int rows, int cols, int type) const
+{
+    cv::Mat mat;
+    mat.allocator = const_cast<FrameAllocator*>(this);
+    mat.create(rows, cols, type);
+    return mat;
+}
+
+FrameMemoryStats FrameAllocator::get_stats() const
+{
+    FrameMemoryStats stats;
+    stats.bytes_allocated = bytes_allocated.load();
+    stats.bytes_locked = bytes_locked.load();
+    stats.huge_page_bytes = huge_page_bytes.load();
+    stats.allocations = allocations.load();
+    return stats;
+}
+
+FramePool::FramePool(std::shared_ptr<FrameAllocator> allocator, cv::Size size, int type, size_t capacity,
+                     bool zeroed)
+    : allocator(std::move(allocator))
+    , size(size)
+    , type(type)
+    , zeroed(zeroed)
+    , next(0)
+    , grow_count(0)
+{
+    buffers.reserve(capacity);
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        buffers.push_back(this->allocator->allocate_mat(size.height, size.width, type));
+        if (zeroed)
+        {
+            buffers.back().setTo(cv::Scalar::all(0));
+        }
+    }
+}
+
+cv::Mat FramePool::acquire()
+{
+    for (size_t n = 0; n < buffers.size(); ++n)
+    {
+        size_t i = (next + n) % buffers.size();
+
+        // Only the pool holds a reference, so nobody can be reading this buffer
+        if (CV_XADD(&buffers[i].u->refcount, 0) == 1)
+        {
+            next = (i + 1) % buffers.size();
+            return buffers[i];
+        }
+    }
+
+    grow_count++;
+    buffers.push_back(allocator->allocate_mat(size.height, size.width, type));
+    if (zeroed)
+    {
+        buffers.back().setTo(cv::Scalar::all(0));
+    }
+    next = 0;
+    return buffers.back();
+}
+
+cv::Size FramePool::get_frame_size() const
+{
+    return size;
+}
+
+int FramePool::get_frame_type() const
+{
+    return type;
+}
+
+size_t FramePool::get_capacity() const
+{
+    return buffers.size();
+}
+
+uint64_t FramePool::get_grow_count() const
+{
+    return grow_count.load();
+}
@@ -0,0 +1,121 @@
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "telicam.hpp"
+#include "telicam_async.hpp"
+#include "telicam_convert.hpp"
+
+// Drives AsyncFrameSource through a simulated camera on a RunLoop. Frames are injected from functions posted to the
+// loop, so the listener, the executor and the coroutines all run on the thread calling RunLoop::run().
+
+static const uint32_t FRAME_WIDTH = 64;
+static const uint32_t FRAME_HEIGHT = 48;
+
+struct AsyncTest
+{
+    TeliCam cam;
+    RunLoop loop;
+    std::vector<uint8_t> bayer = std::vector<uint8_t>(static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT, 128);
+    std::vector<std::string> failures;
+    bool finished = false;
+
+    void inject(uint64_t frame_id)
+    {
+        RawFrame raw;
+        raw.data = bayer.data();
+        raw.size = bayer.size();
+        raw.width = FRAME_WIDTH;
+        raw.height = FRAME_HEIGHT;
+        raw.pixel_format = pixel_format::BAYER_RG8;
+        raw.block_id = frame_id;
+        cam.inject_frame(raw);
+    }
+
+    void post_inject(uint64_t frame_id)
+    {
+        loop.post([this, frame_id] { inject(frame_id); });
+    }
+
+    void expect_frame(const std::optional<Frame>& frame, uint64_t frame_id, const std::string& step)
+    {
+        if (!frame)
+        {
+            failures.push_back(step + ": no frame, expected frame " + std::to_string(frame_id));
+        }
+        else if (frame->metadata.frame_id != frame_id)
+        {
+            failures.push_back(step + ": got frame " + std::to_string(frame->metadata.frame_id) + ", expected frame " +
+                               std::to_string(frame_id));
+        }
+        else if (frame->image.cols != static_cast<int>(FRAME_WIDTH) ||
+                 frame->image.rows != static_cast<int>(FRAME_HEIGHT))
+        {
+            failures.push_back(step + ": frame " + std::to_string(frame_id) + " has the wrong size");
+        }
+    }
+};
+
+static Task receive_frames(AsyncTest& test, AsyncFrameSource& source)
+{
+    // A frame that arrived before the coroutine awaited is returned without suspending
+    test.inject(1);
+    test.expect_frame(co_await source.next_frame(), 1, "next_frame() with a pending frame");
+
+    // Frames that arrive while the coroutine is suspended resume it through the executor
+    test.post_inject(2);
+    test.expect_frame(co_await source.next_frame(), 2, "next_frame() while suspended");
+
+    AsyncGenerator<Frame> frames = source.frames();
+    for (uint64_t frame_id = 3; frame_id <= 6; ++frame_id)
+    {
+        test.post_inject(frame_id);
+        test.expect_frame(co_await frames.next(), frame_id, "frames()");
+    }
+
+    // Only the most recent frame is kept while nobody waits
+    test.inject(7);
+    test.inject(8);
+    test.expect_frame(co_await frames.next(), 8, "frames() after two frames");
+    if (source.get_skipped_frames() != 1)
+    {
+        test.failures.push_back("skipped " + std::to_string(source.get_skipped_frames()) + " frames, expected 1");
+    }
+
+    // Closing the source ends the generator
+    test.loop.post([&source] { source.close(); });
+    if (std::optional<Frame> frame = co_await frames.next())
+    {
+        test.failures.push_back("frames() returned frame " + std::to_string(frame->metadata.frame_id) +
+                                " after the source was closed");
+    }
+
+    test.finished = true;
+    test.loop.stop();
+}
+
+int main()
+{
+    AsyncTest test;
+    test.cam.initialize_simulated(TeliCam::Parameters(), FRAME_WIDTH, FRAME_HEIGHT);
+
+    AsyncFrameSource source(test.cam, test.loop);
+    test.loop.post([&test, &source] { receive_frames(test, source); });
+    test.loop.run();
+
+    if (!test.finished)
+    {
+        test.failures.push_back("the coroutine did not finish");
+    }
+    for (const auto& failure : test.failures)
+    {
+        std::cout << "FAILED: " << failure << std::endl;
+    }
+    if (!test.failures.empty())
+        return 1;
+
+    std::cout << "telicam_async: all checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,1668 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <CLI/CLI.hpp>
+#include <nlohmann/json.hpp>
+
+#include "telicam.hpp"
+#include "telicam_change.hpp"
+#include "telicam_codec.hpp"
+#include "telicam_convert.hpp"
+#include "telicam_denoise.hpp"
+#include "telicam_exposure.hpp"
+#include "telicam_hdr.hpp"
+#include "telicam_preview.hpp"
+#include "telicam_recorder.hpp"
+#include "telicam_stats.hpp"
+#include "telicam_supervisor.hpp"
+#include "telicam_undistort.hpp"
+#include "telicam_viewer_utils.hpp"
+
+using json = nlohmann::json;
+
+struct BenchmarkResult
+{
+    std::string name;
+    uint64_t iterations = 0;
+    double mean_ns = 0.0;
+    double median_ns = 0.0;
+    double p90_ns = 0.0;
+    double p99_ns = 0.0;
+    double min_ns = 0.0;
+    double bytes_per_second = 0.0;
+    std::map<std::string, double> counters; // Extra per-benchmark figures, e.g. stage timings
+};
+
+/**
+ * @brief Times benchmark bodies and collects their results.
+ */
+class BenchmarkRunner
+{
+  public:
+    BenchmarkRunner(double min_time_s, const std::string& filter)
+        : min_time_s(min_time_s)
+        , filter(filter)
+    {
+    }
+
+    /**
+     * @brief Check whether a benchmark was selected on the command line.
+     */
+    bool selected(const std::string& name) const
+    {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    /**
+     * @brief Run a benchmark body repeatedly for at least the minimum time and record its durations.
+     *
+     * @param name Benchmark name
+     * @param body Code to time
+     * @param bytes_per_iteration Bytes processed per call of body, for throughput. 0 to skip.
+     * @return BenchmarkResult* Recorded result, to attach counters to. nullptr if the benchmark was not selected.
+     */
+    BenchmarkResult* run(const std::string& name, const std::function<void()>& body, double bytes_per_iteration = 0.0)
+    {
+        if (!selected(name))
+            return nullptr;
+
+        const int warmup_iterations = 3;
+        const uint64_t min_iterations = 10;
+        const uint64_t max_iterations = 1000000;
+
+        for (int i = 0; i < warmup_iterations; ++i)
+        {
+            body();
+        }
+
+        std::vector<double> samples;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed_s = 0.0;
+        while ((elapsed_s < min_time_s || samples.size() < min_iterations) && samples.size() < max_iterations)
+        {
+            auto iteration_start = std::chrono::steady_clock::now();
+            body();
+            auto iteration_end = std::chrono::steady_clock::now();
+
+            samples.push_back(std::chrono::duration<double, std::nano>(iteration_end - iteration_start).count());
+            elapsed_s = std::chrono::duration<double>(iteration_end - start).count();
+        }
+
+        BenchmarkResult result = summarize(name, samples);
+        if (bytes_per_iteration > 0.0)
+        {
+            result.bytes_per_second = bytes_per_iteration / (result.median_ns * 1e-9);
+        }
+
+        results.push_back(result);
+        print(results.back());
+        return &results.back();
+    }
+
+    /**
+     * @brief Summarize a set of externally measured durations.
+     */
+    static BenchmarkResult summarize(const std::string& name, std::vector<double> samples_ns)
+    {
+        BenchmarkResult result;
+        result.name = name;
+        result.iterations = samples_ns.size();
+        if (samples_ns.empty())
+            return result;
+
+        std::sort(samples_ns.begin(), samples_ns.end());
+        double total = 0.0;
+        for (double sample : samples_ns)
+        {
+            total += sample;
+        }
+
+        auto percentile = [&samples_ns](double p) {
+            size_t index = static_cast<size_t>(p * (samples_ns.size() - 1) + 0.5);
+            return samples_ns[index];
+        };
+
+        result.mean_ns = total / samples_ns.size();
+        result.median_ns = percentile(0.5);
+        result.p90_ns = percentile(0.9);
+        result.p99_ns = percentile(0.99);
+        result.min_ns = samples_ns.front();
+        return result;
+    }
+
+    /**
+     * @brief Add a result measured outside run().
+     */
+    void add_result(const BenchmarkResult& result)
+    {
+        results.push_back(result);
+        print(results.back());
+    }
+
+    const std::deque<BenchmarkResult>& get_results() const
+    {
+        return results;
+    }
+
+    /**
+     * @brief Record a benchmark whose behaviour, rather than its speed, was wrong.
+     */
+    void fail(const std::string& message)
+    {
+        std::cout << "FAILED: " << message << std::endl;
+        failures.push_back(message);
+    }
+
+    const std::vector<std::string>& get_failures() const
+    {
+        return failures;
+    }
+
+  private:
+    static void print(const BenchmarkResult& result)
+    {
+        std::cout << std::left << std::setw(48) << result.name << std::right << std::fixed << std::setprecision(1)
+                  << " median " << std::setw(10) << result.median_ns / 1000.0 << " us  p90 " << std::setw(10)
+                  << result.p90_ns / 1000.0 << " us";
+        if (result.bytes_per_second > 0.0)
+        {
+            std::cout << "  " << std::setw(8) << result.bytes_per_second / 1e9 << " GB/s";
+        }
+        std::cout << std::endl;
+    }
+
+  private:
+    double min_time_s;
+    std::string filter;
+    std::deque<BenchmarkResult> results; // Stable addresses for the pointers returned by run()
+    std::vector<std::string> failures;
+};
+
+/////////////////////////////////////////////
+// Synthetic frames
+/////////////////////////////////////////////
+
+struct SensorSize
+{
+    const char* name;
+    uint32_t width;
+    uint32_t height;
+};
+
+static const std::vector<SensorSize> SENSOR_SIZES = {
+    {"vga", 640, 480},
+    {"1.3mp", 1280, 1024},
+    {"1080p", 1920, 1080},
+    {"5mp", 2448, 2048},
+    {"12mp", 4096, 3000},
+};
+
+/**
+ * @brief Generate an 8-bit Bayer mosaic of a smooth scene with sensor-like noise, so that conversion and compression
+ * see realistic data rather than constant or random buffers.
+ */
+static std::vector<uint8_t> make_bayer_frame(uint32_t width, uint32_t height, uint32_t seed = 0)
+{
+    std::vector<uint8_t> frame(static_cast<size_t>(width) * height);
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0.0f, 2.0f);
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            float scene = 96.0f + 64.0f * std::sin(x * 0.01f + seed) * std::cos(y * 0.013f);
+            float channel_gain = ((x & 1) != (y & 1)) ? 1.0f : ((y & 1) ? 0.7f : 0.85f); // G, B or R of an RGGB tile
+            float value = std::min(255.0f, std::max(0.0f, scene * channel_gain + noise(rng)));
+            frame[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>(value);
+        }
+    }
+
+    return frame;
+}
+
+static RawFrame make_raw_frame(const std::vector<uint8_t>& buffer, uint32_t width, uint32_t height,
+                               uint32_t format = pixel_format::BAYER_RG8)
+{
+    RawFrame raw;
+    raw.data = buffer.data();
+    raw.size = buffer.size();
+    raw.width = width;
+    raw.height = height;
+    raw.pixel_format = format;
+    return raw;
+}
+
+/////////////////////////////////////////////
+// Benchmarks
+/////////////////////////////////////////////
+
+struct ConversionFormat
+{
+    const char* name;
+    uint32_t format;
+    int bits;
+    bool packed;
+};
+
+static const std::vector<ConversionFormat> CONVERSION_FORMATS = {
+    {"bayer_rg8", pixel_format::BAYER_RG8, 8, false},     {"bayer_rg10", pixel_format::BAYER_RG10, 10, false},
+    {"bayer_rg12", pixel_format::BAYER_RG12, 12, false},  {"bayer_rg10p", pixel_format::BAYER_RG10P, 10, true},
+    {"bayer_rg12p", pixel_format::BAYER_RG12P, 12, true},
+};
+
+/**
+ * @brief Store an 8-bit frame in a 10 or 12-bit format, as the most significant bits of each sample. The bits below
+ * them are filled with a pattern that conversion must discard.
+ */
+static std::vector<uint8_t> widen_frame(const std::vector<uint8_t>& frame, int bits, bool packed)
+{
+    std::vector<uint8_t> wide;
+    uint32_t low_mask = (1u << (bits - 8)) - 1;
+    uint64_t pending = 0;
+    int pending_bits = 0;
+    for (size_t i = 0; i < frame.size(); ++i)
+    {
+        uint32_t sample = (static_cast<uint32_t>(frame[i]) << (bits - 8)) | (static_cast<uint32_t>(i * 7) & low_mask);
+        if (!packed)
+        {
+            wide.push_back(static_cast<uint8_t>(sample));
+            wide.push_back(static_cast<uint8_t>(sample >> 8));
+            continue;
+        }
+
+        // Packed formats are a little-endian bit stream
+        pending |= static_cast<uint64_t>(sample) << pending_bits;
+        for (pending_bits += bits; pending_bits >= 8; pending_bits -= 8, pending >>= 8)
+        {
+            wide.push_back(static_cast<uint8_t>(pending));
+        }
+    }
+    return wide;
+}
+
+static void benchmark_conversion(BenchmarkRunner& runner)
+{
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::vector<uint8_t> bayer = make_bayer_frame(sensor.width, sensor.height);
+        cv::Mat reference;
+        cv::cvtColor(cv::Mat(sensor.height, sensor.width, CV_8UC1, bayer.data()), reference, cv::COLOR_BayerBG2BGR);
+
+        for (const ConversionFormat& format : CONVERSION_FORMATS)
+        {
+            std::string name = std::string("convert/") + format.name + "_to_bgr/" + sensor.name;
+            if (!runner.selected(name))
+                continue;
+
+            std::vector<uint8_t> buffer = format.bits == 8 ? bayer : widen_frame(bayer, format.bits, format.packed);
+            RawFrame raw = make_raw_frame(buffer, sensor.width, sensor.height, format.format);
+            FrameConverter converter = select_frame_converter(format.format);
+
+            cv::Mat dst(sensor.height, sensor.width, CV_8UC3);
+            ConversionScratch scratch;
+            runner.run(name, [&] { converter.convert(raw, dst, scratch); }, static_cast<double>(buffer.size()));
+
+            // Wider formats keep their 8 most significant bits, which are the 8-bit frame
+            cv::Rect region(sensor.width / 4 + 1, sensor.height / 4 + 1, sensor.width / 4, sensor.height / 4);
+            cv::Mat region_dst(region.height, region.width, CV_8UC3);
+            convert_region_to_bgr(raw, region, region_dst, scratch);
+            if (cv::norm(dst, reference, cv::NORM_INF) != 0.0 ||
+                cv::norm(region_dst, reference(region), cv::NORM_INF) != 0.0)
+            {
+                runner.fail(name + " differs from converting the 8-bit frame");
+            }
+        }
+    }
+}
+
+/**
+ * @brief Time converting only the regions of interest, against converting the whole frame, and check that regions are
+ * converted as in the whole frame and published as views into it.
+ */
+static void benchmark_regions(BenchmarkRunner& runner)
+{
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::string name = std::string("roi/convert_regions/") + sensor.name;
+        if (!runner.selected(name))
+            continue;
+
+        std::vector<uint8_t> bayer = make_bayer_frame(sensor.width, sensor.height);
+        RawFrame raw = make_raw_frame(bayer, sensor.width, sensor.height);
+
+        // A region at odd coordinates, to exercise the Bayer phase, and one in a corner, 1/16 and 1/64 of the frame
+        int w = static_cast<int>(sensor.width);
+        int h = static_cast<int>(sensor.height);
+        TeliCam::Parameters parameters;
+        parameters.regions = {{"center", cv::Rect(w / 4 + 1, h / 4 + 1, w / 4, h / 4)},
+                              {"corner", cv::Rect(0, 0, w / 8, h / 8)}};
+        parameters.convert_regions_only = true;
+
+        cv::Mat image(sensor.height, sensor.width, CV_8UC3);
+        ConversionScratch scratch;
+        double region_bytes = 0.0;
+        for (const RegionOfInterest& region : parameters.regions)
+        {
+            region_bytes += region.rect.area();
+        }
+        BenchmarkResult* result = runner.run(name, [&] {
+            for (const RegionOfInterest& region : parameters.regions)
+            {
+                cv::Mat dst = image(region.rect);
+                convert_region_to_bgr(raw, region.rect, dst, scratch);
+            }
+        }, region_bytes);
+        result->counters["area_fraction"] = region_bytes / (static_cast<double>(w) * h);
+
+        cv::Mat reference;
+        cv::cvtColor(cv::Mat(sensor.height, sensor.width, CV_8UC1, bayer.data()), reference, cv::COLOR_BayerBG2BGR);
+        for (const RegionOfInterest& region : parameters.regions)
+        {
+            if (cv::norm(image(region.rect), reference(region.rect), cv::NORM_INF) != 0.0)
+            {
+                runner.fail(name + " region " + region.name + " differs from converting the whole frame");
+            }
+        }
+
+        // Through the frame path, regions must be views into the published frame
+        parameters.compute_statistics = true;
+        TeliCam cam;
+        cam.initialize_simulated(parameters, sensor.width, sensor.height);
+        cam.inject_frame(raw);
+        cv::Mat center = cam.get_last_region("center");
+        Frame frame = cam.get_last_frame_with_metadata();
+        if (center.empty() || frame.regions.size() != parameters.regions.size())
+        {
+            runner.fail(name + " did not publish the regions");
+            continue;
+        }
+        cv::Size whole_size;
+        cv::Point offset;
+        center.locateROI(whole_size, offset);
+        if (whole_size != cv::Size(w, h) || offset != parameters.regions[0].rect.tl() ||
+            cv::norm(center, reference(parameters.regions[0].rect), cv::NORM_INF) != 0.0)
+        {
+            runner.fail(name + " published region is not a view of the converted region");
+        }
+
+        // The rest of the published frame is black, and statistics only cover the regions
+        cv::Mat outside = frame.image.clone();
+        for (const RegionOfInterest& region : parameters.regions)
+        {
+            outside(region.rect).setTo(cv::Scalar::all(0));
+        }
+        if (cv::countNonZero(outside.reshape(1)) != 0 || !frame.metadata.statistics ||
+            frame.metadata.statistics->sampled_pixels != region_bytes)
+        {
+            runner.fail(name + " published frame is not black outside the regions, or its statistics are not theirs");
+        }
+    }
+}
+
+static void benchmark_statistics(BenchmarkRunner& runner)
+{
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::vector<uint8_t> bayer = make_bayer_frame(sensor.width, sensor.height);
+        cv::Mat bgr(sensor.height, sensor.width, CV_8UC3);
+        ConversionScratch scratch;
+        convert_to_bgr(make_raw_frame(bayer, sensor.width, sensor.height), bgr, scratch);
+
+        for (uint32_t subsample : {1u, 4u})
+        {
+            StatisticsOptions options;
+            options.subsample = subsample;
+            FrameStatistics statistics;
+            runner.run("statistics/subsample" + std::to_string(subsample) + "/" + sensor.name,
+                       [&] { compute_frame_statistics(bgr, options, statistics); },
+                       static_cast<double>(bgr.total() * bgr.elemSize()));
+        }
+    }
+}
+
+/**
+ * @brief Time compression and decompression of one frame and check that it round-trips.
+ */
+static void benchmark_codec_frame(BenchmarkRunner& runner, const std::string& frame_name, const cv::Mat& bayer)
+{
+    double frame_bytes = static_cast<double>(bayer.total());
+    std::vector<uint8_t> buffer;
+    cv::Mat decompressed;
+
+    for (uint32_t slices : {1u, 0u})
+    {
+        std::string threads = slices == 1 ? "1thread" : "parallel";
+        BayerCodecOptions options;
+        options.slices = slices;
+
+        size_t size = 0;
+        BenchmarkResult* compress = runner.run("codec/compress/" + threads + "/" + frame_name,
+                                               [&] { size = compress_bayer(bayer, buffer, options); }, frame_bytes);
+        size = compress_bayer(bayer, buffer, options);
+        BenchmarkResult* decompress =
+            runner.run("codec/decompress/" + threads + "/" + frame_name,
+                       [&] { decompress_bayer(buffer.data(), size, decompressed); }, frame_bytes);
+
+        if (compress)
+        {
+            compress->counters["ratio"] = frame_bytes / size;
+        }
+        if (compress || decompress)
+        {
+            decompress_bayer(buffer.data(), size, decompressed);
+            cv::Mat difference;
+            cv::absdiff(bayer, decompressed, difference);
+            double max_difference = 0.0;
+            cv::minMaxLoc(difference, nullptr, &max_difference);
+            if (decompressed.size() != bayer.size() || max_difference != 0.0)
+            {
+                runner.fail("codec/" + threads + "/" + frame_name + " does not round-trip");
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check that the codec round-trips frames of odd widths and heights, and frames smaller than one block or one
+ * slice, whose tail paths the sensor sizes never reach.
+ */
+static void check_codec_round_trip(BenchmarkRunner& runner)
+{
+    const std::string name = "codec/round_trip";
+    if (!runner.selected(name))
+        return;
+
+    const cv::Size sizes[] = {{1, 1}, {2, 2}, {15, 1}, {1, 15}, {7, 5}, {17, 3}, {33, 2}, {641, 479}, {1921, 1081}};
+    std::vector<uint8_t> buffer;
+    for (const cv::Size& size : sizes)
+    {
+        std::vector<uint8_t> frame = make_bayer_frame(size.width, size.height);
+        cv::Mat bayer(size.height, size.width, CV_8UC1, frame.data());
+
+        for (uint32_t slices : {1u, 0u, 16u})
+        {
+            BayerCodecOptions options;
+            options.slices = slices;
+            cv::Mat decompressed;
+            decompress_bayer(buffer.data(), compress_bayer(bayer, buffer, options), decompressed);
+
+            bool matches = decompressed.size() == bayer.size();
+            if (matches)
+            {
+                cv::Mat difference;
+                cv::absdiff(bayer, decompressed, difference);
+                matches = cv::countNonZero(difference) == 0;
+            }
+            if (!matches)
+            {
+                runner.fail(name + " " + std::to_string(size.width) + "x" + std::to_string(size.height) + " with " +
+                            std::to_string(slices) + " slices does not round-trip");
+            }
+        }
+    }
+}
+
+static void benchmark_codec(BenchmarkRunner& runner, const std::string& recording_filename)
+{
+    check_codec_round_trip(runner);
+
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::vector<uint8_t> frame = make_bayer_frame(sensor.width, sensor.height);
+        benchmark_codec_frame(runner, sensor.name, cv::Mat(sensor.height, sensor.width, CV_8UC1, frame.data()));
+    }
+
+    // Synthetic frames are smoother than some real scenes, so recordings can be benchmarked too
+    if (!recording_filename.empty())
+    {
+        RecordingReader reader(recording_filename);
+        RecordedFrame recorded;
+        if (reader.read(recorded))
+        {
+            benchmark_codec_frame(runner, "recorded", recorded.bayer);
+        }
+    }
+}
+
+/**
+ * @brief Remove a directory of regular files.
+ */
+static void remove_directory(const std::string& path)
+{
+    DIR* dir = opendir(path.c_str());
+    if (dir)
+    {
+        while (dirent* entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..")
+            {
+                unlink((path + "/" + name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(path.c_str());
+}
+
+/**
+ * @brief Time temporal denoising of a noisy static scene, and check that it reduces the noise without leaving a trail
+ * behind a moving object.
+ */
+static void benchmark_denoise(BenchmarkRunner& runner)
+{
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 6.0f); // Low light at high gain
+    const int noisy_frames = 4;
+    const int static_frames = 40;
+
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::string name = std::string("denoise/") + sensor.name;
+        if (!runner.selected(name))
+            continue;
+
+        std::vector<uint8_t> bayer = make_bayer_frame(sensor.width, sensor.height);
+        cv::Mat clean(sensor.height, sensor.width, CV_8UC3);
+        ConversionScratch scratch;
+        convert_to_bgr(make_raw_frame(bayer, sensor.width, sensor.height), clean, scratch);
+
+        // A few noisy versions of the static scene, fed in turn
+        std::vector<cv::Mat> noisy(noisy_frames);
+        for (cv::Mat& frame : noisy)
+        {
+            frame = clean.clone();
+            uint8_t* data = frame.ptr<uint8_t>();
+            for (size_t i = 0; i < frame.total() * 3; ++i)
+            {
+                data[i] = cv::saturate_cast<uint8_t>(data[i] + noise(rng));
+            }
+        }
+
+        DenoiseOptions options;
+        TemporalDenoiser denoiser(options);
+        cv::Mat frame;
+        std::vector<double> samples_ns;
+        for (int i = 0; i < static_frames; ++i)
+        {
+            noisy[i % noisy_frames].copyTo(frame);
+            int64_t start_ns = monotonic_ns();
+            denoiser.apply(frame);
+            samples_ns.push_back(static_cast<double>(monotonic_ns() - start_ns));
+        }
+
+        double samples = static_cast<double>(clean.total() * 3);
+        double noisy_error = cv::norm(noisy[(static_frames - 1) % noisy_frames], clean, cv::NORM_L1) / samples;
+        double denoised_error = cv::norm(frame, clean, cv::NORM_L1) / samples;
+
+        // A bright square crossing the scene must neither be averaged away nor leave a trail
+        double trail_error = 0.0;
+        cv::Rect previous;
+        for (int i = 0; i < 5; ++i)
+        {
+            cv::Rect square(100 + i * 80, sensor.height / 2, 64, 64);
+            noisy[i % noisy_frames].copyTo(frame);
+            cv::Mat object = frame(square);
+            object.setTo(cv::Scalar(250, 250, 250));
+            denoiser.apply(frame);
+
+            cv::Mat expected = clean.clone();
+            cv::Mat expected_object = expected(square);
+            expected_object.setTo(cv::Scalar(250, 250, 250));
+            trail_error = std::max(trail_error, cv::norm(frame(square), expected(square), cv::NORM_L1) / (64 * 64 * 3));
+            if (i > 0)
+            {
+                cv::Rect uncovered(previous.x, previous.y, square.x - previous.x, previous.height);
+                trail_error = std::max(trail_error, cv::norm(frame(uncovered), expected(uncovered), cv::NORM_L1) /
+                                                        (uncovered.area() * 3));
+            }
+            previous = square;
+        }
+
+        BenchmarkResult result = BenchmarkRunner::summarize(name, samples_ns);
+        result.bytes_per_second = samples / (result.median_ns * 1e-9);
+        result.counters["noise_reduction"] = noisy_error / std::max(denoised_error, 1e-9);
+        result.counters["trail_error"] = trail_error;
+        runner.add_result(result);
+
+        if (denoised_error * 1.5 > noisy_error)
+        {
+            runner.fail(name + " did not reduce the noise of a static scene");
+        }
+        if (trail_error > 10.0)
+        {
+            runner.fail(name + " smeared a moving object");
+        }
+    }
+}
+
+/**
+ * @brief Render a scene as a camera would at a brightness scale, with clipping.
+ */
+static void expose_frame(const cv::Mat& scene, double scale, cv::Mat& exposed)
+{
+    uint8_t lut[256];
+    for (int i = 0; i < 256; ++i)
+    {
+        lut[i] = static_cast<uint8_t>(std::min(255.0, i * scale + 0.5));
+    }
+    exposed.create(scene.rows, scene.cols, scene.type());
+    const uint8_t* source = scene.ptr<uint8_t>();
+    uint8_t* destination = exposed.ptr<uint8_t>();
+    for (size_t i = 0; i < scene.total() * scene.channels(); ++i)
+    {
+        destination[i] = lut[source[i]];
+    }
+}
+
+/**
+ * @brief Time exposure fusion of three exposures two stops apart, and check that the radiance it estimates matches the
+ * scene.
+ */
+static void benchmark_exposure_fusion(BenchmarkRunner& runner)
+{
+    const std::vector<double> exposure_times = {0.25, 1.0, 4.0}; // Relative to the exposure the scene renders at
+
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::vector<uint8_t> bayer = make_bayer_frame(sensor.width, sensor.height);
+        cv::Mat scene(sensor.height, sensor.width, CV_8UC3);
+        ConversionScratch scratch;
+        convert_to_bgr(make_raw_frame(bayer, sensor.width, sensor.height), scene, scratch);
+
+        std::vector<cv::Mat> frames(exposure_times.size());
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            expose_frame(scene, exposure_times[i], frames[i]);
+        }
+
+        for (bool radiance : {false, true})
+        {
+            std::string name = std::string("hdr/") + (radiance ? "radiance/" : "fuse/") + sensor.name;
+            ExposureFusionOptions options;
+            options.radiance = radiance;
+            cv::Mat merged;
+            BenchmarkResult* result = runner.run(
+                name, [&] { fuse_exposures(frames, exposure_times, merged, options); },
+                static_cast<double>(scene.total() * 3 * frames.size()));
+            if (!result)
+                continue;
+            result->counters["merged_fps"] = 1e9 / result->median_ns;
+
+            if (radiance)
+            {
+                // Radiance is scaled to the longest exposure, and the short exposure resolves what it clips
+                cv::Mat estimate;
+                merged.convertTo(estimate, CV_32FC3, 1.0 / exposure_times.back());
+                cv::Mat reference;
+                scene.convertTo(reference, CV_32FC3);
+                double error = cv::norm(estimate, reference, cv::NORM_L1) / (scene.total() * 3);
+                result->counters["radiance_error"] = error;
+                if (error > 2.0)
+                {
+                    runner.fail(name + " does not recover the scene radiance");
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Bracket a simulated camera whose frames follow its exposure time, and check that every merged set holds one
+ * frame of each exposure time, in order.
+ */
+static void benchmark_bracketing(BenchmarkRunner& runner)
+{
+    const std::string name = "hdr/bracket/1080p";
+    if (!runner.selected(name))
+        return;
+
+    const uint32_t width = 1920;
+    const uint32_t height = 1080;
+    const double reference_exposure_time = 4000.0; // Exposure at which the simulated scene renders as generated
+    const int frames = 90;
+
+    TeliCam::Parameters parameters;
+    parameters.exposure_time = reference_exposure_time;
+    parameters.frame_pool_size = 8;
+    TeliCam cam;
+    cam.initialize_simulated(parameters, width, height);
+
+    // Writes reach the simulated camera before it renders the next frame
+    ExposureBracketer::Options options;
+    options.exposure_times = {1000.0, 4000.0, 16000.0};
+    options.latency_frames = 0;
+
+    std::mutex rendered_mutex;
+    std::map<uint64_t, double> rendered_exposure_times; // By frame ID
+    std::vector<double> samples_ns;
+    uint64_t mismatched_sets = 0;
+    ExposureBracketer bracketer(cam, options, [&](const BracketedFrame& merged) {
+        std::lock_guard<std::mutex> lock(rendered_mutex);
+        samples_ns.push_back(merged.merge_ms * 1e6);
+        for (size_t i = 0; i < merged.exposures.size(); ++i)
+        {
+            if (rendered_exposure_times[merged.exposures[i].frame_id] != merged.exposure_times[i])
+            {
+                mismatched_sets++;
+                break;
+            }
+        }
+    });
+
+    std::vector<uint8_t> scene = make_bayer_frame(width, height);
+    cv::Mat exposed;
+    int64_t start_ns = monotonic_ns();
+    for (int frame = 1; frame <= frames; ++frame)
+    {
+        double exposure_time = cam.get_parameters().exposure_time;
+        expose_frame(cv::Mat(height, width, CV_8UC1, scene.data()), exposure_time / reference_exposure_time, exposed);
+        {
+            std::lock_guard<std::mutex> lock(rendered_mutex);
+            rendered_exposure_times[frame] = exposure_time;
+        }
+
+        RawFrame raw;
+        raw.data = exposed.ptr<uint8_t>();
+        raw.size = exposed.total();
+        raw.width = width;
+        raw.height = height;
+        raw.pixel_format = pixel_format::BAYER_RG8;
+        raw.block_id = frame;
+        raw.receive_ns = monotonic_ns();
+        cam.inject_frame(raw);
+
+        // Wait for the bracketer to see this frame and write the next exposure time
+        ExposureBracketer::Stats stats = bracketer.get_stats();
+        while (stats.writes + stats.write_errors < static_cast<uint64_t>(frame) &&
+               monotonic_ns() - raw.receive_ns < 1000000000)
+        {
+            std::this_thread::yield();
+            stats = bracketer.get_stats();
+        }
+    }
+
+    // Let the last complete set be merged
+    ExposureBracketer::Stats stats = bracketer.get_stats();
+    uint64_t complete_sets = frames / options.exposure_times.size() - 1; // The first frames predate the first write
+    while (stats.sets_merged + stats.sets_dropped < complete_sets && monotonic_ns() - start_ns < 10000000000)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        stats = bracketer.get_stats();
+    }
+    double elapsed_s = (monotonic_ns() - start_ns) / 1e9;
+
+    std::lock_guard<std::mutex> lock(rendered_mutex);
+    BenchmarkResult result = BenchmarkRunner::summarize(name, samples_ns);
+    result.counters["merged_fps"] = stats.merged_fps;
+    result.counters["stream_fps"] = frames / elapsed_s;
+    result.counters["sets_merged"] = static_cast<double>(stats.sets_merged);
+    result.counters["sets_dropped"] = static_cast<double>(stats.sets_dropped);
+    result.counters["sets_broken"] = static_cast<double>(stats.sets_broken);
+    runner.add_result(result);
+
+    if (stats.sets_merged == 0 || stats.sets_merged + stats.sets_dropped < complete_sets)
+    {
+        runner.fail(name + " did not merge every complete set");
+    }
+    if (mismatched_sets > 0 || stats.sets_broken > 0)
+    {
+        runner.fail(name + " grouped frames of the wrong exposure times");
+    }
+}
+
+static void benchmark_undistortion(BenchmarkRunner& runner)
+{
+    char cache_template[] = "/tmp/telicam_benchmarks_XXXXXX";
+    const char* cache_dir = mkdtemp(cache_template);
+    if (!cache_dir)
+    {
+        runner.fail("undistort: failed to create a cache directory");
+        return;
+    }
+
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::string name = std::string("undistort/fixed_point/") + sensor.name;
+        std::string float_name = std::string("undistort/float_remap/") + sensor.name;
+        if (!runner.selected(name) && !runner.selected(float_name))
+            continue;
+
+        std::vector<uint8_t> bayer = make_bayer_frame(sensor.width, sensor.height);
+        cv::Mat bgr(sensor.height, sensor.width, CV_8UC3);
+        ConversionScratch scratch;
+        convert_to_bgr(make_raw_frame(bayer, sensor.width, sensor.height), bgr, scratch);
+        double frame_bytes = static_cast<double>(bgr.total() * bgr.elemSize());
+
+        // Barrel distortion of a typical wide-angle lens
+        CameraCalibration calibration;
+        double focal = 0.8 * sensor.width;
+        double center_x = sensor.width / 2.0 - 0.5;
+        double center_y = sensor.height / 2.0 - 0.5;
+        calibration.camera_matrix = {focal, 0.0, center_x, 0.0, focal, center_y, 0.0, 0.0, 1.0};
+        calibration.distortion_coefficients = {-0.28, 0.09, 0.0005, -0.0003, -0.012};
+        cv::Mat camera_matrix(3, 3, CV_64F, calibration.camera_matrix.data());
+        cv::Mat distortion(calibration.distortion_coefficients);
+
+        int64_t build_start_ns = monotonic_ns();
+        Undistorter undistorter(calibration, bgr.size(), cache_dir);
+        int64_t build_ns = monotonic_ns() - build_start_ns;
+        Undistorter cached(calibration, bgr.size(), cache_dir);
+        int64_t load_ns = monotonic_ns() - build_start_ns - build_ns;
+
+        cv::Mat undistorted(bgr.size(), CV_8UC3);
+        BenchmarkResult* result = runner.run(name, [&] { undistorter.apply(bgr, undistorted); }, frame_bytes);
+
+        // What consumers do without the driver stage: remap with float maps
+        cv::Mat map_x, map_y, float_undistorted;
+        cv::initUndistortRectifyMap(camera_matrix, distortion, cv::Mat(), camera_matrix, bgr.size(), CV_32FC1, map_x,
+                                    map_y);
+        runner.run(float_name, [&] { cv::remap(bgr, float_undistorted, map_x, map_y, cv::INTER_LINEAR); },
+                   frame_bytes);
+
+        if (!result)
+            continue;
+
+        cv::Mat reference, difference;
+        cv::undistort(bgr, reference, camera_matrix, distortion);
+        cv::absdiff(undistorted, reference, difference);
+        double max_difference = 0.0;
+        cv::minMaxLoc(difference.reshape(1), nullptr, &max_difference);
+        cv::Scalar channel_difference = cv::mean(difference);
+        double mean_difference = (channel_difference[0] + channel_difference[1] + channel_difference[2]) / 3.0;
+
+        cv::Mat cached_undistorted(bgr.size(), CV_8UC3);
+        cached.apply(bgr, cached_undistorted);
+        cv::absdiff(undistorted, cached_undistorted, difference);
+        double max_cached_difference = 0.0;
+        cv::minMaxLoc(difference.reshape(1), nullptr, &max_cached_difference);
+
+        result->counters["build_ms"] = build_ns / 1e6;
+        result->counters["cache_load_ms"] = load_ns / 1e6;
+        result->counters["max_difference"] = max_difference;
+        result->counters["mean_difference"] = mean_difference;
+
+        if (max_difference > 2.0 || mean_difference > 0.5)
+        {
+            runner.fail(name + " differs from cv::undistort by up to " + std::to_string(max_difference) +
+                        " (mean " + std::to_string(mean_difference) + ")");
+        }
+        if (!cached.is_cached() || max_cached_difference != 0.0)
+        {
+            runner.fail(name + " tables loaded from the cache do not match the built ones");
+        }
+    }
+
+    remove_directory(cache_dir);
+}
+
+static void benchmark_publish(BenchmarkRunner& runner)
+{
+    for (bool use_worker : {false, true})
+    {
+        std::string name = std::string("publish/") + (use_worker ? "worker_submit" : "inline") + "/1080p";
+        if (!runner.selected(name))
+            continue;
+
+        std::vector<uint8_t> bayer = make_bayer_frame(1920, 1080);
+        RawFrame raw = make_raw_frame(bayer, 1920, 1080);
+
+        TeliCam::Parameters parameters;
+        parameters.use_worker_thread = use_worker;
+
+        TeliCam cam;
+        cam.initialize_simulated(parameters, 1920, 1080);
+
+        uint64_t block_id = 0;
+        BenchmarkResult* result = runner.run(name, [&] {
+            raw.block_id = block_id++;
+            raw.receive_ns = monotonic_ns();
+            cam.inject_frame(raw);
+        });
+
+        TeliCam::TimingStats stats = cam.get_timing_stats();
+        result->counters["conversion_mean_us"] = stats.conversion.mean_us;
+        result->counters["publish_mean_us"] = stats.publish.mean_us;
+        result->counters["handoff_mean_us"] = stats.handoff.mean_us;
+        result->counters["frames_dropped"] = static_cast<double>(stats.frames_dropped);
+
+        // A frame larger than the stream's payload cannot be queued without allocating, so the worker drops it
+        if (use_worker)
+        {
+            std::vector<uint8_t> oversized(static_cast<size_t>(1920) * 1080 * 2 + 1);
+            RawFrame oversized_raw = raw;
+            oversized_raw.data = oversized.data();
+            oversized_raw.size = oversized.size();
+            cam.inject_frame(oversized_raw);
+            if (cam.get_timing_stats().frames_oversized != 1)
+            {
+                runner.fail(name + " did not drop a frame larger than the payload size");
+            }
+
+            // Removing a listener waits for its call in progress on the worker thread
+            std::atomic<bool> in_call{false};
+            int listener_id = cam.add_frame_listener([&in_call](const Frame&) {
+                in_call = true;
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                in_call = false;
+            });
+            cam.inject_frame(raw);
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            while (!in_call && std::chrono::steady_clock::now() < deadline)
+            {
+                std::this_thread::yield();
+            }
+            cam.remove_frame_listener(listener_id);
+            if (in_call)
+            {
+                runner.fail(name + " removed a listener while it was still being called");
+            }
+        }
+    }
+}
+
+/**
+ * @brief Simulate a camera that bins or decimates a Bayer mosaic by a factor, keeping the pattern by sampling 2x2
+ * tiles.
+ */
+static std::vector<uint8_t> reduce_bayer_frame(const std::vector<uint8_t>& bayer, uint32_t width, cv::Size reduced,
+                                               uint32_t factor)
+{
+    std::vector<uint8_t> frame(static_cast<size_t>(reduced.area()));
+    for (int y = 0; y < reduced.height; ++y)
+    {
+        size_t source_y = static_cast<size_t>((y / 2) * 2 * factor + (y & 1));
+        for (int x = 0; x < reduced.width; ++x)
+        {
+            size_t source_x = (x / 2) * 2 * factor + (x & 1);
+            frame[static_cast<size_t>(y) * reduced.width + x] = bayer[source_y * width + source_x];
+        }
+    }
+    return frame;
+}
+
+/**
+ * @brief Time the host side of displaying a camera at a quarter of its size, from full resolution frames scaled in
+ * software and from preview profile frames, and check that the preview profile reduces on the camera.
+ */
+static void benchmark_preview(BenchmarkRunner& runner)
+{
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::string full_name = std::string("preview/full_resolution/") + sensor.name;
+        std::string preview_name = std::string("preview/profile/") + sensor.name;
+        if (!runner.selected(full_name) && !runner.selected(preview_name))
+            continue;
+
+        std::vector<uint8_t> bayer = make_bayer_frame(sensor.width, sensor.height);
+        cv::Size display_size(sensor.width / 4, sensor.height / 4);
+
+        TeliCam cam;
+        cam.initialize_simulated(TeliCam::Parameters(), sensor.width, sensor.height);
+
+        uint64_t block_id = 0;
+        auto display = [&](const RawFrame& raw) {
+            RawFrame frame = raw;
+            frame.block_id = block_id++;
+            frame.receive_ns = monotonic_ns();
+            cam.inject_frame(frame);
+
+            std::vector<cv::Mat> frames = {cam.get_last_frame()};
+            cv::Mat composed;
+            compose_frames(frames, std::vector<cv::Size>{display_size}, composed);
+        };
+
+        RawFrame full_raw = make_raw_frame(bayer, sensor.width, sensor.height);
+        BenchmarkResult* full = runner.run(full_name, [&] { display(full_raw); }, static_cast<double>(bayer.size()));
+
+        int64_t switch_start_ns = monotonic_ns();
+        PreviewProfile profile = cam.set_preview_profile(display_size);
+        double switch_us = (monotonic_ns() - switch_start_ns) / 1000.0;
+
+        uint32_t factor = profile.binning * profile.decimation;
+        std::vector<uint8_t> reduced = reduce_bayer_frame(bayer, sensor.width, profile.camera_size, factor);
+        RawFrame preview_raw = make_raw_frame(reduced, profile.camera_size.width, profile.camera_size.height);
+        size_t allocations = cam.get_memory_stats().allocations;
+        BenchmarkResult* result =
+            runner.run(preview_name, [&] { display(preview_raw); }, static_cast<double>(reduced.size()));
+        if (result)
+        {
+            result->counters["binning"] = profile.binning;
+            result->counters["decimation"] = profile.decimation;
+            result->counters["bus_reduction"] = static_cast<double>(bayer.size()) / reduced.size();
+            result->counters["switch_us"] = switch_us;
+            if (full)
+            {
+                result->counters["host_speedup"] = full->median_ns / result->median_ns;
+            }
+        }
+
+        bool delivered = !result || cam.get_last_frame().size() == profile.camera_size;
+        if (factor < 4 || profile.camera_size.width < display_size.width ||
+            profile.camera_size.height < display_size.height || !delivered)
+        {
+            runner.fail(preview_name + " did not reduce to the display size on the camera");
+        }
+        if (cam.get_memory_stats().allocations != allocations)
+        {
+            runner.fail(preview_name + " allocated frame buffers after the switch instead of during it");
+        }
+
+        cam.set_full_profile();
+        if (cam.get_frame_size() != cv::Size(sensor.width, sensor.height))
+        {
+            runner.fail(preview_name + " did not switch back to full resolution");
+        }
+    }
+}
+
+static void benchmark_last_frame_contention(BenchmarkRunner& runner)
+{
+    const int background_readers = 3;
+    std::string name = "get_last_frame/contended/1080p";
+    if (!runner.selected(name))
+        return;
+
+    std::vector<uint8_t> bayer = make_bayer_frame(1920, 1080);
+    RawFrame raw = make_raw_frame(bayer, 1920, 1080);
+
+    TeliCam cam;
+    cam.initialize_simulated(TeliCam::Parameters(), 1920, 1080);
+    cam.inject_frame(raw);
+
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    threads.emplace_back([&] {
+        while (!stop)
+        {
+            raw.receive_ns = monotonic_ns();
+            cam.inject_frame(raw);
+        }
+    });
+    for (int i = 0; i < background_readers; ++i)
+    {
+        threads.emplace_back([&] {
+            while (!stop)
+            {
+                cv::Mat frame = cam.get_last_frame();
+            }
+        });
+    }
+
+    runner.run(name, [&] { cv::Mat frame = cam.get_last_frame(); }, 1920.0 * 1080.0 * 3.0);
+
+    stop = true;
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+static void benchmark_viewer_compose(BenchmarkRunner& runner)
+{
+    for (int num_cams : {1, 2, 4})
+    {
+        std::vector<cv::Mat> sources;
+        for (int i = 0; i < num_cams; ++i)
+        {
+            std::vector<uint8_t> bayer = make_bayer_frame(1920, 1080, i);
+            cv::Mat bgr(1080, 1920, CV_8UC3);
+            ConversionScratch scratch;
+            convert_to_bgr(make_raw_frame(bayer, 1920, 1080), bgr, scratch);
+            sources.push_back(bgr);
+        }
+        std::vector<int> downscale_factors(num_cams, 2);
+
+        runner.run("viewer/compose/1080p_x" + std::to_string(num_cams) + "_downscale2", [&] {
+            std::vector<cv::Mat> frames = sources;
+            cv::Mat composed;
+            compose_frames(frames, downscale_factors, composed);
+        });
+    }
+}
+
+static void benchmark_auto_exposure(BenchmarkRunner& runner)
+{
+    const uint32_t width = 640;
+    const uint32_t height = 480;
+    const double reference_exposure_time = 10000.0; // Exposure at which the simulated scene renders as generated
+    const double worst_brightness_error = 1000.0;
+
+    struct AutoExposureCase
+    {
+        const char* name;
+        double start_exposure_time;
+        bool restart; // Write once at a high frame ID, then start the frame IDs over as a recovered stream does
+    };
+    const AutoExposureCase cases[] = {
+        {"auto_exposure/converge_from_dark", 100.0, false},
+        {"auto_exposure/converge_from_bright", 30000.0, false},
+        {"auto_exposure/converge_after_restart", 100.0, true},
+    };
+
+    for (const AutoExposureCase& test_case : cases)
+    {
+        std::string name = test_case.name;
+        if (!runner.selected(name))
+            continue;
+        double start_exposure_time = test_case.start_exposure_time;
+
+        TeliCam::Parameters parameters;
+        parameters.compute_statistics = true;
+        parameters.statistics_subsample = 2;
+        parameters.exposure_time = start_exposure_time;
+
+        TeliCam cam;
+        cam.initialize_simulated(parameters, width, height);
+
+        AutoExposureController::Options options;
+        AutoExposureController controller(cam, options);
+        int max_frames = static_cast<int>(std::ceil(std::log(worst_brightness_error) / std::log(options.max_step))) *
+                         (options.settle_frames + 1) + 1;
+
+        // A simulated source whose brightness follows exposure time and gain, with clipping
+        std::vector<uint8_t> scene = make_bayer_frame(width, height);
+        std::vector<uint8_t> exposed(scene.size());
+        RawFrame raw = make_raw_frame(exposed, width, height);
+
+        AutoExposureController::State state;
+        auto expose_frame = [&](uint64_t frame_id) {
+            TeliCam::Parameters current = cam.get_parameters();
+            double scale = current.exposure_time / reference_exposure_time * std::pow(10.0, current.gain / 20.0);
+            uint8_t lut[256];
+            for (int i = 0; i < 256; ++i)
+            {
+                lut[i] = static_cast<uint8_t>(std::min(255.0, i * scale + 0.5));
+            }
+            for (size_t i = 0; i < scene.size(); ++i)
+            {
+                exposed[i] = lut[scene[i]];
+            }
+
+            raw.block_id = frame_id;
+            raw.receive_ns = monotonic_ns();
+            cam.inject_frame(raw);
+
+            // Wait for the controller to act on this frame before rendering the next one
+            do
+            {
+                std::this_thread::yield();
+                state = controller.get_state();
+            } while (state.last_frame_id != frame_id && monotonic_ns() - raw.receive_ns < 1000000000);
+        };
+
+        if (test_case.restart)
+        {
+            expose_frame(1000000);
+        }
+
+        std::vector<double> samples_ns;
+        int frames_to_converge = -1;
+        for (int frame = 1; frame <= max_frames && frames_to_converge < 0; ++frame)
+        {
+            expose_frame(frame);
+            samples_ns.push_back(static_cast<double>(monotonic_ns() - raw.receive_ns));
+            if (state.converged)
+            {
+                frames_to_converge = frame;
+            }
+        }
+
+        BenchmarkResult result = BenchmarkRunner::summarize(name, samples_ns);
+        result.counters["frames_to_converge"] = frames_to_converge;
+        result.counters["max_frames"] = max_frames;
+        result.counters["exposure_time"] = state.exposure_time;
+        result.counters["gain"] = state.gain;
+        result.counters["luma"] = state.luma;
+        result.counters["writes"] = static_cast<double>(state.writes);
+        result.counters["skipped_writes"] = static_cast<double>(state.skipped_writes);
+        runner.add_result(result);
+
+        if (frames_to_converge < 0)
+        {
+            runner.fail(name + " did not converge within " + std::to_string(max_frames) + " frames");
+        }
+    }
+}
+
+/**
+ * @brief Time the change detector on static frames that differ only by sensor noise, which must not count as
+ * activity, and check that a moving object starts activity which ends once the scene is static again.
+ */
+static void benchmark_change_detection(BenchmarkRunner& runner)
+{
+    ChangeDetector::Options options;
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 2.0f);
+
+    for (const auto& sensor : SENSOR_SIZES)
+    {
+        std::vector<uint8_t> bayer = make_bayer_frame(sensor.width, sensor.height);
+        std::vector<uint8_t> noisy_bayer(bayer.size());
+        for (size_t i = 0; i < bayer.size(); ++i)
+        {
+            noisy_bayer[i] = cv::saturate_cast<uint8_t>(bayer[i] + noise(rng));
+        }
+
+        cv::Mat frames[2];
+        frames[0] = cv::Mat(sensor.height, sensor.width, CV_8UC1, bayer.data());
+        frames[1] = cv::Mat(sensor.height, sensor.width, CV_8UC1, noisy_bayer.data());
+        cv::Mat bgr_frames[2];
+        ConversionScratch scratch;
+        for (int i = 0; i < 2; ++i)
+        {
+            bgr_frames[i].create(sensor.height, sensor.width, CV_8UC3);
+            convert_to_bgr(make_raw_frame(i == 0 ? bayer : noisy_bayer, sensor.width, sensor.height), bgr_frames[i],
+                           scratch);
+        }
+
+        for (bool bgr : {false, true})
+        {
+            std::string name = std::string("change/") + (bgr ? "bgr/" : "bayer/") + sensor.name;
+            const cv::Mat* input = bgr ? bgr_frames : frames;
+
+            ChangeDetector detector(options);
+            size_t frame = 0;
+            bool active = false;
+            double max_changed_fraction = 0.0;
+            BenchmarkResult* result = runner.run(name, [&] {
+                ChangeDetector::Result change = detector.update(input[frame++ & 1]);
+                active = active || change.active;
+                max_changed_fraction = std::max(max_changed_fraction, change.changed_fraction);
+            }, static_cast<double>(input[0].total() * input[0].elemSize()));
+            if (!result)
+                continue;
+
+            result->counters["max_changed_fraction"] = max_changed_fraction;
+            if (active)
+            {
+                runner.fail(name + " detected activity in static frames");
+            }
+        }
+    }
+
+    std::string name = "change/moving_object";
+    if (!runner.selected(name))
+        return;
+
+    const uint32_t width = 1920;
+    const uint32_t height = 1080;
+    const int moving_frames = 20;
+    std::vector<uint8_t> scene = make_bayer_frame(width, height);
+    std::vector<uint8_t> buffer(scene.size());
+    cv::Mat frame(height, width, CV_8UC1, buffer.data());
+
+    ChangeDetector detector(options);
+    int started_frame = -1;
+    int ended_frame = -1;
+    std::vector<double> samples_ns;
+    int total_frames = 10 + moving_frames + static_cast<int>(options.post_roll_frames) + 40;
+    for (int i = 0; i < total_frames; ++i)
+    {
+        for (size_t j = 0; j < scene.size(); ++j)
+        {
+            buffer[j] = cv::saturate_cast<uint8_t>(scene[j] + noise(rng));
+        }
+
+        // A bright square crosses the frame after 10 static frames and leaves it before the static tail
+        int moving = i - 10;
+        if (moving >= 0 && moving < moving_frames)
+        {
+            frame(cv::Rect(100 + moving * 80, 400, 200, 200)).setTo(cv::Scalar(250));
+        }
+
+        int64_t start_ns = monotonic_ns();
+        ChangeDetector::Result change = detector.update(frame);
+        samples_ns.push_back(static_cast<double>(monotonic_ns() - start_ns));
+
+        if (change.started && started_frame < 0)
+        {
+            started_frame = i;
+        }
+        if (started_frame >= 0 && !change.active && ended_frame < 0)
+        {
+            ended_frame = i;
+        }
+    }
+
+    BenchmarkResult result = BenchmarkRunner::summarize(name, samples_ns);
+    result.counters["started_frame"] = started_frame;
+    result.counters["ended_frame"] = ended_frame;
+    runner.add_result(result);
+
+    if (started_frame < 10 || started_frame >= 10 + moving_frames)
+    {
+        runner.fail(name + " did not start activity while the object moved");
+    }
+    else if (ended_frame < 0)
+    {
+        runner.fail(name + " did not end activity after the scene became static");
+    }
+}
+
+static void benchmark_supervisor_fault(BenchmarkRunner& runner, const std::string& fault)
+{
+    std::string name = "supervisor/" + fault;
+    if (!runner.selected(name))
+        return;
+
+    const uint32_t width = 640;
+    const uint32_t height = 480;
+    const int incidents = 5;
+    const int disconnect_ms = 300;
+    std::vector<uint8_t> bayer = make_bayer_frame(width, height);
+
+    // The supervised camera and a bystander that must not notice its incidents, both fed at 100 fps
+    TeliCam::Parameters parameters;
+    parameters.framerate = 100.0;
+    TeliCam cam;
+    TeliCam bystander;
+    cam.initialize_simulated(parameters, width, height);
+    bystander.initialize_simulated(parameters, width, height);
+    cam.start_stream();
+    bystander.start_stream();
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> bystander_injected(0);
+    std::thread feeder([&] {
+        RawFrame raw = make_raw_frame(bayer, width, height);
+        while (!stop)
+        {
+            raw.block_id++;
+            raw.receive_ns = monotonic_ns();
+            cam.inject_frame(raw);
+            bystander.inject_frame(raw);
+            bystander_injected.fetch_add(1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    // Recovery must bring the camera back in its configured profile, with its runtime parameters and frame buffers
+    const double exposure_time = 2500.0;
+    cam.set_exposure_time(exposure_time);
+    cam.set_preview_profile(cv::Size(width / 2, height / 2));
+
+    StreamSupervisor::Options options;
+    options.min_stall_ms = 50;
+    options.retry_interval_ms = 50;
+    StreamSupervisor supervisor(cam, options);
+
+    std::vector<double> downtime_ns;
+    bool timed_out = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    size_t allocations = cam.get_memory_stats().allocations;
+    for (int i = 0; i < incidents && !timed_out; ++i)
+    {
+        uint64_t recoveries = supervisor.get_stats().recoveries;
+        if (fault == "stream_error")
+        {
+            cam.inject_stream_error();
+        }
+        else
+        {
+            cam.set_simulated_connected(false);
+            std::this_thread::sleep_for(std::chrono::milliseconds(disconnect_ms));
+            cam.set_simulated_connected(true);
+        }
+
+        int64_t deadline_ns = monotonic_ns() + 5000000000LL;
+        while (supervisor.get_stats().recoveries == recoveries && !timed_out)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            timed_out = monotonic_ns() > deadline_ns;
+        }
+        if (!timed_out)
+        {
+            downtime_ns.push_back(supervisor.get_stats().last_downtime_ms * 1e6);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    stop = true;
+    feeder.join();
+
+    StreamSupervisor::Stats stats = supervisor.get_stats();
+    CameraMetricsSnapshot bystander_metrics = bystander.get_metrics()->snapshot();
+    if (!downtime_ns.empty())
+    {
+        BenchmarkResult result = BenchmarkRunner::summarize(name, downtime_ns);
+        result.counters["incidents"] = static_cast<double>(stats.incidents);
+        result.counters["failed_attempts"] = static_cast<double>(stats.failed_attempts);
+        result.counters["max_downtime_ms"] = stats.max_downtime_ms;
+        runner.add_result(result);
+    }
+
+    if (timed_out || stats.recoveries != static_cast<uint64_t>(incidents))
+    {
+        runner.fail(name + " recovered from " + std::to_string(stats.recoveries) + " of " + std::to_string(incidents) +
+                    " incidents");
+    }
+    if (!cam.is_streaming() || cam.is_preview() || cam.get_frame_size() != cv::Size(width, height) ||
+        cam.get_parameters().exposure_time != exposure_time || cam.get_memory_stats().allocations != allocations)
+    {
+        runner.fail(name + " did not restore the camera's profile, parameters and frame buffers");
+    }
+    if (bystander_metrics.frames_received != bystander_injected.load() || bystander_metrics.recoveries != 0)
+    {
+        runner.fail(name + " affected a camera that had no incident");
+    }
+}
+
+static void benchmark_supervisor(BenchmarkRunner& runner)
+{
+    benchmark_supervisor_fault(runner, "stall_recovery");
+    benchmark_supervisor_fault(runner, "stream_error");
+}
+
+/////////////////////////////////////////////
+// Results
+/////////////////////////////////////////////
+
+static json results_to_json(const std::deque<BenchmarkResult>& results)
+{
+    json benchmarks = json::array();
+    for (const auto& result : results)
+    {
+        json entry;
+        entry["name"] = result.name;
+        entry["iterations"] = result.iterations;
+        entry["mean_ns"] = result.mean_ns;
+        entry["median_ns"] = result.median_ns;
+        entry["p90_ns"] = result.p90_ns;
+        entry["p99_ns"] = result.p99_ns;
+        entry["min_ns"] = result.min_ns;
+        entry["bytes_per_second"] = result.bytes_per_second;
+        entry["counters"] = result.counters;
+        benchmarks.push_back(entry);
+    }
+
+    json output;
+    output["version"] = 1;
+    output["hardware_concurrency"] = std::thread::hardware_concurrency();
+    output["opencv_threads"] = cv::getNumThreads();
+    output["benchmarks"] = benchmarks;
+    return output;
+}
+
+// Exit status of a run that could not compare any benchmark with the baseline. ctest reports it as skipped.
+static const int EXIT_NOT_COMPARED = 77;
+
+struct BaselineComparison
+{
+    int compared = 0;    // Benchmarks found in the baseline
+    int regressions = 0; // Benchmarks slower than the baseline by more than the threshold
+};
+
+/**
+ * @brief Compare median times against a baseline file written by a previous run.
+ */
+static BaselineComparison compare_to_baseline(const std::deque<BenchmarkResult>& results,
+                                              const std::string& baseline_filename, double threshold)
+{
+    std::ifstream file(baseline_filename);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open baseline " + baseline_filename);
+    }
+
+    json baseline;
+    try
+    {
+        baseline = json::parse(file);
+    }
+    catch (const json::parse_error& e)
+    {
+        throw std::runtime_error("Baseline " + baseline_filename + " is not valid JSON: " + e.what());
+    }
+    if (!baseline.contains("benchmarks") || !baseline["benchmarks"].is_array())
+    {
+        throw std::runtime_error("Baseline " + baseline_filename + " has no benchmarks array. Write one with --output");
+    }
+
+    std::map<std::string, double> baseline_medians;
+    for (const auto& entry : baseline["benchmarks"])
+    {
+        if (!entry.is_object() || !entry.contains("name") || !entry["name"].is_string() ||
+            !entry.contains("median_ns") || !entry["median_ns"].is_number())
+        {
+            throw std::runtime_error("Baseline " + baseline_filename + " has a benchmark without a name or median_ns");
+        }
+        baseline_medians[entry["name"].get<std::string>()] = entry["median_ns"].get<double>();
+    }
+
+    BaselineComparison comparison;
+    std::cout << std::endl << "Comparison with " << baseline_filename << " (threshold " << threshold * 100.0 << "%):"
+              << std::endl;
+    for (const auto& result : results)
+    {
+        auto it = baseline_medians.find(result.name);
+        if (it == baseline_medians.end() || it->second <= 0.0)
+        {
+            std::cout << "  " << std::left << std::setw(48) << result.name << " (not in baseline)" << std::endl;
+            continue;
+        }
+
+        comparison.compared++;
+        double change = result.median_ns / it->second - 1.0;
+        const char* status = "ok";
+        if (change > threshold)
+        {
+            status = "REGRESSION";
+            comparison.regressions++;
+        }
+        else if (change < -threshold)
+        {
+            status = "improved";
+        }
+
+        std::cout << "  " << std::left << std::setw(48) << result.name << std::right << std::showpos << std::fixed
+                  << std::setprecision(1) << std::setw(8) << change * 100.0 << "%" << std::noshowpos << "  " << status
+                  << std::endl;
+    }
+
+    return comparison;
+}
+
+int main(int argc, char** argv)
+{
+    CLI::App app{"TeliCam frame path benchmarks"};
+
+    std::string output_filename;
+    std::string baseline_filename;
+    std::string filter;
+    double threshold = 0.10;
+    double min_time_s = 0.5;
+    std::string recording_filename;
+
+    app.add_option("--output", output_filename, "Write results as JSON to this file");
+    app.add_option("--baseline", baseline_filename, "Baseline JSON to compare against")->check(CLI::ExistingFile);
+    app.add_option("--threshold", threshold, "Relative slowdown of the median flagged as a regression")
+        ->default_val(0.10);
+    app.add_option("--filter", filter, "Only run benchmarks whose name contains this string");
+    app.add_option("--min-time", min_time_s, "Minimum time per benchmark (s)")->default_val(0.5);
+    app.add_option("--recording", recording_filename, "Also benchmark the codec on the first frame of this recording")
+        ->check(CLI::ExistingFile);
+
+    CLI11_PARSE(app, argc, argv);
+
+    BenchmarkRunner runner(min_time_s, filter);
+    benchmark_conversion(runner);
+    benchmark_regions(runner);
+    benchmark_statistics(runner);
+    benchmark_denoise(runner);
+    benchmark_exposure_fusion(runner);
+    benchmark_bracketing(runner);
+    benchmark_undistortion(runner);
+    benchmark_codec(runner, recording_filename);
+    benchmark_change_detection(runner);
+    benchmark_publish(runner);
+    benchmark_preview(runner);
+    benchmark_last_frame_contention(runner);
+    benchmark_viewer_compose(runner);
+    benchmark_auto_exposure(runner);
+    benchmark_supervisor(runner);
+
+    if (!output_filename.empty())
+    {
+        std::ofstream file(output_filename);
+        file << results_to_json(runner.get_results()).dump(4) << std::endl;
+    }
+
+    BaselineComparison comparison;
+    if (!baseline_filename.empty())
+    {
+        try
+        {
+            comparison = compare_to_baseline(runner.get_results(), baseline_filename, threshold);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        if (comparison.regressions > 0)
+        {
+            std::cout << comparison.regressions << " benchmark(s) regressed" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!runner.get_failures().empty())
+    {
+        std::cout << runner.get_failures().size() << " benchmark(s) failed" << std::endl;
+        return 1;
+    }
+
+    // Passing without comparing anything would hide slowdowns, e.g. with a baseline recorded on no machine yet
+    if (!baseline_filename.empty() && comparison.compared == 0)
+    {
+        std::cout << "No benchmark is in " << baseline_filename << ", so slowdowns were not checked. Record it with "
+                  << "--output on the reference machine" << std::endl;
+        return EXIT_NOT_COMPARED;
+    }
+
+    return 0;
+}
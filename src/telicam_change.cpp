@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "telicam_change.hpp"
+
+#if CV_SIMD
+static const int BLOCK_WIDTH = cv::v_uint8::nlanes;
+#else
+static const int BLOCK_WIDTH = 16;
+#endif
+
+namespace
+{
+int samples_per_row(int width, int block_step)
+{
+    int samples = 0;
+    for (int x = 0; x < width; x += BLOCK_WIDTH * block_step)
+    {
+        samples += std::min(BLOCK_WIDTH, width - x);
+    }
+    return samples;
+}
+
+/**
+ * @brief Compare count consecutive pixels with their reference samples and move the references towards them. BGR
+ * frames are compared on green.
+ */
+uint64_t compare_pixels(const uint8_t* row, int count, int channels, const ChangeDetector::Options& options,
+                        uint16_t* reference)
+{
+    uint64_t changed = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        int value = channels == 1 ? row[i] : row[3 * i + 1];
+        changed += std::abs(value - (reference[i] >> 8)) > options.pixel_threshold;
+        reference[i] = static_cast<uint16_t>(reference[i] - (reference[i] >> options.reference_shift) +
+                                             (value << (8 - options.reference_shift)));
+    }
+    return changed;
+}
+
+#if CV_SIMD
+/**
+ * @brief Compare the sampled blocks of one row. Returns the number of changed samples.
+ */
+uint64_t compare_row(const uint8_t* row, int width, int channels, int block_step,
+                     const ChangeDetector::Options& options, uint16_t* reference)
+{
+    const cv::v_uint8 threshold = cv::v_setall_u8(options.pixel_threshold);
+    const cv::v_uint8 one = cv::v_setall_u8(1);
+    const int shift = static_cast<int>(options.reference_shift);
+
+    // At most 2 per lane and block, so 16 bits last for any row width
+    cv::v_uint16 changed = cv::v_setzero_u16();
+
+    int x = 0;
+    for (; x + BLOCK_WIDTH <= width; x += BLOCK_WIDTH * block_step, reference += BLOCK_WIDTH)
+    {
+        cv::v_uint8 value;
+        if (channels == 1)
+        {
+            value = cv::vx_load(row + x);
+        }
+        else
+        {
+            cv::v_uint8 b, r;
+            cv::v_load_deinterleave(row + 3 * x, b, value, r);
+        }
+
+        cv::v_uint16 reference0 = cv::vx_load(reference);
+        cv::v_uint16 reference1 = cv::vx_load(reference + BLOCK_WIDTH / 2);
+        cv::v_uint8 reference8 = cv::v_pack(reference0 >> 8, reference1 >> 8);
+
+        cv::v_uint16 count0, count1;
+        cv::v_expand((cv::v_absdiff(value, reference8) > threshold) & one, count0, count1);
+        changed += count0 + count1;
+
+        cv::v_uint16 value0, value1;
+        cv::v_expand(value, value0, value1);
+        cv::v_store(reference, reference0 - (reference0 >> shift) + (value0 << (8 - shift)));
+        cv::v_store(reference + BLOCK_WIDTH / 2, reference1 - (reference1 >> shift) + (value1 << (8 - shift)));
+    }
+
+    uint64_t total = cv::v_reduce_sum(changed);
+    if (x < width)
+    {
+        total += compare_pixels(row + channels * x, width - x, channels, options, reference);
+    }
+    return total;
+}
+#else
+uint64_t compare_row(const uint8_t* row, int width, int channels, int block_step,
+                     const ChangeDetector::Options& options, uint16_t* reference)
+{
+    uint64_t total = 0;
+    for (int x = 0; x < width; x += BLOCK_WIDTH * block_step)
+    {
+        int count = std::min(BLOCK_WIDTH, width - x);
+        total += compare_pixels(row + channels * x, count, channels, options, reference);
+        reference += count;
+    }
+    return total;
+}
+#endif
+} // namespace
+
+ChangeDetector::ChangeDetector(const Options& options)
+    : options(options)
+    , reference_type(-1)
+    , active(false)
+    , frames_above_start(0)
+    , frames_below_stop(0)
+{
+    this->options.grid_step = std::max<uint32_t>(options.grid_step, 1);
+    this->options.reference_shift = std::min<uint32_t>(options.reference_shift, 8);
+}
+
+ChangeDetector::Result ChangeDetector::update(const cv::Mat& frame)
+{
+    CV_Assert(frame.type() == CV_8UC1 || frame.type() == CV_8UC3);
+
+    int step = static_cast<int>(options.grid_step);
+    int channels = frame.type() == CV_8UC1 ? 1 : 3;
+    int row_samples = samples_per_row(frame.cols, step);
+
+    Result result;
+    if (frame.size() != reference_size || frame.type() != reference_type)
+    {
+        reset();
+        reference_size = frame.size();
+        reference_type = frame.type();
+
+        // Seed the reference with the frame itself
+        reference.assign(static_cast<size_t>((frame.rows + step - 1) / step) * row_samples, 0);
+        Options seed = options;
+        seed.reference_shift = 0;
+        uint16_t* row_reference = reference.data();
+        for (int y = 0; y < frame.rows; y += step, row_reference += row_samples)
+        {
+            compare_row(frame.ptr<uint8_t>(y), frame.cols, channels, step, seed, row_reference);
+        }
+        return result;
+    }
+
+    uint64_t changed = 0;
+    uint16_t* row_reference = reference.data();
+    for (int y = 0; y < frame.rows; y += step, row_reference += row_samples)
+    {
+        changed += compare_row(frame.ptr<uint8_t>(y), frame.cols, channels, step, options, row_reference);
+    }
+    result.changed_fraction = reference.empty() ? 0.0 : static_cast<double>(changed) / reference.size();
+
+    if (!active)
+    {
+        frames_above_start = result.changed_fraction >= options.start_fraction ? frames_above_start + 1 : 0;
+        if (frames_above_start >= std::max<uint32_t>(options.start_frames, 1))
+        {
+            active = true;
+            result.started = true;
+            frames_below_stop = 0;
+        }
+    }
+    else
+    {
+        frames_below_stop = result.changed_fraction < options.stop_fraction ? frames_below_stop + 1 : 0;
+        if (frames_below_stop > options.post_roll_frames)
+        {
+            active = false;
+            frames_above_start = 0;
+        }
+    }
+
+    result.active = active;
+    return result;
+}
+
+void ChangeDetector::reset()
+{
+    reference.clear();
+    reference_size = cv::Size();
+    reference_type = -1;
+    active = false;
+    frames_above_start = 0;
+    frames_below_stop = 0;
+}
+
+bool ChangeDetector::is_active() const
+{
+    return active;
+}
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "telicam_clock.hpp"
+
+// Samples taken back to back at start-up, and the pause between them
+static const int INITIAL_SAMPLES = 8;
+static const uint32_t INITIAL_INTERVAL_MS = 50;
+
+// 1.4826 * MAD estimates the standard deviation of normally distributed residuals
+static const double MAD_TO_STDDEV = 1.4826;
+
+namespace
+{
+struct Point
+{
+    double x; // Device ticks relative to the reference sample
+    double y; // Host nanoseconds relative to the reference sample
+    int64_t half_round_trip_ns;
+};
+
+bool fit_line(const std::vector<Point>& points, double& slope, double& intercept)
+{
+    if (points.size() < 2)
+        return false;
+
+    double mean_x = 0.0;
+    double mean_y = 0.0;
+    for (const auto& p : points)
+    {
+        mean_x += p.x;
+        mean_y += p.y;
+    }
+    mean_x /= points.size();
+    mean_y /= points.size();
+
+    double sxx = 0.0;
+    double sxy = 0.0;
+    for (const auto& p : points)
+    {
+        sxx += (p.x - mean_x) * (p.x - mean_x);
+        sxy += (p.x - mean_x) * (p.y - mean_y);
+    }
+    if (sxx <= 0.0)
+        return false;
+
+    slope = sxy / sxx;
+    intercept = mean_y - slope * mean_x;
+    return slope > 0.0;
+}
+
+template <typename T> T median(std::vector<T> values)
+{
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+} // namespace
+
+ClockSync::ClockSync() : ClockSync(Options())
+{
+}
+
+ClockSync::ClockSync(const Options& options) : options(options)
+{
+}
+
+void ClockSync::add_sample(const ClockSample& sample)
+{
+    if (sample.host_after_ns < sample.host_before_ns)
+        return;
+
+    // A device clock that went backwards was reset, so earlier samples no longer apply
+    if (!samples.empty() && sample.device_ticks < samples.back().device_ticks)
+    {
+        reset();
+    }
+
+    samples.push_back(sample);
+    while (samples.size() > options.window)
+    {
+        samples.pop_front();
+    }
+
+    fit();
+}
+
+void ClockSync::reset()
+{
+    samples.clear();
+    std::atomic_store(&model, std::shared_ptr<const Model>());
+}
+
+void ClockSync::fit()
+{
+    if (samples.size() < std::max<size_t>(options.min_samples, 2))
+        return;
+
+    // Samples whose request took much longer than usual were probably delayed on one leg only
+    std::vector<int64_t> half_round_trips;
+    for (const auto& sample : samples)
+    {
+        half_round_trips.push_back((sample.host_after_ns - sample.host_before_ns) / 2);
+    }
+    int64_t max_half_round_trip = 2 * median(half_round_trips);
+
+    const ClockSample& reference = samples.back();
+    int64_t reference_host_ns = reference.host_before_ns + (reference.host_after_ns - reference.host_before_ns) / 2;
+
+    std::vector<Point> points;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        if (half_round_trips[i] > max_half_round_trip)
+            continue;
+
+        const ClockSample& sample = samples[i];
+        int64_t host_ns = sample.host_before_ns + half_round_trips[i];
+        points.push_back(Point{static_cast<double>(static_cast<int64_t>(sample.device_ticks - reference.device_ticks)),
+                               static_cast<double>(host_ns - reference_host_ns), half_round_trips[i]});
+    }
+
+    double slope = 0.0;
+    double intercept = 0.0;
+    if (!fit_line(points, slope, intercept))
+        return;
+
+    // Reject samples far from the first fit and refit on the rest
+    std::vector<double> residuals;
+    for (const auto& p : points)
+    {
+        residuals.push_back(std::abs(p.y - (intercept + slope * p.x)));
+    }
+    double max_residual = options.outlier_threshold * MAD_TO_STDDEV * median(residuals);
+    if (max_residual > 0.0)
+    {
+        std::vector<Point> inliers;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            if (residuals[i] <= max_residual)
+                inliers.push_back(points[i]);
+        }
+
+        if (inliers.size() < points.size() && inliers.size() >= 2 && fit_line(inliers, slope, intercept))
+        {
+            points.swap(inliers);
+        }
+    }
+
+    // The host side of each sample is only known to within half its round trip, on top of the scatter of the fit
+    double sum_sq = 0.0;
+    std::vector<int64_t> inlier_half_round_trips;
+    for (const auto& p : points)
+    {
+        double residual = p.y - (intercept + slope * p.x);
+        sum_sq += residual * residual;
+        inlier_half_round_trips.push_back(p.half_round_trip_ns);
+    }
+    double rms = std::sqrt(sum_sq / points.size());
+
+    std::shared_ptr<Model> new_model = std::make_shared<Model>();
+    new_model->reference_ticks = reference.device_ticks;
+    new_model->reference_host_ns = reference_host_ns + std::llround(intercept);
+    new_model->ns_per_tick = slope;
+    new_model->uncertainty_ns = median(inlier_half_round_trips) + static_cast<int64_t>(std::ceil(3.0 * rms));
+    std::atomic_store(&model, std::shared_ptr<const Model>(std::move(new_model)));
+}
+
+HostTimestamp ClockSync::to_host(uint64_t device_ticks) const
+{
+    HostTimestamp timestamp;
+    std::shared_ptr<const Model> current_model = std::atomic_load(&model);
+    if (!current_model)
+        return timestamp;
+
+    double ticks = static_cast<double>(static_cast<int64_t>(device_ticks - current_model->reference_ticks));
+    timestamp.ns = current_model->reference_host_ns + std::llround(ticks * current_model->ns_per_tick);
+    timestamp.uncertainty_ns = current_model->uncertainty_ns;
+    return timestamp;
+}
+
+double ClockSync::get_ns_per_tick() const
+{
+    std::shared_ptr<const Model> current_model = std::atomic_load(&model);
+    return current_model ? current_model->ns_per_tick : 0.0;
+}
+
+ClockSampler::ClockSampler(SampleFunction sample, ClockSync& clock_sync, uint32_t interval_ms)
+    : sample(std::move(sample))
+    , clock_sync(clock_sync)
+    , interval_ms(interval_ms)
+    , stopping(false)
+{
+    thread = std::thread(&ClockSampler::run, this);
+}
+
+ClockSampler::~ClockSampler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    thread.join();
+}
+
+void ClockSampler::run()
+{
+    int attempts = 0;
+    bool error_printed = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        lock.unlock();
+        ClockSample clock_sample;
+        if (sample(clock_sample))
+        {
+            clock_sync.add_sample(clock_sample);
+        }
+        else if (!error_printed)
+        {
+            std::cerr << "ClockSampler: failed to sample the device clock" << std::endl;
+            error_printed = true;
+        }
+        lock.lock();
+
+        uint32_t wait_ms = ++attempts < INITIAL_SAMPLES ? INITIAL_INTERVAL_MS : interval_ms;
+        stop_cv.wait_for(lock, std::chrono::milliseconds(wait_ms), [this] { return stopping; });
+    }
+}
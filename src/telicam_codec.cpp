@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "telicam_codec.hpp"
+
+static const uint32_t CODEC_MAGIC = 0x4B424354; // "TCBK"
+static const uint16_t CODEC_VERSION = 1;
+static const int BLOCK_SIZE = 16;
+
+namespace
+{
+struct CodecHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slices;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rows_per_slice;
+    // Followed by one uint32_t compressed size per slice, then the slices
+};
+
+/**
+ * @brief Bytes 0 or 1 for each of the 8 bits of an index, so that a 16-bit plane mask expands to 16 residual bits
+ * with two lookups.
+ */
+struct BitExpansionTable
+{
+    uint64_t values[256];
+
+    BitExpansionTable()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            values[i] = 0;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                values[i] |= static_cast<uint64_t>((i >> bit) & 1) << (8 * bit);
+            }
+        }
+    }
+};
+
+const BitExpansionTable BIT_EXPANSION;
+
+size_t row_bound(uint32_t width)
+{
+    size_t blocks = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    return (blocks + 1) / 2 + blocks * 2 * 8;
+}
+
+uint32_t rows_per_slice(uint32_t height, uint32_t slices)
+{
+    // Even, so that every slice starts on the same Bayer phase
+    uint32_t rows = (height + slices - 1) / slices;
+    return std::max<uint32_t>((rows + 1) & ~1u, 2);
+}
+
+inline uint8_t med_predict(uint8_t a, uint8_t b, uint8_t c)
+{
+    uint8_t low = std::min(a, b);
+    uint8_t high = std::max(a, b);
+    if (c >= high)
+        return low;
+    if (c <= low)
+        return high;
+    return static_cast<uint8_t>(a + b - c);
+}
+
+inline uint8_t zigzag(uint8_t residual)
+{
+    return static_cast<uint8_t>((residual << 1) ^ (static_cast<int8_t>(residual) >> 7));
+}
+
+inline uint8_t unzigzag(uint8_t value)
+{
+    return static_cast<uint8_t>((value >> 1) ^ -(value & 1));
+}
+
+/**
+ * @brief Same-color prediction of one pixel at a slice or frame edge.
+ */
+inline uint8_t edge_predict(const uint8_t* row, const uint8_t* up, int x)
+{
+    if (up)
+        return x >= 2 ? med_predict(row[x - 2], up[x], up[x - 2]) : up[x];
+    return x >= 2 ? row[x - 2] : 0;
+}
+
+/**
+ * @brief Zigzag coded prediction residuals of one row. up is the row two above, or null for the first two rows of a
+ * slice.
+ */
+void encode_residuals(const uint8_t* row, const uint8_t* up, int width, uint8_t* residuals)
+{
+    int x = 0;
+    int interior_start = up ? std::min(2, width) : width;
+    for (; x < interior_start; ++x)
+    {
+        residuals[x] = zigzag(static_cast<uint8_t>(row[x] - edge_predict(row, up, x)));
+    }
+
+#if CV_SIMD128
+    const cv::v_int8x16 zero = cv::v_setzero_s8();
+    for (; x + BLOCK_SIZE <= width; x += BLOCK_SIZE)
+    {
+        cv::v_uint8x16 a = cv::v_load(row + x - 2);
+        cv::v_uint8x16 b = cv::v_load(up + x);
+        cv::v_uint8x16 c = cv::v_load(up + x - 2);
+        cv::v_uint8x16 current = cv::v_load(row + x);
+
+        // MED without widening: max(high - (c - low), low) with saturating arithmetic
+        cv::v_uint8x16 low = cv::v_min(a, b);
+        cv::v_uint8x16 high = cv::v_max(a, b);
+        cv::v_uint8x16 prediction = cv::v_max(high - (c - low), low);
+
+        cv::v_uint8x16 residual = cv::v_sub_wrap(current, prediction);
+        cv::v_uint8x16 sign = cv::v_reinterpret_as_u8(cv::v_reinterpret_as_s8(residual) < zero);
+        cv::v_store(residuals + x, cv::v_add_wrap(residual, residual) ^ sign);
+    }
+#endif
+
+    for (; x < width; ++x)
+    {
+        residuals[x] = zigzag(static_cast<uint8_t>(row[x] - med_predict(row[x - 2], up[x], up[x - 2])));
+    }
+}
+
+/**
+ * @brief Bit-pack a row of residuals, padded with zeros to a whole number of blocks. Returns the bytes written.
+ */
+size_t pack_row(const uint8_t* residuals, int width, uint8_t* out)
+{
+    int blocks = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint8_t* widths = out;
+    uint8_t* data = out + (blocks + 1) / 2;
+    std::memset(widths, 0, (blocks + 1) / 2);
+
+    for (int block = 0; block < blocks; ++block, residuals += BLOCK_SIZE)
+    {
+        uint16_t planes[8];
+#if CV_SIMD128
+        cv::v_uint8x16 values = cv::v_load(residuals);
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            cv::v_uint8x16 mask = cv::v_setall_u8(static_cast<uint8_t>(1 << bit));
+            planes[bit] = static_cast<uint16_t>(cv::v_signmask((values & mask) == mask));
+        }
+#else
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            uint16_t plane = 0;
+            for (int i = 0; i < BLOCK_SIZE; ++i)
+            {
+                plane |= static_cast<uint16_t>(((residuals[i] >> bit) & 1) << i);
+            }
+            planes[bit] = plane;
+        }
+#endif
+
+        int bits = 8;
+        while (bits > 0 && planes[bits - 1] == 0)
+        {
+            bits--;
+        }
+        widths[block / 2] |= static_cast<uint8_t>(bits << (4 * (block & 1)));
+
+        for (int bit = 0; bit < bits; ++bit)
+        {
+            *data++ = static_cast<uint8_t>(planes[bit]);
+            *data++ = static_cast<uint8_t>(planes[bit] >> 8);
+        }
+    }
+
+    return data - out;
+}
+
+/**
+ * @brief Unpack a row of residuals. Returns the bytes read, or 0 if the row runs past the end of the input.
+ */
+size_t unpack_row(const uint8_t* in, size_t available, int width, uint8_t* residuals)
+{
+    int blocks = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t header_size = (blocks + 1) / 2;
+    if (available < header_size)
+        return 0;
+
+    const uint8_t* widths = in;
+    const uint8_t* data = in + header_size;
+    const uint8_t* end = in + available;
+
+    for (int block = 0; block < blocks; ++block, residuals += BLOCK_SIZE)
+    {
+        int bits = (widths[block / 2] >> (4 * (block & 1))) & 0xF;
+        if (bits > 8 || end - data < 2 * bits)
+            return 0;
+
+        uint64_t low = 0;
+        uint64_t high = 0;
+        for (int bit = 0; bit < bits; ++bit, data += 2)
+        {
+            low |= BIT_EXPANSION.values[data[0]] << bit;
+            high |= BIT_EXPANSION.values[data[1]] << bit;
+        }
+        std::memcpy(residuals, &low, 8);
+        std::memcpy(residuals + 8, &high, 8);
+    }
+
+    return data - in;
+}
+
+/**
+ * @brief Compress rows [first_row, last_row) into out. Returns the bytes written.
+ */
+size_t compress_slice(const cv::Mat& bayer, int first_row, int last_row, uint8_t* out)
+{
+    std::vector<uint8_t> residuals(bayer.cols + BLOCK_SIZE, 0);
+    uint8_t* start = out;
+
+    for (int y = first_row; y < last_row; ++y)
+    {
+        const uint8_t* up = y - first_row >= 2 ? bayer.ptr<uint8_t>(y - 2) : nullptr;
+        encode_residuals(bayer.ptr<uint8_t>(y), up, bayer.cols, residuals.data());
+        out += pack_row(residuals.data(), bayer.cols, out);
+    }
+
+    return out - start;
+}
+
+/**
+ * @brief Decompress rows [first_row, last_row). Returns false if the slice is truncated or malformed.
+ */
+bool decompress_slice(const uint8_t* in, size_t size, int first_row, int last_row, cv::Mat& bayer)
+{
+    std::vector<uint8_t> residuals(bayer.cols + BLOCK_SIZE);
+    const uint8_t* end = in + size;
+
+    for (int y = first_row; y < last_row; ++y)
+    {
+        size_t consumed = unpack_row(in, end - in, bayer.cols, residuals.data());
+        if (consumed == 0)
+            return false;
+        in += consumed;
+
+        // Each pixel depends on the one two to its left, so reconstruction is sequential within a row
+        uint8_t* row = bayer.ptr<uint8_t>(y);
+        const uint8_t* up = y - first_row >= 2 ? bayer.ptr<uint8_t>(y - 2) : nullptr;
+        int x = 0;
+        int interior_start = up ? std::min(2, bayer.cols) : bayer.cols;
+        for (; x < interior_start; ++x)
+        {
+            row[x] = static_cast<uint8_t>(edge_predict(row, up, x) + unzigzag(residuals[x]));
+        }
+        for (; x < bayer.cols; ++x)
+        {
+            row[x] = static_cast<uint8_t>(med_predict(row[x - 2], up[x], up[x - 2]) + unzigzag(residuals[x]));
+        }
+    }
+    return true;
+}
+} // namespace
+
+size_t bayer_compress_bound(uint32_t width, uint32_t height, uint32_t slices)
+{
+    slices = std::max<uint32_t>(slices, 1);
+    uint32_t rows = rows_per_slice(height, slices);
+    uint32_t used_slices = (height + rows - 1) / rows;
+    return sizeof(CodecHeader) + used_slices * sizeof(uint32_t) + used_slices * rows * row_bound(width);
+}
+
+size_t compress_bayer(const cv::Mat& bayer, std::vector<uint8_t>& buffer, const BayerCodecOptions& options)
+{
+    CV_Assert(bayer.type() == CV_8UC1);
+
+    uint32_t width = bayer.cols;
+    uint32_t height = bayer.rows;
+    uint32_t requested_slices = options.slices > 0 ? options.slices : static_cast<uint32_t>(cv::getNumThreads());
+    uint32_t rows = rows_per_slice(height, std::max<uint32_t>(requested_slices, 1));
+    uint32_t slices = (height + rows - 1) / rows;
+    if (slices > UINT16_MAX)
+    {
+        throw std::runtime_error("compress_bayer: too many slices");
+    }
+
+    size_t bound = bayer_compress_bound(width, height, std::max<uint32_t>(requested_slices, 1));
+    if (buffer.size() < bound)
+    {
+        buffer.resize(bound);
+    }
+
+    CodecHeader header;
+    header.magic = CODEC_MAGIC;
+    header.version = CODEC_VERSION;
+    header.slices = static_cast<uint16_t>(slices);
+    header.width = width;
+    header.height = height;
+    header.rows_per_slice = rows;
+    std::memcpy(buffer.data(), &header, sizeof(header));
+
+    // Each slice is written at its worst-case offset, then the slices are moved together
+    uint8_t* sizes = buffer.data() + sizeof(header);
+    uint8_t* payload = sizes + slices * sizeof(uint32_t);
+    size_t slice_bound = rows * row_bound(width);
+    std::vector<uint32_t> slice_sizes(slices);
+
+    cv::parallel_for_(cv::Range(0, slices), [&](const cv::Range& range) {
+        for (int slice = range.start; slice < range.end; ++slice)
+        {
+            int first_row = slice * rows;
+            int last_row = std::min<int>(first_row + rows, height);
+            slice_sizes[slice] = static_cast<uint32_t>(
+                compress_slice(bayer, first_row, last_row, payload + slice * slice_bound));
+        }
+    });
+
+    std::memcpy(sizes, slice_sizes.data(), slices * sizeof(uint32_t));
+    size_t offset = 0;
+    for (uint32_t slice = 0; slice < slices; ++slice)
+    {
+        if (offset != slice * slice_bound)
+        {
+            std::memmove(payload + offset, payload + slice * slice_bound, slice_sizes[slice]);
+        }
+        offset += slice_sizes[slice];
+    }
+
+    return payload + offset - buffer.data();
+}
+
+void decompress_bayer(const uint8_t* data, size_t size, cv::Mat& bayer)
+{
+    CodecHeader header;
+    if (size < sizeof(header))
+    {
+        throw std::runtime_error("decompress_bayer: truncated header");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != CODEC_MAGIC || header.version != CODEC_VERSION)
+    {
+        throw std::runtime_error("decompress_bayer: not a compressed Bayer frame");
+    }
+    uint32_t expected_slices =
+        header.rows_per_slice > 0 ? (header.height + header.rows_per_slice - 1) / header.rows_per_slice : 0;
+    if (header.rows_per_slice == 0 || header.slices != expected_slices)
+    {
+        throw std::runtime_error("decompress_bayer: inconsistent slices");
+    }
+
+    size_t table_end = sizeof(header) + header.slices * sizeof(uint32_t);
+    if (size < table_end)
+    {
+        throw std::runtime_error("decompress_bayer: truncated slice table");
+    }
+
+    std::vector<uint32_t> slice_sizes(header.slices);
+    std::memcpy(slice_sizes.data(), data + sizeof(header), header.slices * sizeof(uint32_t));
+    std::vector<size_t> offsets(header.slices);
+    size_t offset = table_end;
+    for (uint32_t slice = 0; slice < header.slices; ++slice)
+    {
+        offsets[slice] = offset;
+        offset += slice_sizes[slice];
+    }
+    if (offset > size)
+    {
+        throw std::runtime_error("decompress_bayer: truncated frame");
+    }
+
+    bayer.create(header.height, header.width, CV_8UC1);
+    std::atomic<bool> malformed(false);
+    cv::parallel_for_(cv::Range(0, header.slices), [&](const cv::Range& range) {
+        for (int slice = range.start; slice < range.end; ++slice)
+        {
+            int first_row = slice * header.rows_per_slice;
+            int last_row = std::min<int>(first_row + header.rows_per_slice, header.height);
+            if (!decompress_slice(data + offsets[slice], slice_sizes[slice], first_row, last_row, bayer))
+            {
+                malformed = true;
+            }
+        }
+    });
+
+    if (malformed)
+    {
+        throw std::runtime_error("decompress_bayer: truncated slice");
+    }
+}
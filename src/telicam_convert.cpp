@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <TeliCamApi.h>
+#include <TeliCamUtl.h>
+
+#include "telicam_convert.hpp"
+
+namespace
+{
+/**
+ * @brief Sample layouts. Those of more than 8 bits reduce a run of samples, starting on a group boundary, to their 8
+ * most significant bits.
+ */
+struct Unpacked8
+{
+    static const int bits = 8;
+    static const int pixels_per_group = 1;
+    static const int bytes_per_group = 1;
+};
+
+/**
+ * @brief 10 or 12-bit samples in the low bits of little-endian 16-bit words.
+ */
+template <int Bits>
+struct Unpacked16
+{
+    static const int bits = Bits;
+    static const int pixels_per_group = 1;
+    static const int bytes_per_group = 2;
+
+    static void unpack_row(const uint8_t* src, uint8_t* dst, int count)
+    {
+        const int shift = Bits - 8;
+        int i = 0;
+#if CV_SIMD
+        const int lanes = cv::v_uint8::nlanes;
+        const uint16_t* samples = reinterpret_cast<const uint16_t*>(src);
+        for (; i + lanes <= count; i += lanes)
+        {
+            // Samples above the format's range saturate rather than wrap
+            cv::v_uint16 low = cv::vx_load(samples + i) >> shift;
+            cv::v_uint16 high = cv::vx_load(samples + i + lanes / 2) >> shift;
+            cv::v_store(dst + i, cv::v_pack(low, high));
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            int sample = src[2 * i] | (src[2 * i + 1] << 8);
+            dst[i] = static_cast<uint8_t>(std::min(sample >> shift, 255));
+        }
+    }
+};
+
+/**
+ * @brief PFNC 10p: 4 pixels in 5 bytes, least significant bit first.
+ */
+struct Packed10
+{
+    static const int bits = 10;
+    static const int pixels_per_group = 4;
+    static const int bytes_per_group = 5;
+
+    static void unpack_group(const uint8_t* src, uint8_t* dst, int count)
+    {
+        const uint8_t pixels[4] = {static_cast<uint8_t>((src[0] >> 2) | (src[1] << 6)),
+                                   static_cast<uint8_t>((src[1] >> 4) | (src[2] << 4)),
+                                   static_cast<uint8_t>((src[2] >> 6) | (src[3] << 2)), src[4]};
+        std::copy(pixels, pixels + count, dst);
+    }
+
+    static void unpack_row(const uint8_t* src, uint8_t* dst, int count)
+    {
+        int i = 0;
+#if CV_SIMD
+        // Universal intrinsics have no 5-byte deinterleave, so every lane gathers the two bytes its sample straddles.
+        // The sample's 8 most significant bits start 2, 4, 6 or 8 bits into the pair, and a wrapping multiply by
+        // 64, 16, 4 or 1 moves them to its high byte.
+        const int lanes = cv::v_uint8::nlanes;
+        int low_bytes[lanes];
+        int high_bytes[lanes];
+        for (int j = 0; j < lanes; ++j)
+        {
+            low_bytes[j] = j / pixels_per_group * bytes_per_group + j % pixels_per_group;
+            high_bytes[j] = low_bytes[j] + 1;
+        }
+        uint16_t multipliers[lanes / 2];
+        for (int j = 0; j < lanes / 2; ++j)
+        {
+            multipliers[j] = static_cast<uint16_t>(1 << (6 - 2 * (j % pixels_per_group)));
+        }
+        const cv::v_uint16 multiplier = cv::vx_load(multipliers);
+
+        for (; i + lanes <= count; i += lanes, src += lanes / pixels_per_group * bytes_per_group)
+        {
+            cv::v_uint16 low0, low1, high0, high1;
+            cv::v_expand(cv::vx_lut(src, low_bytes), low0, low1);
+            cv::v_expand(cv::vx_lut(src, high_bytes), high0, high1);
+            cv::v_uint16 pixels0 = cv::v_mul_wrap(low0 | (high0 << 8), multiplier) >> 8;
+            cv::v_uint16 pixels1 = cv::v_mul_wrap(low1 | (high1 << 8), multiplier) >> 8;
+            cv::v_store(dst + i, cv::v_pack(pixels0, pixels1));
+        }
+#endif
+        // Whole groups are unpacked from one 64-bit load. The load reads into the next group, which is why the last
+        // group is unpacked on its own.
+        for (; i + 2 * pixels_per_group <= count; i += pixels_per_group, src += bytes_per_group)
+        {
+            uint64_t group;
+            std::memcpy(&group, src, sizeof(group));
+            dst[i] = static_cast<uint8_t>(group >> 2);
+            dst[i + 1] = static_cast<uint8_t>(group >> 12);
+            dst[i + 2] = static_cast<uint8_t>(group >> 22);
+            dst[i + 3] = static_cast<uint8_t>(group >> 32);
+        }
+        for (; i < count; i += pixels_per_group, src += bytes_per_group)
+        {
+            unpack_group(src, dst + i, std::min(pixels_per_group, count - i));
+        }
+    }
+};
+
+/**
+ * @brief PFNC 12p: 2 pixels in 3 bytes, least significant bit first.
+ */
+struct Packed12
+{
+    static const int bits = 12;
+    static const int pixels_per_group = 2;
+    static const int bytes_per_group = 3;
+
+    static void unpack_group(const uint8_t* src, uint8_t* dst, int count)
+    {
+        dst[0] = static_cast<uint8_t>((src[0] >> 4) | (src[1] << 4));
+        if (count > 1)
+        {
+            dst[1] = src[2];
+        }
+    }
+
+    static void unpack_row(const uint8_t* src, uint8_t* dst, int count)
+    {
+        int i = 0;
+#if CV_SIMD
+        const int lanes = cv::v_uint8::nlanes;
+        const cv::v_uint16 low_byte = cv::v_setall_u16(0xFF);
+        for (; i + 2 * lanes <= count; i += 2 * lanes, src += 3 * lanes)
+        {
+            cv::v_uint8 byte0, byte1, byte2;
+            cv::v_load_deinterleave(src, byte0, byte1, byte2);
+
+            // The first pixel of a group is the high nibble of its first byte and the low nibble of its second
+            cv::v_uint16 byte0_low, byte0_high, byte1_low, byte1_high;
+            cv::v_expand(byte0, byte0_low, byte0_high);
+            cv::v_expand(byte1, byte1_low, byte1_high);
+            cv::v_uint16 first_low = ((byte0_low | (byte1_low << 8)) >> 4) & low_byte;
+            cv::v_uint16 first_high = ((byte0_high | (byte1_high << 8)) >> 4) & low_byte;
+
+            // The second is the third byte
+            cv::v_store_interleave(dst + i, cv::v_pack(first_low, first_high), byte2);
+        }
+#endif
+        for (; i < count; i += pixels_per_group, src += bytes_per_group)
+        {
+            unpack_group(src, dst + i, std::min(pixels_per_group, count - i));
+        }
+    }
+};
+
+/**
+ * @brief The frame's samples in rect, as 8 bits. 8-bit frames are used in place.
+ */
+template <typename Layout>
+cv::Mat unpack(const RawFrame& raw, const cv::Rect& rect, cv::Mat& unpacked)
+{
+    size_t stride = static_cast<size_t>(raw.width / Layout::pixels_per_group) * Layout::bytes_per_group;
+    if (raw.width % Layout::pixels_per_group != 0 || raw.size < stride * raw.height)
+    {
+        throw std::runtime_error("convert: frame size does not match its pixel format");
+    }
+
+    if constexpr (Layout::bits == 8)
+    {
+        return cv::Mat(raw.height, raw.width, CV_8UC1, const_cast<uint8_t*>(raw.data), stride)(rect);
+    }
+    else
+    {
+        // Unpacking starts on the group that holds the first column
+        int x0 = rect.x - rect.x % Layout::pixels_per_group;
+        int width = rect.x + rect.width - x0;
+        unpacked.create(rect.height, width, CV_8UC1);
+
+        const uint8_t* src = raw.data + rect.y * stride + x0 / Layout::pixels_per_group * Layout::bytes_per_group;
+        for (int y = 0; y < rect.height; ++y, src += stride)
+        {
+            Layout::unpack_row(src, unpacked.ptr<uint8_t>(y), width);
+        }
+        return unpacked(cv::Rect(rect.x - x0, 0, rect.width, rect.height));
+    }
+}
+
+template <typename Layout, int color_code>
+void convert_frame(const RawFrame& raw, cv::Mat& dst, ConversionScratch& scratch)
+{
+    cv::Mat samples = unpack<Layout>(raw, cv::Rect(0, 0, raw.width, raw.height), scratch.unpacked);
+    cv::cvtColor(samples, dst, color_code);
+}
+
+template <typename Layout, int color_code>
+void convert_frame_region(const RawFrame& raw, const cv::Rect& region, cv::Mat& dst, ConversionScratch& scratch)
+{
+    if constexpr (color_code == cv::COLOR_GRAY2BGR)
+    {
+        cv::Mat samples = unpack<Layout>(raw, region, scratch.unpacked);
+        cv::cvtColor(samples, dst, color_code);
+    }
+    else
+    {
+        // Demosaic with a margin, so that the region's edge pixels see their real neighbours. The margin starts on an
+        // even row and column so that the Bayer pattern is unchanged.
+        const int margin = 2;
+        int x0 = std::max(region.x - margin, 0) & ~1;
+        int y0 = std::max(region.y - margin, 0) & ~1;
+        int x1 = std::min(region.x + region.width + margin, static_cast<int>(raw.width));
+        int y1 = std::min(region.y + region.height + margin, static_cast<int>(raw.height));
+        cv::Mat samples = unpack<Layout>(raw, cv::Rect(x0, y0, x1 - x0, y1 - y0), scratch.unpacked);
+        cv::cvtColor(samples, scratch.converted, color_code);
+        scratch.converted(cv::Rect(region.x - x0, region.y - y0, region.width, region.height)).copyTo(dst);
+    }
+}
+
+void convert_with_sdk(const RawFrame& raw, cv::Mat& dst, ConversionScratch& scratch)
+{
+    // ConvImage has no destination stride, so rows padded for alignment go through a contiguous scratch buffer
+    cv::Mat& target = dst.isContinuous() ? dst : scratch.converted;
+    target.create(dst.size(), CV_8UC3);
+
+    Teli::ConvImage(Teli::DST_FMT_BGR24, raw.pixel_format, true, target.data, const_cast<uint8_t*>(raw.data),
+                    raw.width, raw.height);
+
+    if (!dst.isContinuous())
+    {
+        scratch.converted.copyTo(dst);
+    }
+}
+
+template <typename Layout, int color_code>
+FrameConverter make_converter(uint32_t format)
+{
+    FrameConverter converter;
+    converter.pixel_format = format;
+    converter.convert = &convert_frame<Layout, color_code>;
+    converter.convert_region = &convert_frame_region<Layout, color_code>;
+    return converter;
+}
+} // namespace
+
+FrameConverter select_frame_converter(uint32_t format)
+{
+    // OpenCV names Bayer patterns after the second row, so a PFNC RG pattern is OpenCV's BG
+    switch (format)
+    {
+    case pixel_format::MONO8:
+        return make_converter<Unpacked8, cv::COLOR_GRAY2BGR>(format);
+    case pixel_format::MONO10:
+        return make_converter<Unpacked16<10>, cv::COLOR_GRAY2BGR>(format);
+    case pixel_format::MONO12:
+        return make_converter<Unpacked16<12>, cv::COLOR_GRAY2BGR>(format);
+    case pixel_format::MONO10P:
+        return make_converter<Packed10, cv::COLOR_GRAY2BGR>(format);
+    case pixel_format::MONO12P:
+        return make_converter<Packed12, cv::COLOR_GRAY2BGR>(format);
+
+    case pixel_format::BAYER_RG8:
+        return make_converter<Unpacked8, cv::COLOR_BayerBG2BGR>(format);
+    case pixel_format::BAYER_BG8:
+        return make_converter<Unpacked8, cv::COLOR_BayerRG2BGR>(format);
+    case pixel_format::BAYER_GR8:
+        return make_converter<Unpacked8, cv::COLOR_BayerGB2BGR>(format);
+    case pixel_format::BAYER_GB8:
+        return make_converter<Unpacked8, cv::COLOR_BayerGR2BGR>(format);
+
+    case pixel_format::BAYER_RG10:
+        return make_converter<Unpacked16<10>, cv::COLOR_BayerBG2BGR>(format);
+    case pixel_format::BAYER_BG10:
+        return make_converter<Unpacked16<10>, cv::COLOR_BayerRG2BGR>(format);
+    case pixel_format::BAYER_GR10:
+        return make_converter<Unpacked16<10>, cv::COLOR_BayerGB2BGR>(format);
+    case pixel_format::BAYER_GB10:
+        return make_converter<Unpacked16<10>, cv::COLOR_BayerGR2BGR>(format);
+
+    case pixel_format::BAYER_RG12:
+        return make_converter<Unpacked16<12>, cv::COLOR_BayerBG2BGR>(format);
+    case pixel_format::BAYER_BG12:
+        return make_converter<Unpacked16<12>, cv::COLOR_BayerRG2BGR>(format);
+    case pixel_format::BAYER_GR12:
+        return make_converter<Unpacked16<12>, cv::COLOR_BayerGB2BGR>(format);
+    case pixel_format::BAYER_GB12:
+        return make_converter<Unpacked16<12>, cv::COLOR_BayerGR2BGR>(format);
+
+    case pixel_format::BAYER_RG10P:
+        return make_converter<Packed10, cv::COLOR_BayerBG2BGR>(format);
+    case pixel_format::BAYER_BG10P:
+        return make_converter<Packed10, cv::COLOR_BayerRG2BGR>(format);
+    case pixel_format::BAYER_GR10P:
+        return make_converter<Packed10, cv::COLOR_BayerGB2BGR>(format);
+    case pixel_format::BAYER_GB10P:
+        return make_converter<Packed10, cv::COLOR_BayerGR2BGR>(format);
+
+    case pixel_format::BAYER_RG12P:
+        return make_converter<Packed12, cv::COLOR_BayerBG2BGR>(format);
+    case pixel_format::BAYER_BG12P:
+        return make_converter<Packed12, cv::COLOR_BayerRG2BGR>(format);
+    case pixel_format::BAYER_GR12P:
+        return make_converter<Packed12, cv::COLOR_BayerGB2BGR>(format);
+    case pixel_format::BAYER_GB12P:
+        return make_converter<Packed12, cv::COLOR_BayerGR2BGR>(format);
+
+    default: {
+        FrameConverter converter;
+        converter.pixel_format = format;
+        converter.convert = &convert_with_sdk;
+        return converter;
+    }
+    }
+}
+
+void convert_to_bgr(const RawFrame& raw, cv::Mat& dst, ConversionScratch& scratch)
+{
+    select_frame_converter(raw.pixel_format).convert(raw, dst, scratch);
+}
+
+bool can_convert_region(uint32_t format)
+{
+    return select_frame_converter(format).convert_region != nullptr;
+}
+
+void convert_region_to_bgr(const RawFrame& raw, const cv::Rect& region, cv::Mat& dst, ConversionScratch& scratch)
+{
+    FrameConverter converter = select_frame_converter(raw.pixel_format);
+    if (!converter.convert_region)
+    {
+        throw std::runtime_error("convert_region_to_bgr: unsupported pixel format");
+    }
+    converter.convert_region(raw, region, dst, scratch);
+}
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "telicam_denoise.hpp"
+
+namespace
+{
+/**
+ * @brief Filter count consecutive samples of a row and update their averages.
+ */
+void denoise_samples(uint8_t* row, uint16_t* average, int count, int shift, int threshold)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int value = row[i];
+        int difference = std::abs(value - (average[i] >> 8));
+        if (difference > 2 * threshold)
+        {
+            average[i] = static_cast<uint16_t>(value << 8);
+        }
+        else if (difference > threshold)
+        {
+            average[i] = static_cast<uint16_t>(average[i] - (average[i] >> 1) + (value << 7));
+        }
+        else
+        {
+            average[i] = static_cast<uint16_t>(average[i] - (average[i] >> shift) + (value << (8 - shift)));
+        }
+        row[i] = static_cast<uint8_t>((average[i] + 128) >> 8);
+    }
+}
+
+#if CV_SIMD
+void denoise_row(uint8_t* row, uint16_t* average, int count, int shift, int threshold)
+{
+    const int lanes = cv::v_uint8::nlanes;
+    const cv::v_uint16 moving = cv::v_setall_u16(static_cast<uint16_t>(threshold));
+    const cv::v_uint16 restart = cv::v_setall_u16(static_cast<uint16_t>(2 * threshold));
+    const cv::v_uint16 half = cv::v_setall_u16(128);
+
+    int i = 0;
+    for (; i + lanes <= count; i += lanes)
+    {
+        cv::v_uint8 value = cv::vx_load(row + i);
+        cv::v_uint16 average0 = cv::vx_load(average + i);
+        cv::v_uint16 average1 = cv::vx_load(average + i + lanes / 2);
+
+        cv::v_uint16 difference0, difference1;
+        cv::v_expand(cv::v_absdiff(value, cv::v_pack(average0 >> 8, average1 >> 8)), difference0, difference1);
+        cv::v_uint16 value0, value1;
+        cv::v_expand(value, value0, value1);
+
+        // All three updates are computed, and each lane keeps the one its difference calls for
+        cv::v_uint16 blended0 = average0 - (average0 >> shift) + (value0 << (8 - shift));
+        cv::v_uint16 blended1 = average1 - (average1 >> shift) + (value1 << (8 - shift));
+        cv::v_uint16 halfway0 = average0 - (average0 >> 1) + (value0 << 7);
+        cv::v_uint16 halfway1 = average1 - (average1 >> 1) + (value1 << 7);
+        average0 = cv::v_select(difference0 > restart, value0 << 8,
+                                cv::v_select(difference0 > moving, halfway0, blended0));
+        average1 = cv::v_select(difference1 > restart, value1 << 8,
+                                cv::v_select(difference1 > moving, halfway1, blended1));
+
+        cv::v_store(average + i, average0);
+        cv::v_store(average + i + lanes / 2, average1);
+        cv::v_store(row + i, cv::v_pack((average0 + half) >> 8, (average1 + half) >> 8));
+    }
+
+    if (i < count)
+    {
+        denoise_samples(row + i, average + i, count - i, shift, threshold);
+    }
+}
+#else
+void denoise_row(uint8_t* row, uint16_t* average, int count, int shift, int threshold)
+{
+    denoise_samples(row, average, count, shift, threshold);
+}
+#endif
+} // namespace
+
+TemporalDenoiser::TemporalDenoiser(const DenoiseOptions& options)
+    : options(options)
+{
+    this->options.strength = std::min<uint32_t>(std::max<uint32_t>(options.strength, 1), 7);
+}
+
+void TemporalDenoiser::apply(cv::Mat& frame, const std::vector<cv::Rect>& rects)
+{
+    CV_Assert(frame.type() == CV_8UC1 || frame.type() == CV_8UC3);
+
+    cv::Rect whole_frame(0, 0, frame.cols, frame.rows);
+    const cv::Rect* regions = rects.empty() ? &whole_frame : rects.data();
+    const cv::Rect* regions_end = rects.empty() ? &whole_frame + 1 : rects.data() + rects.size();
+
+    int channels = frame.channels();
+    if (accumulator.rows != frame.rows || accumulator.cols != frame.cols || accumulator.channels() != channels)
+    {
+        // Seed the average with the frame itself
+        accumulator.create(frame.size(), CV_16UC(channels));
+        for (const cv::Rect* rect = regions; rect != regions_end; ++rect)
+        {
+            cv::Mat seed = accumulator(*rect);
+            frame(*rect).convertTo(seed, CV_16U, 256.0);
+        }
+        return;
+    }
+
+    int shift = static_cast<int>(options.strength);
+    int threshold = options.motion_threshold;
+    for (const cv::Rect* region = regions; region != regions_end; ++region)
+    {
+        const cv::Rect& rect = *region;
+
+        // Bands of rows are independent, so large frames are filtered on all cores
+        cv::parallel_for_(cv::Range(rect.y, rect.y + rect.height), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; ++y)
+            {
+                uint8_t* row = frame.ptr<uint8_t>(y) + rect.x * channels;
+                uint16_t* average = accumulator.ptr<uint16_t>(y) + rect.x * channels;
+                denoise_row(row, average, rect.width * channels, shift, threshold);
+            }
+        });
+    }
+}
+
+void TemporalDenoiser::reset()
+{
+    accumulator.release();
+}
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "telicam_exposure.hpp"
+#include "telicam_timing.hpp"
+
+// Brightness factor applied when too many pixels are clipped, since the mean underestimates clipped scenes
+static const double SATURATED_STEP = 0.7;
+
+struct AutoExposureController::Mailbox
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::shared_ptr<const FrameStatistics> statistics; // Latest unevaluated statistics, older ones are dropped
+    uint64_t frame_id = 0;
+    bool stopping = false;
+};
+
+static double db_to_linear(double db)
+{
+    return std::pow(10.0, db / 20.0);
+}
+
+static double linear_to_db(double linear)
+{
+    return 20.0 * std::log10(linear);
+}
+
+static double mean_luma(const FrameStatistics& statistics)
+{
+    if (statistics.sampled_pixels == 0)
+        return 0.0;
+
+    double sum = 0.0;
+    for (size_t bin = 0; bin < statistics.luma_histogram.size(); ++bin)
+    {
+        sum += static_cast<double>(bin) * statistics.luma_histogram[bin];
+    }
+    return sum / statistics.sampled_pixels;
+}
+
+AutoExposureController::AutoExposureController(TeliCam& cam, const Options& options)
+    : cam(cam)
+    , options(options)
+    , mailbox(std::make_shared<Mailbox>())
+    , settle_until_frame_id(0)
+    , last_update_ns(0)
+    , error_printed(false)
+{
+    TeliCam::Parameters parameters = cam.get_parameters();
+    if (!parameters.compute_statistics)
+    {
+        throw std::runtime_error("AutoExposureController requires compute_statistics");
+    }
+
+    min_exposure_time = std::max(options.min_exposure_time, cam.get_min_exposure_time());
+    max_exposure_time = cam.get_max_exposure_time();
+    if (options.max_exposure_time > 0.0)
+    {
+        max_exposure_time = std::min(max_exposure_time, options.max_exposure_time);
+    }
+    if (options.max_exposure_time <= 0.0 && parameters.framerate > 0.0)
+    {
+        max_exposure_time = std::min(max_exposure_time, 1e6 / parameters.framerate);
+    }
+    min_gain = cam.get_min_gain();
+    max_gain = options.max_gain > 0.0 ? std::min(options.max_gain, cam.get_max_gain()) : cam.get_max_gain();
+
+    state.exposure_time = parameters.exposure_time;
+    state.gain = parameters.gain;
+
+    thread = std::thread(&AutoExposureController::run, this);
+
+    std::shared_ptr<Mailbox> shared_mailbox = mailbox;
+    listener_id = cam.add_frame_listener([shared_mailbox](const Frame& frame) {
+        if (!frame.metadata.statistics)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(shared_mailbox->mutex);
+            shared_mailbox->statistics = frame.metadata.statistics;
+            shared_mailbox->frame_id = frame.metadata.frame_id;
+        }
+        shared_mailbox->cv.notify_one();
+    });
+}
+
+AutoExposureController::~AutoExposureController()
+{
+    cam.remove_frame_listener(listener_id);
+    {
+        std::lock_guard<std::mutex> lock(mailbox->mutex);
+        mailbox->stopping = true;
+    }
+    mailbox->cv.notify_one();
+    thread.join();
+}
+
+AutoExposureController::State AutoExposureController::get_state() const
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return state;
+}
+
+void AutoExposureController::run()
+{
+    while (true)
+    {
+        std::shared_ptr<const FrameStatistics> statistics;
+        uint64_t frame_id;
+        {
+            std::unique_lock<std::mutex> lock(mailbox->mutex);
+            mailbox->cv.wait(lock, [this] { return mailbox->stopping || mailbox->statistics; });
+            if (mailbox->stopping)
+                return;
+
+            statistics.swap(mailbox->statistics);
+            frame_id = mailbox->frame_id;
+        }
+
+        try
+        {
+            evaluate(*statistics, frame_id);
+        }
+        catch (const std::exception& e)
+        {
+            if (!error_printed)
+            {
+                std::cerr << "AutoExposureController: " << e.what() << std::endl;
+                error_printed = true;
+            }
+        }
+    }
+}
+
+void AutoExposureController::evaluate(const FrameStatistics& statistics, uint64_t frame_id)
+{
+    double luma = mean_luma(statistics);
+    double sampled = static_cast<double>(std::max<uint64_t>(statistics.sampled_pixels, 1));
+    bool too_saturated = statistics.saturated_pixels / sampled > options.max_saturated_fraction;
+
+    State current = get_state();
+    if (frame_id <= current.last_frame_id)
+    {
+        // Frame IDs start over when the stream is recovered, restarted or switches profile, so a write made before
+        // says nothing about the new frames
+        settle_until_frame_id = 0;
+        last_update_ns = 0;
+    }
+    current.luma = luma;
+    current.last_frame_id = frame_id;
+
+    // Frames exposed before the last write took effect say nothing about the new values
+    bool settling = frame_id <= settle_until_frame_id;
+    int64_t min_update_interval_ns = static_cast<int64_t>(options.min_update_interval_ms) * 1000000;
+    bool rate_limited = last_update_ns != 0 && monotonic_ns() - last_update_ns < min_update_interval_ns;
+
+    double error = std::abs(luma - options.target_luma) / options.target_luma;
+    current.converged = !settling && error <= options.tolerance && !too_saturated;
+
+    if (settling || rate_limited || current.converged)
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        state = current;
+        return;
+    }
+
+    // Brightness is proportional to exposure time times linear gain
+    double ratio = options.target_luma / std::max(luma, 1.0);
+    if (too_saturated)
+    {
+        ratio = std::min(ratio, SATURATED_STEP);
+    }
+    ratio = std::max(1.0 / options.max_step, std::min(options.max_step, ratio));
+
+    double brightness = current.exposure_time * db_to_linear(current.gain - min_gain) * ratio;
+
+    double exposure_time = current.exposure_time;
+    if (options.adjust_exposure)
+    {
+        exposure_time = std::max(min_exposure_time, std::min(max_exposure_time, brightness));
+    }
+    double gain = current.gain;
+    if (options.adjust_gain)
+    {
+        gain = std::max(min_gain, std::min(max_gain, min_gain + linear_to_db(brightness / exposure_time)));
+    }
+
+    bool wrote = false;
+    if (std::abs(exposure_time - current.exposure_time) >= options.min_relative_change * current.exposure_time)
+    {
+        cam.set_exposure_time(exposure_time);
+        current.exposure_time = exposure_time;
+        current.writes++;
+        wrote = true;
+    }
+    else if (exposure_time != current.exposure_time)
+    {
+        current.skipped_writes++;
+    }
+
+    if (std::abs(gain - current.gain) >= linear_to_db(1.0 + options.min_relative_change))
+    {
+        cam.set_gain(gain);
+        current.gain = gain;
+        current.writes++;
+        wrote = true;
+    }
+    else if (gain != current.gain)
+    {
+        current.skipped_writes++;
+    }
+
+    if (wrote)
+    {
+        current.updates++;
+        settle_until_frame_id = frame_id + options.settle_frames;
+        last_update_ns = monotonic_ns();
+    }
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    state = current;
+}
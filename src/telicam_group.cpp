@@ -0,0 +1,155 @@
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "telicam_group.hpp"
+
+TeliCamGroup::TeliCamGroup(const std::vector<int>& camera_indices)
+{
+    cameras.reserve(camera_indices.size());
+    for (int index : camera_indices)
+    {
+        cameras.emplace_back(index);
+    }
+}
+
+TeliCamGroup::~TeliCamGroup()
+{
+    try
+    {
+        destroy();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+void TeliCamGroup::add(TeliCam camera)
+{
+    cameras.push_back(std::move(camera));
+}
+
+void TeliCamGroup::initialize(const std::vector<TeliCam::Parameters>& parameters)
+{
+    if (parameters.size() < cameras.size())
+    {
+        std::stringstream ss;
+        ss << "TeliCamGroup has " << cameras.size() << " cameras but only " << parameters.size()
+           << " parameter sets were given";
+        throw std::runtime_error(ss.str());
+    }
+
+    for_each_concurrently([&parameters](size_t i, TeliCam& camera) { camera.initialize(parameters[i]); },
+                          "initialize");
+}
+
+void TeliCamGroup::start_stream()
+{
+    for_each_concurrently([](size_t, TeliCam& camera) { camera.start_stream(); }, "start_stream");
+}
+
+void TeliCamGroup::stop_stream()
+{
+    for_each_concurrently([](size_t, TeliCam& camera) { camera.stop_stream(); }, "stop_stream");
+}
+
+void TeliCamGroup::capture_frame()
+{
+    for_each_concurrently([](size_t, TeliCam& camera) { camera.capture_frame(); }, "capture_frame");
+}
+
+void TeliCamGroup::destroy()
+{
+    for_each_concurrently([](size_t, TeliCam& camera) { camera.destroy(); }, "destroy");
+}
+
+size_t TeliCamGroup::size() const
+{
+    return cameras.size();
+}
+
+TeliCam& TeliCamGroup::operator[](size_t index)
+{
+    return cameras[index];
+}
+
+const TeliCam& TeliCamGroup::operator[](size_t index) const
+{
+    return cameras[index];
+}
+
+std::vector<TeliCam>::iterator TeliCamGroup::begin()
+{
+    return cameras.begin();
+}
+
+std::vector<TeliCam>::iterator TeliCamGroup::end()
+{
+    return cameras.end();
+}
+
+std::vector<TeliCam>::const_iterator TeliCamGroup::begin() const
+{
+    return cameras.begin();
+}
+
+std::vector<TeliCam>::const_iterator TeliCamGroup::end() const
+{
+    return cameras.end();
+}
+
+void TeliCamGroup::for_each_concurrently(const std::function<void(size_t, TeliCam&)>& operation, const char* name)
+{
+    std::vector<std::exception_ptr> errors(cameras.size());
+    std::vector<std::thread> threads;
+    threads.reserve(cameras.size());
+
+    for (size_t i = 0; i < cameras.size(); ++i)
+    {
+        threads.emplace_back([this, i, &operation, &errors] {
+            try
+            {
+                operation(i, cameras[i]);
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::stringstream ss;
+    bool failed = false;
+    for (size_t i = 0; i < errors.size(); ++i)
+    {
+        if (!errors[i])
+            continue;
+
+        try
+        {
+            std::rethrow_exception(errors[i]);
+        }
+        catch (const std::exception& e)
+        {
+            ss << (failed ? "; " : "") << "camera " << i << ": " << e.what();
+        }
+        catch (...)
+        {
+            ss << (failed ? "; " : "") << "camera " << i << ": unknown error";
+        }
+        failed = true;
+    }
+
+    if (failed)
+    {
+        throw std::runtime_error("TeliCamGroup " + std::string(name) + " failed for " + ss.str());
+    }
+}
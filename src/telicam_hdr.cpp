@@ -0,0 +1,538 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "telicam_hdr.hpp"
+#include "telicam_trace.hpp"
+
+// BT.601 luma weights in 8-bit fixed point, as in the frame statistics
+static const uint16_t LUMA_B = 29;
+static const uint16_t LUMA_G = 150;
+static const uint16_t LUMA_R = 77;
+
+// Pixels merged at a time. The running sums of a tile fit in L1 cache, and it is a multiple of any SIMD width.
+static const int TILE_WIDTH = 256;
+
+namespace
+{
+/**
+ * @brief Running sums of one tile, one plane per channel and one for the weights.
+ */
+struct TileSums
+{
+    float b[TILE_WIDTH];
+    float g[TILE_WIDTH];
+    float r[TILE_WIDTH];
+    float weight[TILE_WIDTH];
+};
+
+/**
+ * @brief Weight of a pixel, from 1 near black or clipping to 128 in the mid-tones. It is never 0, so that a pixel that
+ * is black or clipped in every frame still gets a value.
+ */
+inline int exposure_weight(uint8_t b, uint8_t g, uint8_t r)
+{
+    int luma = (b * LUMA_B + g * LUMA_G + r * LUMA_R) >> 8;
+    int headroom = 255 - std::max(b, std::max(g, r));
+    return std::min(luma, headroom) + 1;
+}
+
+void accumulate_pixels(const uint8_t* bgr, int start, int end, float scale, TileSums& sums)
+{
+    for (int x = start; x < end; ++x)
+    {
+        const uint8_t* pixel = bgr + 3 * x;
+        float weight = static_cast<float>(exposure_weight(pixel[0], pixel[1], pixel[2]));
+        float scaled_weight = weight * scale;
+        sums.b[x] += scaled_weight * pixel[0];
+        sums.g[x] += scaled_weight * pixel[1];
+        sums.r[x] += scaled_weight * pixel[2];
+        sums.weight[x] += weight;
+    }
+}
+
+void store_pixels(const TileSums& sums, int start, int end, uint8_t* bgr)
+{
+    for (int x = start; x < end; ++x)
+    {
+        bgr[3 * x] = cv::saturate_cast<uint8_t>(sums.b[x] / sums.weight[x]);
+        bgr[3 * x + 1] = cv::saturate_cast<uint8_t>(sums.g[x] / sums.weight[x]);
+        bgr[3 * x + 2] = cv::saturate_cast<uint8_t>(sums.r[x] / sums.weight[x]);
+    }
+}
+
+void store_pixels(const TileSums& sums, int start, int end, float* bgr)
+{
+    for (int x = start; x < end; ++x)
+    {
+        bgr[3 * x] = sums.b[x] / sums.weight[x];
+        bgr[3 * x + 1] = sums.g[x] / sums.weight[x];
+        bgr[3 * x + 2] = sums.r[x] / sums.weight[x];
+    }
+}
+
+#if CV_SIMD
+/**
+ * @brief Convert the halves of an expanded 8-bit vector to four float vectors.
+ */
+inline void widen(const cv::v_uint16& low, const cv::v_uint16& high, cv::v_float32 (&quarters)[4])
+{
+    cv::v_uint32 widened[4];
+    cv::v_expand(low, widened[0], widened[1]);
+    cv::v_expand(high, widened[2], widened[3]);
+    for (int k = 0; k < 4; ++k)
+    {
+        quarters[k] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(widened[k]));
+    }
+}
+
+void accumulate_tile(const uint8_t* bgr, int count, float scale, TileSums& sums)
+{
+    const int lanes = cv::v_uint8::nlanes;
+    const int float_lanes = cv::v_float32::nlanes;
+    const cv::v_uint16 weight_b = cv::v_setall_u16(LUMA_B);
+    const cv::v_uint16 weight_g = cv::v_setall_u16(LUMA_G);
+    const cv::v_uint16 weight_r = cv::v_setall_u16(LUMA_R);
+    const cv::v_uint8 full = cv::v_setall_u8(255);
+    const cv::v_uint8 one = cv::v_setall_u8(1);
+    const cv::v_float32 frame_scale = cv::v_setall_f32(scale);
+
+    int x = 0;
+    for (; x + lanes <= count; x += lanes)
+    {
+        cv::v_uint8 b, g, r;
+        cv::v_load_deinterleave(bgr + 3 * x, b, g, r);
+
+        cv::v_uint16 b0, b1, g0, g1, r0, r1;
+        cv::v_expand(b, b0, b1);
+        cv::v_expand(g, g0, g1);
+        cv::v_expand(r, r0, r1);
+        cv::v_uint8 luma = cv::v_pack((b0 * weight_b + g0 * weight_g + r0 * weight_r) >> 8,
+                                      (b1 * weight_b + g1 * weight_g + r1 * weight_r) >> 8);
+        cv::v_uint8 weight = cv::v_min(luma, full - cv::v_max(b, cv::v_max(g, r))) + one;
+
+        cv::v_uint16 weight0, weight1;
+        cv::v_expand(weight, weight0, weight1);
+        cv::v_float32 weights[4], blue[4], green[4], red[4];
+        widen(weight0, weight1, weights);
+        widen(b0, b1, blue);
+        widen(g0, g1, green);
+        widen(r0, r1, red);
+
+        for (int k = 0; k < 4; ++k)
+        {
+            int i = x + k * float_lanes;
+            cv::v_float32 scaled_weight = weights[k] * frame_scale;
+            cv::v_store(sums.b + i, cv::v_muladd(scaled_weight, blue[k], cv::vx_load(sums.b + i)));
+            cv::v_store(sums.g + i, cv::v_muladd(scaled_weight, green[k], cv::vx_load(sums.g + i)));
+            cv::v_store(sums.r + i, cv::v_muladd(scaled_weight, red[k], cv::vx_load(sums.r + i)));
+            cv::v_store(sums.weight + i, cv::vx_load(sums.weight + i) + weights[k]);
+        }
+    }
+
+    accumulate_pixels(bgr, x, count, scale, sums);
+}
+
+void store_tile(const TileSums& sums, int count, uint8_t* bgr)
+{
+    const int lanes = cv::v_uint8::nlanes;
+    const int float_lanes = cv::v_float32::nlanes;
+
+    int x = 0;
+    for (; x + lanes <= count; x += lanes)
+    {
+        cv::v_int32 b[4], g[4], r[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            int i = x + k * float_lanes;
+            cv::v_float32 weight = cv::vx_load(sums.weight + i);
+            b[k] = cv::v_round(cv::vx_load(sums.b + i) / weight);
+            g[k] = cv::v_round(cv::vx_load(sums.g + i) / weight);
+            r[k] = cv::v_round(cv::vx_load(sums.r + i) / weight);
+        }
+        cv::v_store_interleave(bgr + 3 * x, cv::v_pack(cv::v_pack_u(b[0], b[1]), cv::v_pack_u(b[2], b[3])),
+                               cv::v_pack(cv::v_pack_u(g[0], g[1]), cv::v_pack_u(g[2], g[3])),
+                               cv::v_pack(cv::v_pack_u(r[0], r[1]), cv::v_pack_u(r[2], r[3])));
+    }
+
+    store_pixels(sums, x, count, bgr);
+}
+
+void store_tile(const TileSums& sums, int count, float* bgr)
+{
+    const int float_lanes = cv::v_float32::nlanes;
+
+    int x = 0;
+    for (; x + float_lanes <= count; x += float_lanes)
+    {
+        cv::v_float32 weight = cv::vx_load(sums.weight + x);
+        cv::v_store_interleave(bgr + 3 * x, cv::vx_load(sums.b + x) / weight, cv::vx_load(sums.g + x) / weight,
+                               cv::vx_load(sums.r + x) / weight);
+    }
+
+    store_pixels(sums, x, count, bgr);
+}
+#else
+void accumulate_tile(const uint8_t* bgr, int count, float scale, TileSums& sums)
+{
+    accumulate_pixels(bgr, 0, count, scale, sums);
+}
+
+void store_tile(const TileSums& sums, int count, uint8_t* bgr)
+{
+    store_pixels(sums, 0, count, bgr);
+}
+
+void store_tile(const TileSums& sums, int count, float* bgr)
+{
+    store_pixels(sums, 0, count, bgr);
+}
+#endif
+} // namespace
+
+void fuse_exposures(const std::vector<cv::Mat>& frames, const std::vector<double>& exposure_times, cv::Mat& merged,
+                    const ExposureFusionOptions& options)
+{
+    CV_Assert(!frames.empty() && frames.size() <= MAX_FUSED_EXPOSURES && exposure_times.size() == frames.size());
+    for (const cv::Mat& frame : frames)
+    {
+        CV_Assert(frame.type() == CV_8UC3 && frame.size() == frames[0].size());
+    }
+
+    // Radiance is estimated by scaling every frame to the longest exposure. Fusion takes the values as they are.
+    double longest_exposure_time = *std::max_element(exposure_times.begin(), exposure_times.end());
+    float scales[MAX_FUSED_EXPOSURES];
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        CV_Assert(exposure_times[i] > 0.0);
+        scales[i] = options.radiance ? static_cast<float>(longest_exposure_time / exposure_times[i]) : 1.0f;
+    }
+
+    merged.create(frames[0].size(), options.radiance ? CV_32FC3 : CV_8UC3);
+    int width = frames[0].cols;
+
+    cv::parallel_for_(cv::Range(0, frames[0].rows), [&](const cv::Range& range) {
+        TileSums sums;
+        for (int y = range.start; y < range.end; ++y)
+        {
+            for (int x = 0; x < width; x += TILE_WIDTH)
+            {
+                int count = std::min(TILE_WIDTH, width - x);
+                std::fill_n(sums.b, count, 0.0f);
+                std::fill_n(sums.g, count, 0.0f);
+                std::fill_n(sums.r, count, 0.0f);
+                std::fill_n(sums.weight, count, 0.0f);
+
+                for (size_t i = 0; i < frames.size(); ++i)
+                {
+                    accumulate_tile(frames[i].ptr<uint8_t>(y) + 3 * x, count, scales[i], sums);
+                }
+
+                if (options.radiance)
+                {
+                    store_tile(sums, count, merged.ptr<float>(y) + 3 * x);
+                }
+                else
+                {
+                    store_tile(sums, count, merged.ptr<uint8_t>(y) + 3 * x);
+                }
+            }
+        }
+    });
+}
+
+struct ExposureBracketer::Sequencer
+{
+    explicit Sequencer(const Options& options)
+        : options(options)
+    {
+    }
+
+    /**
+     * @brief Ask for the exposure time of a later frame to be written, and add the frame to the set being collected.
+     */
+    void on_frame(const Frame& frame);
+
+    const Options options;
+
+    // Only used by the frame listener
+    uint64_t last_frame_id = 0;
+    std::vector<Frame> collecting;
+
+    // Shared with the write and merge threads
+    std::mutex mutex;
+    std::condition_variable write_cv;
+    std::condition_variable merge_cv;
+    std::deque<std::pair<uint64_t, size_t>> schedule; // First frame ID and exposure time index of each write
+    uint64_t received_frame_id = 0;                   // Last frame received
+    bool write_requested = false;
+    std::vector<Frame> complete; // Latest complete set that has not been merged, older ones are dropped
+    bool stopping = false;       // Set before the threads are joined, after which frames are ignored
+    Stats stats;
+    BracketedFrame last_merged;
+};
+
+void ExposureBracketer::Sequencer::on_frame(const Frame& frame)
+{
+    uint64_t frame_id = frame.metadata.frame_id;
+    bool reopened = frame_id <= last_frame_id;
+    last_frame_id = frame_id;
+
+    bool completed = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+            return;
+
+        if (reopened)
+        {
+            // Frame IDs start over when the camera is reopened, and the writes before say nothing about the new frames
+            schedule.clear();
+            collecting.clear();
+        }
+
+        // Exposure time this frame was taken with, unless it was exposed before the first write
+        while (schedule.size() > 1 && schedule[1].first <= frame_id)
+        {
+            schedule.pop_front();
+        }
+        bool scheduled = !schedule.empty() && schedule.front().first <= frame_id;
+        size_t index = scheduled ? schedule.front().second : 0;
+
+        received_frame_id = frame_id;
+        write_requested = true;
+        stats.frames++;
+
+        if (scheduled)
+        {
+            bool continues = index == collecting.size() &&
+                             (collecting.empty() || (frame_id == collecting.back().metadata.frame_id + 1 &&
+                                                     frame.image.size() == collecting.back().image.size()));
+            if (!continues)
+            {
+                stats.sets_broken += !collecting.empty();
+                collecting.clear();
+            }
+            if (index == collecting.size())
+            {
+                collecting.push_back(frame);
+                if (collecting.size() == options.exposure_times.size())
+                {
+                    stats.sets_dropped += !complete.empty();
+                    complete.swap(collecting);
+                    collecting.clear();
+                    completed = true;
+                }
+            }
+        }
+    }
+    write_cv.notify_one();
+    if (completed)
+    {
+        merge_cv.notify_one();
+    }
+}
+
+ExposureBracketer::ExposureBracketer(TeliCam& cam, const Options& options,
+                                     std::function<void(const BracketedFrame&)> on_merged)
+    : cam(cam)
+    , options(options)
+    , on_merged(std::move(on_merged))
+    , restore_exposure_time(cam.get_parameters().exposure_time)
+    , allocator(FrameAllocator::create(FrameAllocator::Options()))
+{
+    if (options.exposure_times.size() < 2 || options.exposure_times.size() > MAX_FUSED_EXPOSURES)
+    {
+        throw std::runtime_error("ExposureBracketer requires 2 to " + std::to_string(MAX_FUSED_EXPOSURES) +
+                                 " exposure times");
+    }
+    for (double exposure_time : options.exposure_times)
+    {
+        if (exposure_time < cam.get_min_exposure_time() || exposure_time > cam.get_max_exposure_time())
+        {
+            std::stringstream ss;
+            ss << "ExposureBracketer: exposure time " << exposure_time << " out of range. Min: "
+               << cam.get_min_exposure_time() << " Max: " << cam.get_max_exposure_time();
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+    sequencer = std::make_shared<Sequencer>(options);
+    write_thread = std::thread(&ExposureBracketer::write_exposures, this);
+    merge_thread = std::thread(&ExposureBracketer::merge_sets, this);
+
+    std::shared_ptr<Sequencer> shared_sequencer = sequencer;
+    listener_id = cam.add_frame_listener([shared_sequencer](const Frame& frame) { shared_sequencer->on_frame(frame); });
+}
+
+ExposureBracketer::~ExposureBracketer()
+{
+    cam.remove_frame_listener(listener_id);
+
+    // A listener call still in flight sees the flag and returns without requesting a write, and the write thread is
+    // joined before the exposure time is restored, so nothing can overwrite it afterwards
+    {
+        std::lock_guard<std::mutex> lock(sequencer->mutex);
+        sequencer->stopping = true;
+    }
+    sequencer->write_cv.notify_one();
+    sequencer->merge_cv.notify_one();
+    write_thread.join();
+    merge_thread.join();
+
+    try
+    {
+        cam.set_exposure_time(restore_exposure_time);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "ExposureBracketer: could not restore the exposure time: " << e.what() << std::endl;
+    }
+}
+
+ExposureBracketer::Stats ExposureBracketer::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(sequencer->mutex);
+    return sequencer->stats;
+}
+
+BracketedFrame ExposureBracketer::get_last_merged() const
+{
+    std::lock_guard<std::mutex> lock(sequencer->mutex);
+    return sequencer->last_merged;
+}
+
+void ExposureBracketer::write_exposures()
+{
+    size_t next_index = 0;
+    bool error_printed = false;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(sequencer->mutex);
+            sequencer->write_cv.wait(lock, [this] { return sequencer->stopping || sequencer->write_requested; });
+            if (sequencer->stopping)
+                return;
+
+            sequencer->write_requested = false;
+        }
+
+        // Frames that arrive while the write is in flight are coalesced into the next one
+        try
+        {
+            cam.set_exposure_time(options.exposure_times[next_index]);
+        }
+        catch (const std::exception& e)
+        {
+            std::lock_guard<std::mutex> lock(sequencer->mutex);
+            sequencer->stats.write_errors++;
+            if (!error_printed)
+            {
+                std::cerr << "ExposureBracketer: " << e.what() << std::endl;
+                error_printed = true;
+            }
+            continue;
+        }
+
+        // The next latency_frames frames after the last one received may already be exposed, so the write applies to
+        // the one after them. A frame that is lost skips its write, and the frame the write was for repeats the
+        // previous exposure time.
+        {
+            std::lock_guard<std::mutex> lock(sequencer->mutex);
+            sequencer->schedule.emplace_back(sequencer->received_frame_id + 1 + options.latency_frames, next_index);
+            sequencer->stats.writes++;
+        }
+        next_index = (next_index + 1) % options.exposure_times.size();
+    }
+}
+
+void ExposureBracketer::merge_sets()
+{
+    std::vector<cv::Mat> images;
+    int64_t first_merge_ns = 0;
+    double total_merge_ms = 0.0;
+    bool error_printed = false;
+
+    while (true)
+    {
+        std::vector<Frame> frames;
+        {
+            std::unique_lock<std::mutex> lock(sequencer->mutex);
+            sequencer->merge_cv.wait(lock, [this] { return sequencer->stopping || !sequencer->complete.empty(); });
+            if (sequencer->stopping)
+                return;
+
+            frames.swap(sequencer->complete);
+        }
+
+        int64_t start_ns = monotonic_ns();
+        BracketedFrame merged;
+        merged.exposure_times = options.exposure_times;
+        for (const Frame& frame : frames)
+        {
+            images.push_back(frame.image);
+            merged.exposures.push_back(frame.metadata);
+        }
+
+        try
+        {
+            TraceSpan span("hdr_merge", -1, merged.exposures.back().frame_id);
+
+            // Frames change size when the camera switches to or from a preview profile
+            int type = options.fusion.radiance ? CV_32FC3 : CV_8UC3;
+            if (!output_pool || output_pool->get_frame_size() != images[0].size() ||
+                output_pool->get_frame_type() != type)
+            {
+                output_pool.reset(new FramePool(allocator, images[0].size(), type, 2));
+            }
+            merged.image = output_pool->acquire();
+            fuse_exposures(images, merged.exposure_times, merged.image, options.fusion);
+        }
+        catch (const std::exception& e)
+        {
+            if (!error_printed)
+            {
+                std::cerr << "ExposureBracketer: " << e.what() << std::endl;
+                error_printed = true;
+            }
+            images.clear();
+            continue;
+        }
+
+        // The camera's buffers go back to its pool before the merged frame is handed out
+        images.clear();
+        frames.clear();
+
+        int64_t end_ns = monotonic_ns();
+        merged.merge_ms = (end_ns - start_ns) / 1e6;
+        {
+            std::lock_guard<std::mutex> lock(sequencer->mutex);
+            Stats& stats = sequencer->stats;
+            if (stats.sets_merged == 0)
+            {
+                first_merge_ns = end_ns;
+            }
+            stats.sets_merged++;
+            total_merge_ms += merged.merge_ms;
+            stats.mean_merge_ms = total_merge_ms / stats.sets_merged;
+            stats.max_merge_ms = std::max(stats.max_merge_ms, merged.merge_ms);
+            if (stats.sets_merged > 1)
+            {
+                stats.merged_fps = (stats.sets_merged - 1) * 1e9 / std::max<int64_t>(end_ns - first_merge_ns, 1);
+            }
+            sequencer->last_merged = merged;
+        }
+
+        if (on_merged)
+        {
+            on_merged(merged);
+        }
+    }
+}
@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "telicam_metrics.hpp"
+#include "telicam_timing.hpp"
+
+// Weight of the newest frame interval in the frame rate estimate
+static const double FPS_SMOOTHING = 0.1;
+
+static const int POLL_INTERVAL_MS = 200;
+static const int CLIENT_TIMEOUT_MS = 1000;
+
+Histogram::Histogram(std::vector<double> upper_bounds)
+    : upper_bounds(std::move(upper_bounds))
+    , buckets(new std::atomic<uint64_t>[this->upper_bounds.size() + 1])
+    , count(0)
+    , sum(0.0)
+{
+    for (size_t i = 0; i <= this->upper_bounds.size(); ++i)
+    {
+        buckets[i] = 0;
+    }
+}
+
+void Histogram::observe(double value)
+{
+    size_t bucket = std::lower_bound(upper_bounds.begin(), upper_bounds.end(), value) - upper_bounds.begin();
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+
+    double current_sum = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(current_sum, current_sum + value, std::memory_order_relaxed))
+    {
+    }
+}
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+    Snapshot snapshot;
+    snapshot.upper_bounds = upper_bounds;
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= upper_bounds.size(); ++i)
+    {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        snapshot.cumulative_counts.push_back(cumulative);
+    }
+
+    // Taken from the buckets so that the +Inf bucket and the count always agree
+    snapshot.count = cumulative;
+    snapshot.sum = sum.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+CameraMetrics::CameraMetrics()
+    : frames_received(0)
+    , frames_dropped(0)
+    , frames_incomplete(0)
+    , stream_errors(0)
+    , recoveries(0)
+    , last_block_id(0)
+    , last_receive_ns(0)
+    , interval_ns(0.0)
+    , conversion_seconds({0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1})
+{
+}
+
+void CameraMetrics::record_frame(uint64_t block_id, uint32_t status, int64_t receive_ns)
+{
+    frames_received.fetch_add(1, std::memory_order_relaxed);
+    if (status != 0)
+    {
+        frames_incomplete.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t previous_block_id = last_block_id.load(std::memory_order_relaxed);
+    if (previous_block_id != 0)
+    {
+        // Block IDs restart when the camera restarts acquisition, which is not a drop
+        if (block_id > previous_block_id + 1)
+        {
+            frames_dropped.fetch_add(block_id - previous_block_id - 1, std::memory_order_relaxed);
+        }
+
+        double interval = static_cast<double>(receive_ns - last_receive_ns.load(std::memory_order_relaxed));
+        if (block_id > previous_block_id)
+        {
+            interval /= static_cast<double>(block_id - previous_block_id);
+        }
+
+        double previous_interval = interval_ns.load(std::memory_order_relaxed);
+        interval_ns.store(previous_interval == 0.0 ? interval
+                                                   : previous_interval + FPS_SMOOTHING * (interval - previous_interval),
+                          std::memory_order_relaxed);
+    }
+
+    last_block_id.store(block_id, std::memory_order_relaxed);
+    last_receive_ns.store(receive_ns, std::memory_order_relaxed);
+}
+
+void CameraMetrics::record_dropped(uint64_t frames)
+{
+    frames_dropped.fetch_add(frames, std::memory_order_relaxed);
+}
+
+void CameraMetrics::record_conversion(int64_t duration_ns)
+{
+    conversion_seconds.observe(duration_ns * 1e-9);
+}
+
+void CameraMetrics::record_stream_error()
+{
+    stream_errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CameraMetrics::record_recovery()
+{
+    recoveries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CameraMetrics::restart_sequence()
+{
+    last_block_id.store(0, std::memory_order_relaxed);
+}
+
+CameraMetricsSnapshot CameraMetrics::snapshot() const
+{
+    CameraMetricsSnapshot snapshot;
+    snapshot.frames_received = frames_received.load(std::memory_order_relaxed);
+    snapshot.frames_dropped = frames_dropped.load(std::memory_order_relaxed);
+    snapshot.frames_incomplete = frames_incomplete.load(std::memory_order_relaxed);
+    snapshot.stream_errors = stream_errors.load(std::memory_order_relaxed);
+    snapshot.recoveries = recoveries.load(std::memory_order_relaxed);
+    snapshot.conversion_seconds = conversion_seconds.snapshot();
+
+    int64_t receive_ns = last_receive_ns.load(std::memory_order_relaxed);
+    if (receive_ns != 0)
+    {
+        double age_ns = static_cast<double>(monotonic_ns() - receive_ns);
+        snapshot.last_frame_age_s = age_ns * 1e-9;
+
+        // A stalled camera has no new intervals, so let the time since the last frame pull the rate down
+        double interval = std::max(interval_ns.load(std::memory_order_relaxed), age_ns);
+        snapshot.fps = interval > 0.0 ? 1e9 / interval : 0.0;
+    }
+    return snapshot;
+}
+
+MetricsRegistry& MetricsRegistry::global()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+void MetricsRegistry::add(const std::string& camera, const std::shared_ptr<const CameraMetrics>& metrics)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [](const Entry& entry) { return entry.metrics.expired(); }),
+                  entries.end());
+
+    for (auto& entry : entries)
+    {
+        if (entry.metrics.lock() == metrics)
+        {
+            entry.camera = camera;
+            return;
+        }
+    }
+    entries.push_back(Entry{camera, metrics});
+}
+
+void MetricsRegistry::remove(const std::shared_ptr<const CameraMetrics>& metrics)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [&metrics](const Entry& entry) {
+                                     return entry.metrics.expired() || entry.metrics.lock() == metrics;
+                                 }),
+                  entries.end());
+}
+
+/**
+ * @brief Escape a Prometheus label value.
+ */
+static std::string escape_label_value(const std::string& value)
+{
+    std::string escaped;
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (c == '\n')
+        {
+            escaped += "\\n";
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+std::string MetricsRegistry::render_prometheus()
+{
+    std::vector<std::pair<std::string, CameraMetricsSnapshot>> snapshots;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& entry : entries)
+        {
+            if (std::shared_ptr<const CameraMetrics> metrics = entry.metrics.lock())
+            {
+                snapshots.emplace_back(escape_label_value(entry.camera), metrics->snapshot());
+            }
+        }
+    }
+
+    std::ostringstream out;
+    out.precision(9);
+
+    auto write_family = [&](const char* name, const char* type, const char* help, auto value) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+        for (const auto& snapshot : snapshots)
+        {
+            out << name << "{camera=\"" << snapshot.first << "\"} " << value(snapshot.second) << "\n";
+        }
+    };
+
+    write_family("telicam_frames_received_total", "counter", "Frames delivered by the camera.",
+                 [](const CameraMetricsSnapshot& s) { return s.frames_received; });
+    write_family("telicam_frames_dropped_total", "counter", "Frames lost on the camera link or dropped on the host.",
+                 [](const CameraMetricsSnapshot& s) { return s.frames_dropped; });
+    write_family("telicam_frames_incomplete_total", "counter", "Frames delivered with a non-zero image status.",
+                 [](const CameraMetricsSnapshot& s) { return s.frames_incomplete; });
+    write_family("telicam_stream_errors_total", "counter", "Errors reported by the SDK stream.",
+                 [](const CameraMetricsSnapshot& s) { return s.stream_errors; });
+    write_family("telicam_recoveries_total", "counter", "Times the camera was reopened after a disconnect or error.",
+                 [](const CameraMetricsSnapshot& s) { return s.recoveries; });
+    write_family("telicam_fps", "gauge", "Effective frame rate.",
+                 [](const CameraMetricsSnapshot& s) { return s.fps; });
+    write_family("telicam_last_frame_age_seconds", "gauge", "Time since the last frame arrived.",
+                 [](const CameraMetricsSnapshot& s) {
+                     return s.last_frame_age_s < 0.0 ? std::string("NaN") : std::to_string(s.last_frame_age_s);
+                 });
+
+    const char* histogram = "telicam_conversion_seconds";
+    out << "# HELP " << histogram << " Raw to BGR conversion time.\n# TYPE " << histogram << " histogram\n";
+    for (const auto& snapshot : snapshots)
+    {
+        const Histogram::Snapshot& h = snapshot.second.conversion_seconds;
+        std::string camera = "camera=\"" + snapshot.first + "\"";
+        for (size_t i = 0; i < h.upper_bounds.size(); ++i)
+        {
+            out << histogram << "_bucket{" << camera << ",le=\"" << h.upper_bounds[i] << "\"} "
+                << h.cumulative_counts[i] << "\n";
+        }
+        out << histogram << "_bucket{" << camera << ",le=\"+Inf\"} " << h.count << "\n";
+        out << histogram << "_sum{" << camera << "} " << h.sum << "\n";
+        out << histogram << "_count{" << camera << "} " << h.count << "\n";
+    }
+
+    return out.str();
+}
+
+MetricsExporter::MetricsExporter(MetricsRegistry& registry, const Options& options)
+    : registry(registry)
+    , options(options)
+    , listen_fd(-1)
+    , stopping(false)
+{
+    if (options.http_port != 0)
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+        {
+            throw std::runtime_error("MetricsExporter socket failed: " + std::string(std::strerror(errno)));
+        }
+
+        int reuse = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(options.http_port));
+        if (inet_pton(AF_INET, options.bind_address.c_str(), &address.sin_addr) != 1 ||
+            bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_fd, 8) != 0)
+        {
+            std::string error = std::strerror(errno);
+            close(listen_fd);
+            throw std::runtime_error("MetricsExporter failed to listen on " + options.bind_address + ":" +
+                                     std::to_string(options.http_port) + ": " + error);
+        }
+    }
+
+    thread = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stopping = true;
+    thread.join();
+
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+    }
+}
+
+void MetricsExporter::run()
+{
+    int64_t next_write_ns = monotonic_ns();
+    while (!stopping)
+    {
+        if (!options.filename.empty() && monotonic_ns() >= next_write_ns)
+        {
+            write_file();
+            next_write_ns += static_cast<int64_t>(options.file_interval_s * 1e9);
+        }
+
+        if (listen_fd < 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL_MS));
+            continue;
+        }
+
+        pollfd listen_poll = {listen_fd, POLLIN, 0};
+        if (poll(&listen_poll, 1, POLL_INTERVAL_MS) > 0 && (listen_poll.revents & POLLIN))
+        {
+            int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client_fd >= 0)
+            {
+                serve_client(client_fd);
+                close(client_fd);
+            }
+        }
+    }
+
+    if (!options.filename.empty())
+    {
+        write_file();
+    }
+}
+
+void MetricsExporter::serve_client(int client_fd)
+{
+    // Only the request line matters, so read until it is complete
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n") == std::string::npos && request.size() < 8192)
+    {
+        pollfd client_poll = {client_fd, POLLIN, 0};
+        if (poll(&client_poll, 1, CLIENT_TIMEOUT_MS) <= 0)
+            return;
+
+        ssize_t received = recv(client_fd, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+            return;
+        request.append(buffer, static_cast<size_t>(received));
+    }
+
+    std::string status = "200 OK";
+    std::string body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+    {
+        body = registry.render_prometheus();
+    }
+    else
+    {
+        status = "404 Not Found";
+        body = "Not found\n";
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << "\r\n"
+             << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+
+    std::string data = response.str();
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(client_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        sent += static_cast<size_t>(n);
+    }
+}
+
+void MetricsExporter::write_file()
+{
+    // Write then rename, so that readers such as the node_exporter textfile collector never see a partial file
+    std::string temporary = options.filename + ".tmp";
+    {
+        std::ofstream file(temporary);
+        file << registry.render_prometheus();
+        if (!file)
+        {
+            std::cerr << "MetricsExporter: failed to write " << temporary << std::endl;
+            return;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), options.filename.c_str()) != 0)
+    {
+        std::cerr << "MetricsExporter: failed to rename " << temporary << ": " << std::strerror(errno) << std::endl;
+    }
+}
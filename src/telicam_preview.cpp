@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <cmath>
+
+#include "telicam_preview.hpp"
+
+PreviewProfile plan_preview_profile(cv::Size frame_size, cv::Size target_size, const BinningLimits& limits)
+{
+    PreviewProfile profile;
+    profile.camera_size = frame_size;
+    profile.display_size = frame_size;
+    if (frame_size.area() == 0 || target_size.area() == 0)
+        return profile;
+
+    double scale = std::min(1.0, std::min(static_cast<double>(target_size.width) / frame_size.width,
+                                          static_cast<double>(target_size.height) / frame_size.height));
+    profile.display_size = cv::Size(std::max(1, static_cast<int>(std::lround(frame_size.width * scale))),
+                                    std::max(1, static_cast<int>(std::lround(frame_size.height * scale))));
+
+    uint32_t min_binning = std::max<uint32_t>(limits.min_binning, 1);
+    uint32_t max_binning = std::max(limits.max_binning, min_binning);
+    uint32_t min_decimation = std::max<uint32_t>(limits.min_decimation, 1);
+    uint32_t max_decimation = std::max(limits.max_decimation, min_decimation);
+
+    // The ranges are a handful of values, so every combination is tried
+    uint32_t best_factor = 0;
+    for (uint32_t binning = min_binning; binning <= max_binning; ++binning)
+    {
+        for (uint32_t decimation = min_decimation; decimation <= max_decimation; ++decimation)
+        {
+            uint32_t factor = binning * decimation;
+            cv::Size camera_size(frame_size.width / factor, frame_size.height / factor);
+            bool large_enough =
+                camera_size.width >= profile.display_size.width && camera_size.height >= profile.display_size.height;
+            if (!large_enough && factor > min_binning * min_decimation)
+                continue;
+
+            if (factor > best_factor || (factor == best_factor && binning > profile.binning))
+            {
+                best_factor = factor;
+                profile.binning = binning;
+                profile.decimation = decimation;
+                profile.camera_size = camera_size;
+            }
+        }
+    }
+
+    return profile;
+}
@@ -0,0 +1,188 @@
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "telicam_recorder.hpp"
+
+static const uint32_t RECORDING_MAGIC = 0x52524354; // "TCRR"
+static const uint32_t RECORDING_VERSION = 1;
+
+namespace
+{
+struct RecordingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct RecordHeader
+{
+    uint64_t block_id;
+    uint64_t device_timestamp;
+    int64_t receive_ns;
+    uint32_t pixel_format;
+    uint32_t compressed_size;
+    // Followed by the frame, compressed with compress_bayer()
+};
+} // namespace
+
+struct FrameRecorder::Record
+{
+    RecordHeader header;
+    uint64_t raw_size = 0;
+    std::vector<uint8_t> compressed; // Sized to the compression bound, header.compressed_size bytes are used
+};
+
+FrameRecorder::FrameRecorder(TeliCam& cam, const std::string& filename, const Options& options)
+    : cam(cam)
+    , options(options)
+    , file(filename, std::ios::binary | std::ios::trunc)
+    , change_detector(options.change)
+    , current(new Record())
+    , listener_id(-1)
+    , frames_written(0)
+    , unsupported_frames(0)
+    , frames_skipped(0)
+    , raw_bytes(0)
+    , compressed_bytes(0)
+{
+    if (!file)
+    {
+        throw std::runtime_error("FrameRecorder: failed to create " + filename);
+    }
+
+    RecordingHeader header;
+    header.magic = RECORDING_MAGIC;
+    header.version = RECORDING_VERSION;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    FrameWorker::Options worker_options;
+    worker_options.name = "recorder";
+    worker_options.queue_depth = options.queue_depth;
+    size_t buffer_size = static_cast<size_t>(cam.get_sensor_width()) * cam.get_sensor_height();
+    worker.reset(new FrameWorker(worker_options, buffer_size, [this](const RawFrame& raw) { process_frame(raw); }));
+
+    listener_id = cam.add_raw_frame_listener([this](const RawFrame& raw) {
+        if (raw.size != static_cast<size_t>(raw.width) * raw.height)
+        {
+            unsupported_frames.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        worker->submit(raw);
+    });
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    // Removal waits for a listener call in progress on the acquisition thread, so nothing submits to the worker once
+    // it returns, and the worker only stops after that
+    cam.remove_raw_frame_listener(listener_id);
+    worker.reset();
+}
+
+FrameRecorder::Stats FrameRecorder::get_stats() const
+{
+    Stats stats;
+    stats.frames_written = frames_written.load(std::memory_order_relaxed);
+    stats.frames_dropped = worker->get_dropped_frames() + unsupported_frames.load(std::memory_order_relaxed);
+    stats.frames_skipped = frames_skipped.load(std::memory_order_relaxed);
+    stats.raw_bytes = raw_bytes.load(std::memory_order_relaxed);
+    stats.compressed_bytes = compressed_bytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void FrameRecorder::process_frame(const RawFrame& raw)
+{
+    cv::Mat bayer(raw.height, raw.width, CV_8UC1, const_cast<uint8_t*>(raw.data));
+
+    // The detector runs on the raw mosaic, so the decision applies to exactly this frame
+    bool active = !options.record_on_change || change_detector.update(bayer).active;
+    if (!active && options.pre_roll_frames == 0)
+    {
+        frames_skipped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    RecordHeader& header = current->header;
+    header.block_id = raw.block_id;
+    header.device_timestamp = raw.device_timestamp;
+    header.receive_ns = raw.receive_ns;
+    header.pixel_format = raw.pixel_format;
+    header.compressed_size = static_cast<uint32_t>(compress_bayer(bayer, current->compressed, options.codec));
+    current->raw_size = raw.size;
+
+    if (!active)
+    {
+        // Keep the frame for pre-roll, recycling the record that falls out of it
+        pre_roll.push_back(std::move(current));
+        if (pre_roll.size() > options.pre_roll_frames)
+        {
+            current = std::move(pre_roll.front());
+            pre_roll.pop_front();
+            frames_skipped.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            current.reset(new Record());
+        }
+        return;
+    }
+
+    while (!pre_roll.empty())
+    {
+        write_record(*pre_roll.front());
+        pre_roll.pop_front();
+    }
+    write_record(*current);
+}
+
+void FrameRecorder::write_record(const Record& record)
+{
+    file.write(reinterpret_cast<const char*>(&record.header), sizeof(record.header));
+    file.write(reinterpret_cast<const char*>(record.compressed.data()), record.header.compressed_size);
+    if (!file)
+    {
+        throw std::runtime_error("FrameRecorder: write failed");
+    }
+
+    frames_written.fetch_add(1, std::memory_order_relaxed);
+    raw_bytes.fetch_add(record.raw_size, std::memory_order_relaxed);
+    compressed_bytes.fetch_add(record.header.compressed_size, std::memory_order_relaxed);
+}
+
+RecordingReader::RecordingReader(const std::string& filename)
+    : file(filename, std::ios::binary)
+{
+    RecordingHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != RECORDING_MAGIC || header.version != RECORDING_VERSION)
+    {
+        throw std::runtime_error("RecordingReader: " + filename + " is not a TeliCam recording");
+    }
+}
+
+bool RecordingReader::read(RecordedFrame& frame)
+{
+    RecordHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (file.gcount() == 0)
+        return false;
+    if (!file)
+    {
+        throw std::runtime_error("RecordingReader: truncated record");
+    }
+
+    compressed.resize(header.compressed_size);
+    file.read(reinterpret_cast<char*>(compressed.data()), header.compressed_size);
+    if (!file)
+    {
+        throw std::runtime_error("RecordingReader: truncated frame");
+    }
+
+    frame.block_id = header.block_id;
+    frame.device_timestamp = header.device_timestamp;
+    frame.receive_ns = header.receive_ns;
+    frame.pixel_format = header.pixel_format;
+    decompress_bayer(compressed.data(), compressed.size(), frame.bayer);
+    return true;
+}
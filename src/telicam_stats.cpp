@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <vector>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "telicam_stats.hpp"
+
+// BT.601 luma weights in 8-bit fixed point. They sum to 256, so the weighted sum of 8-bit channels fits in 16 bits.
+static const uint16_t LUMA_B = 29;
+static const uint16_t LUMA_G = 150;
+static const uint16_t LUMA_R = 77;
+
+#if CV_SIMD
+static const int BLOCK_WIDTH = cv::v_uint8::nlanes;
+#else
+static const int BLOCK_WIDTH = 16;
+#endif
+
+namespace
+{
+struct RowTotals
+{
+    uint64_t sum_b = 0;
+    uint64_t sum_g = 0;
+    uint64_t sum_r = 0;
+    uint64_t saturated = 0;
+    uint64_t black = 0;
+};
+
+void accumulate_pixels(const uint8_t* bgr, int count, const StatisticsOptions& options, uint8_t* luma,
+                       RowTotals& totals)
+{
+    for (int i = 0; i < count; ++i, bgr += 3)
+    {
+        uint8_t b = bgr[0];
+        uint8_t g = bgr[1];
+        uint8_t r = bgr[2];
+        uint8_t max_channel = std::max(b, std::max(g, r));
+
+        luma[i] = static_cast<uint8_t>((b * LUMA_B + g * LUMA_G + r * LUMA_R) >> 8);
+        totals.sum_b += b;
+        totals.sum_g += g;
+        totals.sum_r += r;
+        totals.saturated += max_channel >= options.saturation_level;
+        totals.black += max_channel <= options.black_level;
+    }
+}
+
+#if CV_SIMD
+/**
+ * @brief Accumulate one row. Luma of the sampled pixels is written contiguously to luma. Returns the number of
+ * sampled pixels.
+ */
+int accumulate_row(const uint8_t* row, int width, int block_step, const StatisticsOptions& options, uint8_t* luma,
+                   RowTotals& totals)
+{
+    const cv::v_uint16 weight_b = cv::v_setall_u16(LUMA_B);
+    const cv::v_uint16 weight_g = cv::v_setall_u16(LUMA_G);
+    const cv::v_uint16 weight_r = cv::v_setall_u16(LUMA_R);
+    const cv::v_uint8 saturation_level = cv::v_setall_u8(options.saturation_level);
+    const cv::v_uint8 black_level = cv::v_setall_u8(options.black_level);
+    const cv::v_uint8 one = cv::v_setall_u8(1);
+
+    // Channel sums of a block are at most 2 * 255 per 16-bit lane, so they are widened to 32 bits before
+    // accumulating. Clipped pixel counts are at most 2 per lane and block, so 16 bits last for any row width.
+    cv::v_uint32 sum_b = cv::v_setzero_u32();
+    cv::v_uint32 sum_g = cv::v_setzero_u32();
+    cv::v_uint32 sum_r = cv::v_setzero_u32();
+    cv::v_uint16 saturated = cv::v_setzero_u16();
+    cv::v_uint16 black = cv::v_setzero_u16();
+
+    int sampled = 0;
+    int x = 0;
+    for (; x + BLOCK_WIDTH <= width; x += BLOCK_WIDTH * block_step, sampled += BLOCK_WIDTH)
+    {
+        cv::v_uint8 b, g, r;
+        cv::v_load_deinterleave(row + 3 * x, b, g, r);
+
+        cv::v_uint16 b0, b1, g0, g1, r0, r1;
+        cv::v_expand(b, b0, b1);
+        cv::v_expand(g, g0, g1);
+        cv::v_expand(r, r0, r1);
+
+        cv::v_uint16 luma0 = (b0 * weight_b + g0 * weight_g + r0 * weight_r) >> 8;
+        cv::v_uint16 luma1 = (b1 * weight_b + g1 * weight_g + r1 * weight_r) >> 8;
+        cv::v_store(luma + sampled, cv::v_pack(luma0, luma1));
+
+        cv::v_uint32 lo, hi;
+        cv::v_expand(b0 + b1, lo, hi);
+        sum_b += lo + hi;
+        cv::v_expand(g0 + g1, lo, hi);
+        sum_g += lo + hi;
+        cv::v_expand(r0 + r1, lo, hi);
+        sum_r += lo + hi;
+
+        cv::v_uint8 max_channel = cv::v_max(b, cv::v_max(g, r));
+        cv::v_uint16 count0, count1;
+        cv::v_expand((max_channel >= saturation_level) & one, count0, count1);
+        saturated += count0 + count1;
+        cv::v_expand((max_channel <= black_level) & one, count0, count1);
+        black += count0 + count1;
+    }
+
+    totals.sum_b += cv::v_reduce_sum(sum_b);
+    totals.sum_g += cv::v_reduce_sum(sum_g);
+    totals.sum_r += cv::v_reduce_sum(sum_r);
+    totals.saturated += cv::v_reduce_sum(saturated);
+    totals.black += cv::v_reduce_sum(black);
+
+    // A partial block is only left over when the last sampled block would run past the end of the row
+    if (x < width)
+    {
+        accumulate_pixels(row + 3 * x, width - x, options, luma + sampled, totals);
+        sampled += width - x;
+    }
+    return sampled;
+}
+#else
+int accumulate_row(const uint8_t* row, int width, int block_step, const StatisticsOptions& options, uint8_t* luma,
+                   RowTotals& totals)
+{
+    int sampled = 0;
+    for (int x = 0; x < width; x += BLOCK_WIDTH * block_step)
+    {
+        int count = std::min(BLOCK_WIDTH, width - x);
+        accumulate_pixels(row + 3 * x, count, options, luma + sampled, totals);
+        sampled += count;
+    }
+    return sampled;
+}
+#endif
+} // namespace
+
+void compute_frame_statistics(const cv::Mat& bgr, const StatisticsOptions& options, FrameStatistics& statistics)
+{
+    CV_Assert(bgr.type() == CV_8UC3);
+
+    statistics = FrameStatistics();
+    const cv::Mat region = options.roi.area() > 0 ? bgr(options.roi & cv::Rect(0, 0, bgr.cols, bgr.rows)) : bgr;
+    int step = static_cast<int>(std::max<uint32_t>(options.subsample, 1));
+
+    // Four interleaved histograms, so that runs of equal luma do not serialize on one counter
+    std::vector<uint32_t> histograms(4 * 256, 0);
+    std::vector<uint8_t> luma(region.cols + BLOCK_WIDTH);
+    RowTotals totals;
+
+    for (int y = 0; y < region.rows; y += step)
+    {
+        int sampled = accumulate_row(region.ptr<uint8_t>(y), region.cols, step, options, luma.data(), totals);
+
+        int i = 0;
+        for (; i + 4 <= sampled; i += 4)
+        {
+            histograms[luma[i]]++;
+            histograms[256 + luma[i + 1]]++;
+            histograms[512 + luma[i + 2]]++;
+            histograms[768 + luma[i + 3]]++;
+        }
+        for (; i < sampled; ++i)
+        {
+            histograms[luma[i]]++;
+        }
+        statistics.sampled_pixels += sampled;
+    }
+
+    for (int bin = 0; bin < 256; ++bin)
+    {
+        statistics.luma_histogram[bin] =
+            histograms[bin] + histograms[256 + bin] + histograms[512 + bin] + histograms[768 + bin];
+    }
+
+    if (statistics.sampled_pixels > 0)
+    {
+        double n = static_cast<double>(statistics.sampled_pixels);
+        statistics.channel_means = cv::Scalar(totals.sum_b / n, totals.sum_g / n, totals.sum_r / n);
+    }
+    statistics.saturated_pixels = totals.saturated;
+    statistics.black_pixels = totals.black;
+}
+
+void add_frame_statistics(const FrameStatistics& other, FrameStatistics& statistics)
+{
+    uint64_t sampled_pixels = statistics.sampled_pixels + other.sampled_pixels;
+    for (int c = 0; c < 3 && sampled_pixels > 0; ++c)
+    {
+        statistics.channel_means[c] = (statistics.channel_means[c] * statistics.sampled_pixels +
+                                       other.channel_means[c] * other.sampled_pixels) /
+                                      sampled_pixels;
+    }
+    for (int bin = 0; bin < 256; ++bin)
+    {
+        statistics.luma_histogram[bin] += other.luma_histogram[bin];
+    }
+    statistics.saturated_pixels += other.saturated_pixels;
+    statistics.black_pixels += other.black_pixels;
+    statistics.sampled_pixels = sampled_pixels;
+}
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "telicam_supervisor.hpp"
+#include "telicam_timing.hpp"
+
+static int64_t frame_time_ns(const CameraMetricsSnapshot& snapshot, int64_t now_ns)
+{
+    if (snapshot.last_frame_age_s < 0.0)
+        return 0;
+    return now_ns - static_cast<int64_t>(snapshot.last_frame_age_s * 1e9);
+}
+
+StreamSupervisor::StreamSupervisor(TeliCam& cam, const Options& options,
+                                   std::function<void(const Incident&)> on_recovered)
+    : cam(cam)
+    , options(options)
+    , on_recovered(std::move(on_recovered))
+    , stopping(false)
+{
+    this->options.poll_interval_ms = std::max<uint32_t>(options.poll_interval_ms, 1);
+    thread = std::thread(&StreamSupervisor::run, this);
+}
+
+StreamSupervisor::~StreamSupervisor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+StreamSupervisor::Stats StreamSupervisor::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+bool StreamSupervisor::wait(uint32_t ms)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return cv.wait_for(lock, std::chrono::milliseconds(ms), [this] { return stopping; });
+}
+
+int64_t StreamSupervisor::stall_timeout_ns() const
+{
+    int64_t timeout_ns = static_cast<int64_t>(options.min_stall_ms) * 1000000;
+    double framerate = cam.get_parameters().framerate;
+    if (framerate > 0.0)
+    {
+        timeout_ns = std::max(timeout_ns, static_cast<int64_t>(options.stall_frame_periods * 1e9 / framerate));
+    }
+    return timeout_ns;
+}
+
+void StreamSupervisor::run()
+{
+    std::shared_ptr<const CameraMetrics> metrics = cam.get_metrics();
+    uint64_t seen_stream_errors = metrics->snapshot().stream_errors;
+    int64_t watch_start_ns = 0; // When streaming was first seen, 0 while not streaming
+
+    while (!wait(options.poll_interval_ms))
+    {
+        CameraMetricsSnapshot snapshot = metrics->snapshot();
+        int64_t now_ns = monotonic_ns();
+        if (!cam.is_streaming())
+        {
+            watch_start_ns = 0;
+            seen_stream_errors = snapshot.stream_errors;
+            continue;
+        }
+        if (watch_start_ns == 0)
+        {
+            watch_start_ns = now_ns;
+        }
+
+        Incident incident;
+        incident.last_frame_ns = frame_time_ns(snapshot, now_ns);
+        incident.detected_ns = now_ns;
+
+        if (snapshot.stream_errors > seen_stream_errors && options.recover_on_error)
+        {
+            incident.cause = "stream error";
+        }
+        else if (!cam.get_parameters().trigger_mode)
+        {
+            // A stream that just started gets a full timeout for its first frame, and so does a camera that streamed
+            // before it was stopped and started again
+            int64_t reference_ns = std::max(watch_start_ns, incident.last_frame_ns);
+            if (now_ns - reference_ns > stall_timeout_ns())
+            {
+                incident.cause = "stall";
+            }
+        }
+        seen_stream_errors = snapshot.stream_errors;
+
+        if (incident.cause.empty())
+            continue;
+
+        handle_incident(incident);
+        seen_stream_errors = metrics->snapshot().stream_errors;
+        watch_start_ns = monotonic_ns();
+    }
+}
+
+void StreamSupervisor::handle_incident(Incident incident)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.incidents;
+        stats.recovering = true;
+    }
+
+    std::shared_ptr<const CameraMetrics> metrics = cam.get_metrics();
+    while (true)
+    {
+        uint64_t frames_before = metrics->snapshot().frames_received;
+        ++incident.attempts;
+        try
+        {
+            cam.recover();
+        }
+        catch (const std::exception& e)
+        {
+            if (incident.attempts == 1)
+            {
+                std::cerr << "StreamSupervisor: recovery after " << incident.cause << " failed: " << e.what()
+                          << std::endl;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++stats.failed_attempts;
+            }
+            if (wait(options.retry_interval_ms))
+                return;
+            continue;
+        }
+
+        // Recovery is done once frames flow again
+        int64_t deadline_ns = monotonic_ns() + stall_timeout_ns();
+        bool resumed = !cam.is_streaming();
+        while (!resumed && monotonic_ns() < deadline_ns)
+        {
+            if (wait(options.poll_interval_ms))
+                return;
+            CameraMetricsSnapshot snapshot = metrics->snapshot();
+            if (snapshot.frames_received > frames_before)
+            {
+                incident.resumed_ns = frame_time_ns(snapshot, monotonic_ns());
+                resumed = true;
+            }
+        }
+        if (resumed)
+            break;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.failed_attempts;
+    }
+
+    if (incident.resumed_ns == 0)
+    {
+        incident.resumed_ns = monotonic_ns();
+    }
+    int64_t start_ns = incident.last_frame_ns != 0 ? incident.last_frame_ns : incident.detected_ns;
+    incident.downtime_ms = (incident.resumed_ns - start_ns) / 1e6;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.recoveries;
+        stats.last_downtime_ms = incident.downtime_ms;
+        stats.max_downtime_ms = std::max(stats.max_downtime_ms, incident.downtime_ms);
+        stats.total_downtime_ms += incident.downtime_ms;
+        stats.recovering = false;
+        stats.last_incident = incident;
+    }
+
+    if (on_recovered)
+    {
+        on_recovered(incident);
+    }
+}
@@ -0,0 +1,192 @@
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "telicam_trace.hpp"
+
+namespace
+{
+struct TraceEvent
+{
+    const char* name;
+    int camera_id;
+    uint64_t frame_id;
+    int64_t start_ns;
+    int64_t end_ns;
+};
+
+/**
+ * @brief Ring slot guarded by a sequence number, so that a reader never sees an event the owner is rewriting. All
+ * fields are atomics, written and read relaxed between the sequence number updates.
+ */
+struct TraceSlot
+{
+    std::atomic<uint64_t> sequence{0}; // Ring index + 1 of the event held, 0 while it is being written
+    std::atomic<const char*> name;
+    std::atomic<int> camera_id;
+    std::atomic<uint64_t> frame_id;
+    std::atomic<int64_t> start_ns;
+    std::atomic<int64_t> end_ns;
+
+    void store(uint64_t index, const TraceEvent& event)
+    {
+        sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        name.store(event.name, std::memory_order_relaxed);
+        camera_id.store(event.camera_id, std::memory_order_relaxed);
+        frame_id.store(event.frame_id, std::memory_order_relaxed);
+        start_ns.store(event.start_ns, std::memory_order_relaxed);
+        end_ns.store(event.end_ns, std::memory_order_relaxed);
+        sequence.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Copy the event at a ring index. Fails if the slot holds another event, or was rewritten during the copy.
+     */
+    bool load(uint64_t index, TraceEvent& event) const
+    {
+        if (sequence.load(std::memory_order_acquire) != index + 1)
+            return false;
+
+        event.name = name.load(std::memory_order_relaxed);
+        event.camera_id = camera_id.load(std::memory_order_relaxed);
+        event.frame_id = frame_id.load(std::memory_order_relaxed);
+        event.start_ns = start_ns.load(std::memory_order_relaxed);
+        event.end_ns = end_ns.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence.load(std::memory_order_relaxed) == index + 1;
+    }
+};
+
+/**
+ * @brief Single-producer ring owned by one thread. Readers skip slots the owner overwrote or is overwriting.
+ */
+struct TraceRing
+{
+    static const size_t CAPACITY = 1 << 16;
+
+    std::unique_ptr<TraceSlot[]> slots{new TraceSlot[CAPACITY]};
+    std::atomic<uint64_t> write_index{0};
+    long tid = 0;
+    std::string thread_name;
+};
+
+std::mutex rings_mutex;
+std::vector<std::shared_ptr<TraceRing>> rings; // Kept after their thread exits so its spans can still be dumped
+
+TraceRing& get_thread_ring()
+{
+    thread_local std::shared_ptr<TraceRing> ring;
+    if (!ring)
+    {
+        ring = std::make_shared<TraceRing>();
+        ring->tid = syscall(SYS_gettid);
+
+        char name[16] = {0};
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        ring->thread_name = name;
+
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(ring);
+    }
+    return *ring;
+}
+
+void write_json_string(std::ostream& out, const std::string& value)
+{
+    out << '"';
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) >= 0x20)
+            out << c;
+    }
+    out << '"';
+}
+} // namespace
+
+std::atomic<bool> Tracer::enabled(false);
+std::atomic<int64_t> Tracer::start_ns(0);
+
+void Tracer::start()
+{
+    start_ns = monotonic_ns();
+    enabled = true;
+}
+
+void Tracer::stop()
+{
+    enabled = false;
+}
+
+void Tracer::record(const char* name, int camera_id, uint64_t frame_id, int64_t start_ns, int64_t end_ns)
+{
+    TraceRing& ring = get_thread_ring();
+    uint64_t index = ring.write_index.load(std::memory_order_relaxed);
+    ring.slots[index % TraceRing::CAPACITY].store(index, TraceEvent{name, camera_id, frame_id, start_ns, end_ns});
+    ring.write_index.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::dump(const std::string& filename)
+{
+    std::vector<std::shared_ptr<TraceRing>> current_rings;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        current_rings = rings;
+    }
+
+    std::ofstream out(filename);
+    if (!out)
+    {
+        throw std::runtime_error("Failed to open trace file " + filename);
+    }
+
+    int64_t trace_start_ns = start_ns.load();
+    long pid = getpid();
+    bool first = true;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const auto& ring : current_rings)
+    {
+        uint64_t end = ring->write_index.load(std::memory_order_acquire);
+        uint64_t begin = end > TraceRing::CAPACITY ? end - TraceRing::CAPACITY : 0;
+
+        // The owning thread may keep writing while we copy. Events it overwrites are skipped.
+        std::vector<TraceEvent> events;
+        TraceEvent event;
+        for (uint64_t i = begin; i < end; ++i)
+        {
+            if (ring->slots[i % TraceRing::CAPACITY].load(i, event))
+            {
+                events.push_back(event);
+            }
+        }
+
+        out << (first ? "" : ",") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid
+            << ",\"tid\":" << ring->tid << ",\"args\":{\"name\":";
+        write_json_string(out, ring->thread_name.empty() ? "thread " + std::to_string(ring->tid) : ring->thread_name);
+        out << "}}";
+        first = false;
+
+        for (const auto& event : events)
+        {
+            if (event.start_ns < trace_start_ns)
+                continue;
+
+            out << ",{\"ph\":\"X\",\"cat\":\"telicam\",\"name\":";
+            write_json_string(out, event.name);
+            out << ",\"pid\":" << pid << ",\"tid\":" << ring->tid << ",\"ts\":" << event.start_ns / 1000
+                << "." << (event.start_ns / 100) % 10 << ",\"dur\":" << (event.end_ns - event.start_ns) / 1000
+                << "." << ((event.end_ns - event.start_ns) / 100) % 10 << ",\"args\":{\"camera\":" << event.camera_id
+                << ",\"frame\":" << event.frame_id << "}}";
+        }
+    }
+    out << "]}" << std::endl;
+}
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "telicam_undistort.hpp"
+
+// Tiles are small enough that a tile's source and destination rows stay in L2, and numerous enough to balance
+static const int TILE_WIDTH = 256;
+static const int TILE_HEIGHT = 32;
+
+static const uint32_t CACHE_MAGIC = 0x44554354; // "TCUD"
+static const uint32_t CACHE_VERSION = 1;
+
+namespace
+{
+struct CacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint64_t key;
+};
+
+class Fnv1a
+{
+  public:
+    void add(const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+        }
+    }
+
+    template <typename T> void add(const T& value)
+    {
+        add(&value, sizeof(value));
+    }
+
+    uint64_t get() const
+    {
+        return hash;
+    }
+
+  private:
+    uint64_t hash = 0xcbf29ce484222325ULL;
+};
+} // namespace
+
+/**
+ * @brief Camera matrix of the calibration, scaled to the frame size. Pixel centers are kept aligned, so the principal
+ * point is scaled as (c + 0.5) * s - 0.5.
+ */
+static cv::Mat scaled_camera_matrix(const CameraCalibration& calibration, cv::Size frame_size)
+{
+    if (calibration.camera_matrix.size() != 9)
+    {
+        throw std::runtime_error("Undistorter: camera_matrix must have 9 elements");
+    }
+
+    cv::Mat camera_matrix(3, 3, CV_64F);
+    std::copy(calibration.camera_matrix.begin(), calibration.camera_matrix.end(), camera_matrix.ptr<double>());
+
+    cv::Size image_size = calibration.image_size.area() > 0 ? calibration.image_size : frame_size;
+    double scale_x = static_cast<double>(frame_size.width) / image_size.width;
+    double scale_y = static_cast<double>(frame_size.height) / image_size.height;
+    camera_matrix.at<double>(0, 0) *= scale_x;
+    camera_matrix.at<double>(0, 2) = (camera_matrix.at<double>(0, 2) + 0.5) * scale_x - 0.5;
+    camera_matrix.at<double>(1, 1) *= scale_y;
+    camera_matrix.at<double>(1, 2) = (camera_matrix.at<double>(1, 2) + 0.5) * scale_y - 0.5;
+    return camera_matrix;
+}
+
+Undistorter::Undistorter(const CameraCalibration& calibration, cv::Size frame_size, const std::string& cache_dir)
+    : frame_size(frame_size)
+    , cached(false)
+{
+    if (frame_size.area() <= 0)
+    {
+        throw std::runtime_error("Undistorter: empty frame size");
+    }
+
+    cv::Mat camera_matrix = scaled_camera_matrix(calibration, frame_size);
+    cv::Mat distortion(calibration.distortion_coefficients, true);
+
+    // The interpolation table layout is OpenCV's, so its version is part of the key
+    Fnv1a hash;
+    hash.add(CACHE_VERSION);
+    hash.add(frame_size.width);
+    hash.add(frame_size.height);
+    hash.add(camera_matrix.ptr<double>(), 9 * sizeof(double));
+    hash.add(calibration.distortion_coefficients.data(), calibration.distortion_coefficients.size() * sizeof(double));
+    hash.add(CV_VERSION, std::strlen(CV_VERSION));
+    key = hash.get();
+
+    std::string filename;
+    if (!cache_dir.empty())
+    {
+        std::ostringstream name;
+        name << cache_dir << "/undistort_" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+        filename = name.str();
+        cached = load(filename);
+    }
+
+    if (!cached)
+    {
+        cv::initUndistortRectifyMap(camera_matrix, distortion, cv::Mat(), camera_matrix, frame_size, CV_16SC2, map_xy,
+                                    map_interpolation);
+        if (!filename.empty())
+        {
+            save(filename);
+        }
+    }
+}
+
+void Undistorter::apply(const cv::Mat& src, cv::Mat& dst) const
+{
+    CV_Assert(src.type() == CV_8UC3 && src.size() == frame_size);
+    CV_Assert(dst.type() == CV_8UC3 && dst.size() == frame_size && dst.data != src.data);
+
+    int tiles_x = (frame_size.width + TILE_WIDTH - 1) / TILE_WIDTH;
+    int tiles_y = (frame_size.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+
+    // The maps hold absolute source positions, so each tile remaps from the whole source into its part of dst
+    cv::parallel_for_(cv::Range(0, tiles_x * tiles_y), [&](const cv::Range& range) {
+        for (int tile = range.start; tile < range.end; ++tile)
+        {
+            int x = (tile % tiles_x) * TILE_WIDTH;
+            int y = (tile / tiles_x) * TILE_HEIGHT;
+            cv::Rect rect(x, y, std::min(TILE_WIDTH, frame_size.width - x),
+                          std::min(TILE_HEIGHT, frame_size.height - y));
+
+            cv::Mat dst_tile = dst(rect);
+            cv::remap(src, dst_tile, map_xy(rect), map_interpolation(rect), cv::INTER_LINEAR, cv::BORDER_CONSTANT,
+                      cv::Scalar());
+        }
+    });
+}
+
+cv::Size Undistorter::get_frame_size() const
+{
+    return frame_size;
+}
+
+bool Undistorter::is_cached() const
+{
+    return cached;
+}
+
+bool Undistorter::load(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        return false;
+
+    CacheHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.key != key ||
+        header.width != frame_size.width || header.height != frame_size.height)
+    {
+        return false;
+    }
+
+    cv::Mat xy(frame_size, CV_16SC2);
+    cv::Mat interpolation(frame_size, CV_16UC1);
+    file.read(reinterpret_cast<char*>(xy.data), xy.total() * xy.elemSize());
+    file.read(reinterpret_cast<char*>(interpolation.data), interpolation.total() * interpolation.elemSize());
+    if (!file)
+        return false;
+
+    map_xy = xy;
+    map_interpolation = interpolation;
+    return true;
+}
+
+void Undistorter::save(const std::string& filename) const
+{
+    CacheHeader header;
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.width = frame_size.width;
+    header.height = frame_size.height;
+    header.key = key;
+
+    // Write then rename, so that a process starting concurrently never loads a partial file
+    std::string temporary = filename + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(map_xy.data), map_xy.total() * map_xy.elemSize());
+        file.write(reinterpret_cast<const char*>(map_interpolation.data),
+                   map_interpolation.total() * map_interpolation.elemSize());
+        if (!file)
+        {
+            std::cerr << "Undistorter: failed to write " << temporary << std::endl;
+            std::remove(temporary.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+        std::cerr << "Undistorter: failed to rename " << temporary << ": " << std::strerror(errno) << std::endl;
+        std::remove(temporary.c_str());
+    }
+}
@@ -1,10 +1,20 @@
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <sstream>
 #include <thread>
 #include <vector>
 
+#include <sys/resource.h>
+#include <unistd.h>
+
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -13,6 +23,15 @@
 #include <nlohmann/json.hpp>
 
 #include "telicam.hpp"
+#include "telicam_change.hpp"
+#include "telicam_exposure.hpp"
+#include "telicam_hdr.hpp"
+#include "telicam_recorder.hpp"
+#include "telicam_supervisor.hpp"
+#include "telicam_group.hpp"
+#include "telicam_metrics.hpp"
+#include "telicam_trace.hpp"
+#include "telicam_viewer_utils.hpp"
 #include "uuid.hpp"
 
 using namespace std;
@@ -23,8 +42,115 @@ struct ViewerTeliCamParams
     int cam_id;
     TeliCam::Parameters camera_params;
     int downscale_factor;
+    bool auto_exposure = false;
+    AutoExposureController::Options auto_exposure_options;
+    bool hdr = false; // Bracket exposures and display the merged frames
+    ExposureBracketer::Options hdr_options;
+    bool change_detection = false; // Gate recording on activity
+    ChangeDetector::Options change_options;
+    uint32_t pre_roll_frames = 0;
+};
+
+// Set by SIGUSR1 so a trace can be started or stopped from outside the process
+static std::atomic<bool> trace_toggle_requested(false);
+
+static void request_trace_toggle(int)
+{
+    trace_toggle_requested = true;
+}
+
+// Set by SIGINT and SIGTERM so a headless run can be ended early and still write its summary
+static std::atomic<bool> stop_requested(false);
+
+static void request_stop(int)
+{
+    stop_requested = true;
+}
+
+/**
+ * @brief Latencies of one camera's frames, collected by a frame listener during a headless run.
+ */
+/**
+ * @brief Uniform random sample of at most CAPACITY latencies, so that a run of any length keeps a fixed amount of
+ * memory and never allocates on the frame path. The count and maximum cover every latency.
+ */
+struct LatencyReservoir
+{
+    static const size_t CAPACITY = 1 << 16;
+
+    LatencyReservoir()
+    {
+        samples.reserve(CAPACITY);
+    }
+
+    void add(double sample)
+    {
+        count++;
+        max = std::max(max, sample);
+        if (samples.size() < CAPACITY)
+        {
+            samples.push_back(sample);
+            return;
+        }
+
+        // Replaces a sample with probability CAPACITY / count
+        uint64_t index = std::uniform_int_distribution<uint64_t>(0, count - 1)(rng);
+        if (index < CAPACITY)
+        {
+            samples[index] = sample;
+        }
+    }
+
+    std::vector<double> samples;
+    uint64_t count = 0;
+    double max = 0.0;
+    std::minstd_rand rng;
+};
+
+struct LatencySamples
+{
+    std::mutex mutex;
+    LatencyReservoir processing_ms; // SDK callback to publish
+    LatencyReservoir end_to_end_ms; // Exposure to publish, for frames whose camera clock is synced
 };
 
+/**
+ * @brief Summarize latency samples as percentiles, or null if there are none.
+ */
+static json percentiles(const LatencyReservoir& reservoir)
+{
+    if (reservoir.samples.empty())
+        return nullptr;
+
+    std::vector<double> samples = reservoir.samples;
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) { return samples[static_cast<size_t>(p * (samples.size() - 1))]; };
+    return json{{"p50", percentile(0.5)},
+                {"p90", percentile(0.9)},
+                {"p99", percentile(0.99)},
+                {"max", reservoir.max},
+                {"count", reservoir.count}};
+}
+
+static double to_seconds(const timeval& time)
+{
+    return time.tv_sec + time.tv_usec / 1e6;
+}
+
+void write_trace(const std::string& filename)
+{
+    Tracer::stop();
+    try
+    {
+        Tracer::dump(filename);
+        std::cout << "Trace written to " << filename << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
 std::vector<ViewerTeliCamParams> read_config(std::string filename)
 {
     std::ifstream file(filename);
@@ -60,9 +186,103 @@ std::vector<ViewerTeliCamParams> read_config(std::string filename)
         params.camera_params.reverse_x = params_json["reverse_x"].get<bool>();
         params.camera_params.reverse_y = params_json["reverse_y"].get<bool>();
         params.camera_params.trigger_mode = params_json["trigger_mode"].get<bool>();
+        params.camera_params.use_worker_thread = params_json.value("use_worker_thread", false);
+        params.camera_params.worker_cpu_affinity = params_json.value("worker_cpu_affinity", std::vector<int>());
+        params.camera_params.worker_priority = params_json.value("worker_priority", 0);
+        params.camera_params.numa_local_buffers = params_json.value("numa_local_buffers", true);
+        params.camera_params.frame_pool_size = params_json.value("frame_pool_size", 4u);
+        params.camera_params.use_huge_pages = params_json.value("use_huge_pages", false);
+        params.camera_params.lock_frame_memory = params_json.value("lock_frame_memory", false);
+        params.camera_params.compute_statistics = params_json.value("compute_statistics", false);
+        params.camera_params.statistics_subsample = params_json.value("statistics_subsample", 1u);
+        if (params_json.contains("statistics_roi"))
+        {
+            std::vector<int> roi = params_json["statistics_roi"].get<std::vector<int>>();
+            params.camera_params.statistics_roi = cv::Rect(roi.at(0), roi.at(1), roi.at(2), roi.at(3));
+        }
+        params.camera_params.denoise = params_json.value("denoise", false);
+        params.camera_params.denoise_strength = params_json.value("denoise_strength", 2u);
+        params.camera_params.denoise_motion_threshold = params_json.value("denoise_motion_threshold", 16u);
+        params.camera_params.clock_sync_interval_ms = params_json.value("clock_sync_interval_ms", 1000u);
+        params.camera_params.undistort_cache_dir = params_json.value("undistort_cache_dir", std::string());
+        if (params_json.contains("regions"))
+        {
+            for (const json& region_json : params_json["regions"])
+            {
+                std::vector<int> rect = region_json["rect"].get<std::vector<int>>();
+                RegionOfInterest region;
+                region.name = region_json["name"].get<std::string>();
+                region.rect = cv::Rect(rect.at(0), rect.at(1), rect.at(2), rect.at(3));
+                params.camera_params.regions.push_back(region);
+            }
+        }
+        params.camera_params.convert_regions_only = params_json.value("convert_regions_only", false);
 
         params.downscale_factor = cam["downscale_factor"].get<int>();
 
+        if (cam.contains("calibration"))
+        {
+            const json& calibration_json = cam["calibration"];
+            CameraCalibration& calibration = params.camera_params.calibration;
+            calibration.camera_matrix = calibration_json["camera_matrix"].get<std::vector<double>>();
+            calibration.distortion_coefficients =
+                calibration_json.value("distortion_coefficients", std::vector<double>());
+            if (calibration_json.contains("image_size"))
+            {
+                std::vector<int> image_size = calibration_json["image_size"].get<std::vector<int>>();
+                calibration.image_size = cv::Size(image_size.at(0), image_size.at(1));
+            }
+        }
+
+        if (cam.contains("auto_exposure"))
+        {
+            const json& ae_json = cam["auto_exposure"];
+            AutoExposureController::Options& ae = params.auto_exposure_options;
+            ae.target_luma = ae_json.value("target_luma", ae.target_luma);
+            ae.tolerance = ae_json.value("tolerance", ae.tolerance);
+            ae.adjust_exposure = ae_json.value("adjust_exposure", ae.adjust_exposure);
+            ae.adjust_gain = ae_json.value("adjust_gain", ae.adjust_gain);
+            ae.max_exposure_time = ae_json.value("max_exposure_time", ae.max_exposure_time);
+            ae.max_gain = ae_json.value("max_gain", ae.max_gain);
+            ae.settle_frames = ae_json.value("settle_frames", ae.settle_frames);
+            ae.min_update_interval_ms = ae_json.value("min_update_interval_ms", ae.min_update_interval_ms);
+
+            params.auto_exposure = true;
+            params.camera_params.compute_statistics = true;
+            params.camera_params.auto_gain = false;
+        }
+
+        if (cam.contains("hdr"))
+        {
+            const json& hdr_json = cam["hdr"];
+            ExposureBracketer::Options& hdr = params.hdr_options;
+            hdr.exposure_times = hdr_json["exposure_times"].get<std::vector<double>>();
+            hdr.latency_frames = hdr_json.value("latency_frames", hdr.latency_frames);
+            params.hdr = true;
+
+            // Bracketing owns the exposure time
+            if (params.auto_exposure)
+            {
+                std::cerr << "Camera " << params.cam_id << ": auto_exposure is ignored with hdr" << std::endl;
+                params.auto_exposure = false;
+            }
+        }
+
+        if (cam.contains("change_detection"))
+        {
+            const json& change_json = cam["change_detection"];
+            ChangeDetector::Options& change = params.change_options;
+            change.grid_step = change_json.value("grid_step", change.grid_step);
+            change.pixel_threshold = change_json.value("pixel_threshold", change.pixel_threshold);
+            change.start_fraction = change_json.value("start_fraction", change.start_fraction);
+            change.stop_fraction = change_json.value("stop_fraction", change.stop_fraction);
+            change.start_frames = change_json.value("start_frames", change.start_frames);
+            change.post_roll_frames = change_json.value("post_roll_frames", change.post_roll_frames);
+            change.reference_shift = change_json.value("reference_shift", change.reference_shift);
+            params.pre_roll_frames = change_json.value("pre_roll_frames", params.pre_roll_frames);
+            params.change_detection = true;
+        }
+
         all_params.push_back(params);
     }
 
@@ -80,14 +300,79 @@ int main(int argc, char** argv)
     std::vector<int> cam_ids;
     bool capture_mode = false;
     int refresh_rate = 30;
+    std::string trace_filename;
+    double trace_duration = 10.0;
+    MetricsExporter::Options metrics_options;
+    std::string record_prefix;
+    bool save_on_change = false;
+    bool show_regions = false;
+    bool preview = false;
+    bool supervise = false;
+    bool headless = false;
+    double duration_s = 0.0;
+    uint64_t frame_count = 0;
+    double timeout_s = 60.0;
+    std::string summary_filename;
 
     app.add_option("--cam", cam_ids, "List of camera IDs to ppen")->required();
     app.add_option("--config", config_filename, "Configuration file")->required()->check(CLI::ExistingFile);
-    app.add_flag("--capture", capture_mode, "Capture mode")->default_val(false);
+    CLI::Option* capture_option = app.add_flag("--capture", capture_mode, "Capture mode")->default_val(false);
     app.add_option("--refresh", refresh_rate, "Refresh rate (Hz)")->default_val(30);
+    app.add_option("--trace", trace_filename, "Trace from startup and write Chrome trace JSON to this file");
+    app.add_option("--trace-duration", trace_duration, "Seconds per trace, or 0 to trace until toggled off")
+        ->default_val(10.0);
+    app.add_option("--metrics-port", metrics_options.http_port, "Serve Prometheus metrics on this loopback port");
+    app.add_option("--metrics-file", metrics_options.filename, "Periodically write Prometheus metrics to this file");
+    app.add_option("--metrics-interval", metrics_options.file_interval_s, "Seconds between metrics file writes")
+        ->default_val(5.0);
+
+    app.add_option("--record", record_prefix, "Record raw frames losslessly to <prefix>_cam<id>.tcr");
+    CLI::Option* save_on_change_option =
+        app.add_flag("--save-on-change", save_on_change, "Save displayed frames to ./data while a change is detected")
+            ->default_val(false);
+    CLI::Option* preview_option =
+        app.add_flag("--preview", preview, "Start in the preview profile, binned and decimated on the camera")
+            ->default_val(false);
+
+    // A supervisor reopens cameras in their configured profile, so profile switches are left to it
+    app.add_flag("--supervise", supervise, "Reopen cameras whose stream stalls or fails, without restarting the viewer")
+        ->default_val(false)
+        ->excludes(preview_option);
+    app.add_flag("--show-regions", show_regions, "Outline each camera's regions of interest")->default_val(false);
+
+    CLI::Option* headless_option =
+        app.add_flag("--headless", headless, "Stream without a display, and print a JSON summary on exit")
+            ->default_val(false)
+            ->excludes(capture_option)
+            ->excludes(save_on_change_option);
+    app.add_option("--duration", duration_s, "Seconds a headless run lasts. Defaults to 10 without --frames")
+        ->needs(headless_option);
+    app.add_option("--frames", frame_count, "End a headless run once every camera has received this many frames")
+        ->needs(headless_option);
+    app.add_option("--timeout", timeout_s, "Seconds a headless run without --duration waits for --frames")
+        ->default_val(60.0)
+        ->needs(headless_option);
+    app.add_option("--summary", summary_filename, "Write the headless summary to this file instead of stdout")
+        ->needs(headless_option);
 
     CLI11_PARSE(app, argc, argv);
 
+    if (headless && duration_s <= 0.0 && frame_count == 0)
+    {
+        duration_s = 10.0;
+    }
+
+    // In a headless run stdout only carries the JSON summary. Everything else written to it, by the viewer, the
+    // driver or the camera SDK, goes to stderr until the summary is printed.
+    int summary_fd = -1;
+    if (headless)
+    {
+        std::cout.flush();
+        std::fflush(stdout);
+        summary_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
     // Check if ./data exists, and if not create it
     std::filesystem::path data_path("./data");
     if (!std::filesystem::exists(data_path))
@@ -101,23 +386,75 @@ int main(int argc, char** argv)
     TeliCam::initialize_api();
 
     // Create cameras
-    std::vector<TeliCam> cams;
-    for (auto id : cam_ids)
-    {
-        cams.push_back(TeliCam(id));
-    }
+    TeliCamGroup cams(cam_ids);
 
     // Initialize cameras and start streams
     std::vector<ViewerTeliCamParams> params = read_config(config_filename);
-    for (int i = 0; i < cams.size(); ++i)
+    std::vector<TeliCam::Parameters> camera_params;
+    for (const auto& p : params)
+    {
+        camera_params.push_back(p.camera_params);
+    }
+    cams.initialize(camera_params);
+
+    std::vector<std::unique_ptr<FrameRecorder>> recorders;
+    if (!record_prefix.empty())
+    {
+        for (size_t i = 0; i < cams.size(); ++i)
+        {
+            std::string filename = record_prefix + "_cam" + std::to_string(cam_ids[i]) + ".tcr";
+            FrameRecorder::Options recorder_options;
+            recorder_options.record_on_change = params[i].change_detection;
+            recorder_options.change = params[i].change_options;
+            recorder_options.pre_roll_frames = params[i].pre_roll_frames;
+            recorders.emplace_back(new FrameRecorder(cams[i], filename, recorder_options));
+        }
+    }
+
+    if (!capture_mode)
+    {
+        cams.start_stream();
+    }
+
+    std::vector<std::unique_ptr<AutoExposureController>> auto_exposure_controllers;
+    for (size_t i = 0; i < cams.size(); ++i)
     {
-        cams[i].initialize(params[i].camera_params);
-        if (!capture_mode)
+        if (params[i].auto_exposure)
         {
-            cams[i].start_stream();
+            auto_exposure_controllers.emplace_back(
+                new AutoExposureController(cams[i], params[i].auto_exposure_options));
         }
     }
 
+    std::vector<std::unique_ptr<ExposureBracketer>> bracketers(cams.size());
+    for (size_t i = 0; i < cams.size(); ++i)
+    {
+        if (params[i].hdr)
+        {
+            bracketers[i].reset(new ExposureBracketer(cams[i], params[i].hdr_options));
+        }
+    }
+
+    std::vector<std::unique_ptr<StreamSupervisor>> supervisors;
+    if (supervise)
+    {
+        for (size_t i = 0; i < cams.size(); ++i)
+        {
+            int cam_id = cam_ids[i];
+            supervisors.emplace_back(new StreamSupervisor(
+                cams[i], StreamSupervisor::Options(), [cam_id](const StreamSupervisor::Incident& incident) {
+                    std::cout << "Camera " << cam_id << ": recovered from " << incident.cause << " after "
+                              << incident.downtime_ms << " ms, " << incident.attempts << " attempt(s)" << std::endl;
+                }));
+        }
+    }
+
+    std::unique_ptr<MetricsExporter> metrics_exporter;
+    if (metrics_options.http_port != 0 || !metrics_options.filename.empty())
+    {
+        metrics_exporter.reset(new MetricsExporter(MetricsRegistry::global(), metrics_options));
+    }
+
     // Print camera info
     cams[0].print_system_info();
     for (auto& cam : cams)
@@ -128,27 +465,221 @@ int main(int argc, char** argv)
     /////////////////////////////////////////////
     // Display TeliCam Streams
     /////////////////////////////////////////////
-    cv::namedWindow("TeliCam", cv::WINDOW_NORMAL);
+    if (!headless)
+    {
+        cv::namedWindow("TeliCam", cv::WINDOW_NORMAL);
+    }
 
     std::vector<cv::Mat> cam_frames(cams.size());
+    std::vector<uint64_t> cam_frame_ids(cams.size(), 0);
+    std::vector<cv::Size> display_sizes;
+    for (size_t i = 0; i < cams.size(); ++i)
+    {
+        cv::Size frame_size = cams[i].get_frame_size();
+        display_sizes.emplace_back(frame_size.width / params[i].downscale_factor,
+                                   frame_size.height / params[i].downscale_factor);
+    }
+
+    // The preview profile bins and decimates on the camera down to about the display size
+    auto toggle_preview = [&]() {
+        for (size_t i = 0; i < cams.size(); ++i)
+        {
+            int64_t start_ns = monotonic_ns();
+            if (cams[i].is_preview())
+            {
+                cams[i].set_full_profile();
+                std::cout << "Camera " << cam_ids[i] << ": full resolution";
+            }
+            else
+            {
+                PreviewProfile profile = cams[i].set_preview_profile(display_sizes[i]);
+                std::cout << "Camera " << cam_ids[i] << ": preview, binning " << profile.binning << ", decimation "
+                          << profile.decimation << ", " << profile.camera_size.width << "x"
+                          << profile.camera_size.height;
+            }
+            std::cout << " (switched in " << (monotonic_ns() - start_ns) / 1000000.0 << " ms)" << std::endl;
+        }
+    };
+    if (preview)
+    {
+        toggle_preview();
+    }
+
+    // With --save-on-change, new frames are saved while their camera's detector is active, preceded by the frames
+    // kept for pre-roll. Cameras without change_detection settings use the default detector options.
+    std::vector<std::unique_ptr<ChangeDetector>> change_detectors;
+    std::vector<std::deque<Frame>> pre_roll_frames(cams.size());
+    if (save_on_change)
+    {
+        for (size_t i = 0; i < cams.size(); ++i)
+        {
+            change_detectors.emplace_back(new ChangeDetector(params[i].change_options));
+        }
+    }
+    auto save_frame = [&](int cam_id, const Frame& frame) {
+        std::string filename =
+            "./data/cam" + std::to_string(cam_id) + "_" + std::to_string(frame.metadata.frame_id) + ".jpg";
+        TraceSpan span("snapshot_encode", cam_id, frame.metadata.frame_id);
+        cv::imwrite(filename, frame.image);
+    };
+
+    // Traces can be toggled with the t key or SIGUSR1 while the viewer is running
+    std::signal(SIGUSR1, request_trace_toggle);
+    std::string active_trace_filename;
+    int64_t trace_stop_ns = 0;
+    auto start_trace = [&](const std::string& filename) {
+        active_trace_filename = filename;
+        trace_stop_ns = monotonic_ns() + static_cast<int64_t>(trace_duration * 1e9);
+        Tracer::start();
+        std::cout << "Tracing to " << filename << std::endl;
+    };
+    auto update_trace = [&](bool toggle_trace) {
+        if (Tracer::is_enabled())
+        {
+            if (toggle_trace || (trace_duration > 0 && monotonic_ns() >= trace_stop_ns))
+            {
+                write_trace(active_trace_filename);
+            }
+        }
+        else if (toggle_trace)
+        {
+            start_trace("./data/trace_" + uuid::generate_uuid_v4() + ".json");
+        }
+    };
+    if (!trace_filename.empty())
+    {
+        start_trace(trace_filename);
+    }
+
+    // A headless run is measured from here, with every camera streaming
+    std::vector<std::shared_ptr<LatencySamples>> latencies;
+    std::vector<int> latency_listener_ids;
+    std::vector<CameraMetricsSnapshot> start_metrics;
+    rusage start_usage;
+    int64_t run_start_ns = 0;
+    if (headless)
+    {
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+        for (size_t i = 0; i < cams.size(); ++i)
+        {
+            std::shared_ptr<LatencySamples> samples = std::make_shared<LatencySamples>();
+            latencies.push_back(samples);
+            latency_listener_ids.push_back(cams[i].add_frame_listener([samples](const Frame& frame) {
+                std::lock_guard<std::mutex> lock(samples->mutex);
+                samples->processing_ms.add((frame.metadata.publish_ns - frame.metadata.receive_ns) / 1e6);
+                if (frame.metadata.exposure_uncertainty_ns >= 0)
+                {
+                    samples->end_to_end_ms.add((frame.metadata.publish_ns - frame.metadata.exposure_ns) / 1e6);
+                }
+            }));
+            start_metrics.push_back(cams[i].get_metrics()->snapshot());
+        }
+        getrusage(RUSAGE_SELF, &start_usage);
+        run_start_ns = monotonic_ns();
+    }
+
     char key = 0;
+    uint64_t display_count = 0;
+    std::string ended_by; // Why a headless run ended
     while (key != 27)
     {
+        // Headless runs skip all display work, and end after their duration or frame count
+        if (headless)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            update_trace(trace_toggle_requested.exchange(false));
+
+            bool all_received = frame_count > 0;
+            for (size_t i = 0; i < cams.size() && all_received; ++i)
+            {
+                uint64_t frames_received = cams[i].get_metrics()->snapshot().frames_received;
+                all_received = frames_received - start_metrics[i].frames_received >= frame_count;
+            }
+
+            // Without a duration, a camera that never delivers its frames would keep the run going forever
+            double run_s = (monotonic_ns() - run_start_ns) / 1e9;
+            if (stop_requested)
+            {
+                ended_by = "signal";
+            }
+            else if (all_received)
+            {
+                ended_by = "frames";
+            }
+            else if (duration_s > 0.0 && run_s >= duration_s)
+            {
+                ended_by = "duration";
+            }
+            else if (duration_s <= 0.0 && run_s >= timeout_s)
+            {
+                ended_by = "timeout";
+            }
+            if (!ended_by.empty())
+                break;
+            continue;
+        }
+
         for (int i = 0; i < cams.size(); ++i)
         {
-            cam_frames[i] = cams[i].get_last_frame();
+            Frame cam_frame = cams[i].get_last_frame_with_metadata();
+            bool new_frame = !cam_frame.image.empty() && cam_frame.metadata.frame_id != cam_frame_ids[i];
+            cam_frames[i] = cam_frame.image;
+            cam_frame_ids[i] = cam_frame.metadata.frame_id;
 
-            // Downscale frame by downscale_factor
-            int new_width = cam_frames[i].cols / params[i].downscale_factor;
-            int new_height = cam_frames[i].rows / params[i].downscale_factor;
+            if (save_on_change && new_frame)
+            {
+                if (change_detectors[i]->update(cam_frame.image).active)
+                {
+                    for (const Frame& pre_roll_frame : pre_roll_frames[i])
+                    {
+                        save_frame(cam_ids[i], pre_roll_frame);
+                    }
+                    pre_roll_frames[i].clear();
+                    save_frame(cam_ids[i], cam_frame);
+                }
+                else if (params[i].pre_roll_frames > 0)
+                {
+                    pre_roll_frames[i].push_back(cam_frame);
+                    if (pre_roll_frames[i].size() > params[i].pre_roll_frames)
+                    {
+                        pre_roll_frames[i].pop_front();
+                    }
+                }
+            }
+
+            // Bracketed cameras show their last merged frame
+            if (bracketers[i])
+            {
+                BracketedFrame merged = bracketers[i]->get_last_merged();
+                if (!merged.image.empty())
+                {
+                    cam_frames[i] = merged.image;
+                }
+            }
 
-            cv::resize(cam_frames[i], cam_frames[i], cv::Size(new_width, new_height));
+            // Outline the regions of interest on a copy, as the frame may be kept for pre-roll
+            if (show_regions && !cam_frame.regions.empty())
+            {
+                cam_frames[i] = cam_frames[i].clone();
+                for (const FrameRegion& region : cam_frame.regions)
+                {
+                    if (region.image.empty())
+                        continue;
+                    cv::Size whole_size;
+                    cv::Point offset;
+                    region.image.locateROI(whole_size, offset);
+                    cv::rectangle(cam_frames[i], cv::Rect(offset, region.image.size()), cv::Scalar(0, 255, 0), 2);
+                }
+            }
         }
 
-        // Dislay side by side
         cv::Mat frame;
-        cv::hconcat(cam_frames, frame);
-        cv::imshow("TeliCam", frame);
+        compose_frames(cam_frames, display_sizes, frame);
+        {
+            TraceSpan span("imshow", -1, display_count++);
+            cv::imshow("TeliCam", frame);
+        }
 
         key = cv::waitKey(1);
         std::this_thread::sleep_for(std::chrono::milliseconds((int)(1 / refresh_rate)));
@@ -156,32 +687,153 @@ int main(int argc, char** argv)
         // If key equals spacebar
         if (capture_mode && key == 32)
         {
-            for (auto& cam : cams)
-            {
-                cam.capture_frame();
-            }
+            cams.capture_frame();
         }
 
         // If key equals g, write last captured frame to the disk
         if (key == 103)
         {
-            for (auto& cam : cams)
+            for (size_t i = 0; i < cams.size(); ++i)
             {
                 std::string guid = uuid::generate_uuid_v4();
                 std::stringstream filename;
                 filename << "./data/" << guid << ".jpg";
-                cv::imwrite(filename.str(), cam.get_last_frame());
+                Frame snapshot = cams[i].get_last_frame_with_metadata();
+
+                TraceSpan span("snapshot_encode", cam_ids[i], snapshot.metadata.frame_id);
+                cv::imwrite(filename.str(), snapshot.image);
             }
         }
+
+        // If key equals p, switch between the preview and full resolution profiles, unless supervised
+        if (key == 'p' && supervise)
+        {
+            std::cout << "Preview profile switching is disabled with --supervise" << std::endl;
+        }
+        else if (key == 'p')
+        {
+            toggle_preview();
+        }
+
+        // If key equals t or SIGUSR1 was received, start or stop a trace
+        update_trace(key == 't' || trace_toggle_requested.exchange(false));
+    }
+
+    if (Tracer::is_enabled())
+    {
+        write_trace(active_trace_filename);
+    }
+
+    json summary;
+    if (headless)
+    {
+        double elapsed_s = (monotonic_ns() - run_start_ns) / 1e9;
+        rusage end_usage;
+        getrusage(RUSAGE_SELF, &end_usage);
+        double user_s = to_seconds(end_usage.ru_utime) - to_seconds(start_usage.ru_utime);
+        double system_s = to_seconds(end_usage.ru_stime) - to_seconds(start_usage.ru_stime);
+
+        summary["duration_s"] = elapsed_s;
+        summary["ended_by"] = ended_by;
+        if (frame_count > 0)
+        {
+            summary["target_frames"] = frame_count;
+        }
+        summary["cpu"] = {{"user_s", user_s}, {"system_s", system_s}, {"cores", (user_s + system_s) / elapsed_s}};
+        summary["peak_rss_mb"] = end_usage.ru_maxrss / 1024.0; // ru_maxrss is in KiB
+        summary["cameras"] = json::array();
+        for (size_t i = 0; i < cams.size(); ++i)
+        {
+            cams[i].remove_frame_listener(latency_listener_ids[i]);
+            CameraMetricsSnapshot end_metrics = cams[i].get_metrics()->snapshot();
+            uint64_t frames = end_metrics.frames_received - start_metrics[i].frames_received;
+
+            json camera;
+            camera["cam_id"] = cam_ids[i];
+            camera["frames"] = frames;
+            camera["fps"] = frames / elapsed_s;
+            if (frame_count > 0)
+            {
+                camera["missing_frames"] = frames < frame_count ? frame_count - frames : 0;
+            }
+            camera["configured_fps"] = params[i].camera_params.framerate;
+            camera["dropped"] = end_metrics.frames_dropped - start_metrics[i].frames_dropped;
+            camera["incomplete"] = end_metrics.frames_incomplete - start_metrics[i].frames_incomplete;
+            camera["stream_errors"] = end_metrics.stream_errors - start_metrics[i].stream_errors;
+            {
+                std::lock_guard<std::mutex> lock(latencies[i]->mutex);
+                camera["latency_ms"] = percentiles(latencies[i]->processing_ms);
+                camera["end_to_end_latency_ms"] = percentiles(latencies[i]->end_to_end_ms);
+            }
+            if (!recorders.empty())
+            {
+                FrameRecorder::Stats stats = recorders[i]->get_stats();
+                camera["recorder"] = {{"frames_written", stats.frames_written},
+                                      {"frames_dropped", stats.frames_dropped},
+                                      {"frames_skipped", stats.frames_skipped}};
+            }
+            summary["cameras"].push_back(camera);
+        }
     }
 
     // Destroy cameras
     for (auto& cam : cams)
     {
-        cam.destroy();
+        cam.print_timing_stats();
+    }
+    for (size_t i = 0; i < recorders.size(); ++i)
+    {
+        FrameRecorder::Stats stats = recorders[i]->get_stats();
+        double ratio = stats.compressed_bytes > 0 ? static_cast<double>(stats.raw_bytes) / stats.compressed_bytes : 0.0;
+        std::cout << "Recorder " << cam_ids[i] << ": " << stats.frames_written << " frames written, "
+                  << stats.frames_dropped << " dropped, " << stats.frames_skipped << " skipped, compression ratio "
+                  << ratio << std::endl;
     }
+    for (size_t i = 0; i < supervisors.size(); ++i)
+    {
+        StreamSupervisor::Stats stats = supervisors[i]->get_stats();
+        std::cout << "Supervisor " << cam_ids[i] << ": " << stats.incidents << " incidents, " << stats.recoveries
+                  << " recovered, " << stats.failed_attempts << " failed attempts, downtime " << stats.total_downtime_ms
+                  << " ms total, " << stats.max_downtime_ms << " ms max" << std::endl;
+    }
+    for (size_t i = 0; i < bracketers.size(); ++i)
+    {
+        if (!bracketers[i])
+            continue;
+        ExposureBracketer::Stats stats = bracketers[i]->get_stats();
+        std::cout << "HDR " << cam_ids[i] << ": " << stats.sets_merged << " sets merged at " << stats.merged_fps
+                  << " fps, " << stats.mean_merge_ms << " ms mean merge, " << stats.sets_dropped << " dropped, "
+                  << stats.sets_broken << " broken" << std::endl;
+    }
+    supervisors.clear();
+    bracketers.clear();
+    recorders.clear();
+    metrics_exporter.reset();
+    auto_exposure_controllers.clear();
+    cams.destroy();
 
     TeliCam::close_api();
 
-    return 0;
+    // The summary comes last, so it can be parsed from the end of the output
+    if (headless)
+    {
+        std::cout.flush();
+        std::fflush(stdout);
+        dup2(summary_fd, STDOUT_FILENO);
+        close(summary_fd);
+
+        if (summary_filename.empty())
+        {
+            std::cout << summary.dump(2) << std::endl;
+        }
+        else
+        {
+            std::ofstream file(summary_filename);
+            file << summary.dump(2) << std::endl;
+            std::cerr << "Summary written to " << summary_filename << std::endl;
+        }
+    }
+
+    // A headless run that gave up waiting for its frames failed
+    return ended_by == "timeout" ? 1 : 0;
 }
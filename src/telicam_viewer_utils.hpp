@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "telicam_trace.hpp"
+
+/**
+ * @brief Resize each camera frame in place to its display size and lay them out side by side. Frames that already
+ * have their display size, e.g. from a preview profile, are not resized.
+ *
+ * @param frames Camera frames, replaced by their resized versions
+ * @param display_sizes Display size of each frame
+ * @param composed Frames side by side
+ */
+inline void compose_frames(std::vector<cv::Mat>& frames, const std::vector<cv::Size>& display_sizes, cv::Mat& composed)
+{
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        if (frames[i].size() == display_sizes[i])
+            continue;
+
+        TraceSpan span("resize", static_cast<int>(i));
+        cv::resize(frames[i], frames[i], display_sizes[i]);
+    }
+
+    // Dislay side by side
+    TraceSpan span("compose");
+    cv::hconcat(frames, composed);
+}
+
+/**
+ * @brief Downscale each camera frame in place and lay them out side by side.
+ *
+ * @param frames Camera frames, replaced by their downscaled versions
+ * @param downscale_factors Downscale factor of each frame
+ * @param composed Frames side by side
+ */
+inline void compose_frames(std::vector<cv::Mat>& frames, const std::vector<int>& downscale_factors, cv::Mat& composed)
+{
+    std::vector<cv::Size> display_sizes;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        display_sizes.emplace_back(frames[i].cols / downscale_factors[i], frames[i].rows / downscale_factors[i]);
+    }
+    compose_frames(frames, display_sizes, composed);
+}
@@ -0,0 +1,205 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "telicam_worker.hpp"
+
+FrameWorker::FrameWorker(const Options& options, size_t buffer_size, Handler handler)
+    : options(options)
+    , handler(std::move(handler))
+    , num_slots(options.queue_depth > 0 ? options.queue_depth : 1)
+    , buffer_size(buffer_size)
+    , queue_head(0)
+    , queue_tail(0)
+    , stopping(false)
+    , ready(false)
+    , dropped_frames(0)
+    , oversized_frames(0)
+{
+    slots.reset(new Slot[num_slots]);
+    queue.reset(new uint32_t[num_slots]);
+
+    // Without NUMA-local buffers the pages are touched here, on the thread that opened the stream
+    if (!options.numa_local_buffers)
+    {
+        for (uint32_t i = 0; i < num_slots; ++i)
+        {
+            slots[i].buffer.resize(buffer_size);
+        }
+    }
+
+    thread = std::thread(&FrameWorker::run, this, buffer_size);
+
+    std::unique_lock<std::mutex> lock(ready_mutex);
+    ready_cv.wait(lock, [this] { return ready; });
+    if (!setup_error.empty())
+    {
+        lock.unlock();
+        thread.join();
+        throw std::runtime_error(setup_error);
+    }
+}
+
+FrameWorker::~FrameWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cv.notify_one();
+
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+bool FrameWorker::submit(const RawFrame& raw)
+{
+    // Buffers are sized for the stream's payload, and growing one here would allocate on the SDK callback thread
+    if (raw.size > buffer_size)
+    {
+        oversized_frames.fetch_add(1, std::memory_order_relaxed);
+        dropped_frames.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t index = 0;
+    for (; index < num_slots; ++index)
+    {
+        int expected = SLOT_FREE;
+        if (slots[index].state.compare_exchange_strong(expected, SLOT_FILLING, std::memory_order_acquire))
+            break;
+    }
+
+    if (index == num_slots)
+    {
+        dropped_frames.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Slot& slot = slots[index];
+    std::memcpy(slot.buffer.data(), raw.data, raw.size);
+    slot.raw = raw;
+    slot.raw.data = slot.buffer.data();
+    slot.state.store(SLOT_READY, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue[queue_tail++ % num_slots] = index;
+    }
+    queue_cv.notify_one();
+
+    return true;
+}
+
+uint64_t FrameWorker::get_dropped_frames() const
+{
+    return dropped_frames.load(std::memory_order_relaxed);
+}
+
+uint64_t FrameWorker::get_oversized_frames() const
+{
+    return oversized_frames.load(std::memory_order_relaxed);
+}
+
+StageTiming FrameWorker::get_handoff_timing() const
+{
+    return handoff_timer.get_timing();
+}
+
+void FrameWorker::configure_thread()
+{
+    pthread_setname_np(pthread_self(), options.name.substr(0, 15).c_str());
+
+    if (!options.cpu_affinity.empty())
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (int cpu : options.cpu_affinity)
+        {
+            CPU_SET(cpu, &cpu_set);
+        }
+
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+        if (result != 0)
+        {
+            std::stringstream ss;
+            ss << "Failed to set worker CPU affinity: " << std::strerror(result);
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+    if (options.priority > 0)
+    {
+        sched_param param;
+        param.sched_priority = options.priority;
+
+        int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (result != 0)
+        {
+            std::stringstream ss;
+            ss << "Failed to set worker SCHED_FIFO priority " << options.priority << ": " << std::strerror(result);
+            throw std::runtime_error(ss.str());
+        }
+    }
+}
+
+void FrameWorker::run(size_t buffer_size)
+{
+    try
+    {
+        configure_thread();
+
+        // Touch the buffers from the pinned worker so their pages are placed on its NUMA node
+        if (options.numa_local_buffers)
+        {
+            for (uint32_t i = 0; i < num_slots; ++i)
+            {
+                slots[i].buffer.resize(buffer_size);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        setup_error = e.what();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ready_mutex);
+        ready = true;
+    }
+    ready_cv.notify_one();
+
+    if (!setup_error.empty())
+        return;
+
+    while (true)
+    {
+        uint32_t index;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this] { return stopping || queue_head != queue_tail; });
+            if (stopping)
+                return;
+
+            index = queue[queue_head++ % num_slots];
+        }
+
+        Slot& slot = slots[index];
+        handoff_timer.record(monotonic_ns() - slot.raw.receive_ns);
+        try
+        {
+            handler(slot.raw);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "TeliCam worker " << options.name << ": " << e.what() << std::endl;
+        }
+        slot.state.store(SLOT_FREE, std::memory_order_release);
+    }
+}